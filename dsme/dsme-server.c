@@ -39,14 +39,17 @@
 #include "../include/dsme/dsmesock.h"
 #include <dsme/protocol.h>
 #include "../include/dsme/logging.h"
+#include "../include/dsme/logtrace.h"
 #include <dsme/messages.h>
 #include "../include/dsme/oom.h"
+#include "../include/dsme/wakelock.h"
 
 #include <glib.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <dlfcn.h>
 #include <unistd.h>
@@ -78,8 +81,12 @@ static void usage(const char *  progname)
   fprintf(stderr, "Valid options:\n");
 #ifdef DSME_LOG_ENABLE
   fprintf(stderr, " -l  --logging     "
-                    "Logging type (syslog, sti, stderr, stdout, none)\n");
+                    "Logging type (syslog, journal, sti, stderr, stdout, none)\n");
   fprintf(stderr, " -v  --verbosity   Log verbosity (3..7)\n");
+  fprintf(stderr, " -R  --log-rotate-size <KiB>  "
+                    "Rotate log file when it exceeds given size\n");
+  fprintf(stderr, " -G  --log-generations <N>   "
+                    "Number of rotated log files to keep\n");
 #endif
 #ifdef DSME_SYSTEMD_ENABLE
   fprintf(stderr, " -s  --systemd     "
@@ -107,6 +114,8 @@ void signal_handler(int sig)
 #ifdef DSME_LOG_ENABLE
 static int        logging_verbosity = LOG_NOTICE;
 static log_method logging_method    = LOG_METHOD_SYSLOG;
+static size_t     logging_rotate_size = DSME_LOG_FILE_MAX_SIZE;
+static int        logging_generations = DSME_LOG_FILE_GENERATIONS;
 #endif
 #ifdef DSME_SYSTEMD_ENABLE
 static int signal_systemd = 0;
@@ -118,7 +127,7 @@ static void parse_options(int      argc,           /* in  */
 {
   int          next_option;
   const char*  program_name  = argv[0];
-  const char*  short_options = "dhsp:l:v:";
+  const char*  short_options = "dhsp:l:v:R:G:";
   const struct option long_options[] = {
         { "startup-module", 1, NULL, 'p' },
         { "help",           0, NULL, 'h' },
@@ -128,6 +137,8 @@ static void parse_options(int      argc,           /* in  */
 #endif
 #ifdef DSME_LOG_ENABLE  
         { "logging",        0, NULL, 'l' },
+        { "log-rotate-size", 1, NULL, 'R' },
+        { "log-generations", 1, NULL, 'G' },
 #endif
         { 0, 0, 0, 0 }
   };
@@ -153,7 +164,8 @@ static void parse_options(int      argc,           /* in  */
               "stdout", /* LOG_METHOD_STDOUT */
               "stderr", /* LOG_METHOD_STDERR */
               "syslog", /* LOG_METHOD_SYSLOG */
-              "file"    /* LOG_METHOD_FILE */
+              "file",   /* LOG_METHOD_FILE */
+              "journal" /* LOG_METHOD_JOURNAL */
           };
           int i;
 
@@ -173,9 +185,17 @@ static void parse_options(int      argc,           /* in  */
           if (strlen(optarg) == 1 && isdigit(optarg[0]))
               logging_verbosity = atoi(optarg);
           break;
+        case 'R': /* -R or --log-rotate-size */
+          logging_rotate_size = strtoul(optarg, 0, 0) * 1024;
+          break;
+        case 'G': /* -G or --log-generations */
+          logging_generations = atoi(optarg);
+          break;
 #else
         case 'l':
         case 'v':
+        case 'R':
+        case 'G':
           fprintf(stderr, ME "Logging not compiled in\n");
           break;
 #endif  
@@ -215,7 +235,14 @@ static bool receive_and_queue_message(dsmesock_connection_t* conn)
       } else if ((logging = DSMEMSG_CAST(DSM_MSGTYPE_SET_LOGGING_VERBOSITY,
                                          msg)))
       {
-          dsme_log_set_verbosity(logging->verbosity);
+          const char *module = DSMEMSG_EXTRA(logging);
+          size_t      size   = DSMEMSG_EXTRA_SIZE(logging);
+
+          if (module && size > 0 && memchr(module, 0, size)) {
+              dsme_log_set_module_verbosity(module, logging->verbosity);
+          } else {
+              dsme_log_set_verbosity(logging->verbosity);
+          }
       }
       free(msg);
   }
@@ -269,6 +296,8 @@ int main(int argc, char *argv[])
   }
 
 #ifdef DSME_LOG_ENABLE
+  dsme_log_set_file_rotation(logging_rotate_size, logging_generations);
+  dsme_log_set_trace_file(DSME_TRACE_FILE);
   dsme_log_open(logging_method,
                 logging_verbosity,
                 0,
@@ -278,6 +307,9 @@ int main(int argc, char *argv[])
                 "/var/log/dsme.log");
 #endif
 
+  /* keep wakelock sysfs files open for modules to use */
+  dsme_wakelock_init();
+
   /* load modules */
   if (!modulebase_init(module_names)) {
       g_slist_free(module_names);
@@ -318,6 +350,8 @@ int main(int argc, char *argv[])
 
   modulebase_shutdown();
 
+  dsme_wakelock_quit();
+
 #ifdef DSME_LOG_ENABLE
   dsme_log_close();
 #endif
@@ -32,6 +32,7 @@
 #include "dsme-wdd.h"
 #include "dsme-wdd-wd.h"
 #include "../include/dsme/oom.h"
+#include "../include/dsme/wakelock.h"
 
 #include <unistd.h>
 #include <stdio.h>
@@ -445,21 +446,6 @@ EXIT:
  */
 #define DSME_RESTART_WAKELOCK "dsme_restart"
 
-/** Sysfs helper for wakelock manipulation
- */
-static void wakelock_write(const char *path, const char *data, size_t size)
-{
-    // NOTE: called from signal handler - must stay async-signal-safe
-
-    int fd = open(path, O_WRONLY);
-    if( fd != -1 ) {
-        if( write(fd, data, size) == -1 ) {
-            /* dontcare, but need to keep the compiler happy */
-        }
-        close(fd);
-    }
-}
-
 /** Get restart wakelock
  *
  * Used for blocking suspend for one minute when dsme restart
@@ -469,9 +455,8 @@ static void obtain_restart_wakelock(void)
 {
     // NOTE: called from signal handler - must stay async-signal-safe
 
-    static const char path[] = "/sys/power/wake_lock";
     static const char text[] = DSME_RESTART_WAKELOCK " 60000000000\n";
-    wakelock_write(path, text, sizeof text - 1);
+    dsme_wakelock_write(true, text, sizeof text - 1);
 }
 
 /** Clear restart wakelock
@@ -480,9 +465,8 @@ static void obtain_restart_wakelock(void)
  */
 static void release_restart_wakelock(void)
 {
-    static const char path[] = "/sys/power/wake_unlock";
     static const char text[] = DSME_RESTART_WAKELOCK "\n";
-    wakelock_write(path, text, sizeof text - 1);
+    dsme_wakelock_write(false, text, sizeof text - 1);
 }
 
 /** Set wakelock before invoking default signal handler
@@ -597,6 +581,12 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    // keep wakelock sysfs files open, so that they can be
+    // used from signal handler without opening anything
+    if (!dsme_wakelock_init()) {
+        fprintf(stderr, ME "wakelocks not supported\n");
+    }
+
     // open communication pipes
     int to_child[2];
     int from_child[2];
@@ -706,6 +696,8 @@ int main(int argc, char *argv[])
     else
         release_restart_wakelock();
 
+    dsme_wakelock_quit();
+
     fprintf(stderr, "DSME %s terminating\n", STRINGIFY(PRG_VERSION));
     return dsme_abnormal_exit ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -26,16 +26,25 @@
 #define _GNU_SOURCE // TODO: should these be put to makefile?
 
 #include "../include/dsme/logging.h"
+#include "../include/dsme/modulebase.h"
+#include "../include/dsme/logtrace.h"
 
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stdint.h>
 #include <fcntl.h>
+#include <endian.h>
 #include <errno.h>
 #include <sys/syslog.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <asm/types.h>
 #include <linux/netlink.h>
 
@@ -51,7 +60,7 @@
 /* Function prototypes */
 static void log_to_null(int prio, const char* message);
 static void log_to_stderr(int prio, const char* message);
-static int deque_log_buffer(volatile unsigned *p_read_count);
+static int deque_log_buffer(unsigned *p_read_count);
 
 /* This variable holds the address of the logging functions */
 static void (*dsme_log_routine)(int prio, const char* message) =
@@ -62,35 +71,65 @@ static struct {
     int         verbosity; /* Verbosity level (corresponding to LOG_*) */
     int         usetime;   /* Timestamps on/off */
     const char* prefix;    /* Message prefix */
-    FILE*       filep;     /* Log file stream */
     int         sock;      /* Netlink socket for STI method */
     int         channel;   /* Channel number for STI method */
-} logopt = { LOG_METHOD_STDERR, LOG_NOTICE, 0, "DSME", NULL };
+} logopt = { LOG_METHOD_STDERR, LOG_NOTICE, 0, "DSME", -1 };
 
 
-#define DSME_MAX_LOG_MESSAGE_LENGTH 123
-#define DSME_MAX_LOG_BUFFER_ENTRIES 128 /* must be a power of 2! */
+#define DSME_MAX_LOG_MESSAGE_LENGTH 255
 
+/* Size of the log ring buffer in bytes; can be overridden at configure
+ * time with --with-log-buffer-size. Must be a power of 2. The default
+ * uses the same amount of memory as the old 128 x 128 byte entry ring,
+ * but since records are variable length it holds far more messages. */
+#ifndef DSME_LOG_BUFFER_SIZE
+# define DSME_LOG_BUFFER_SIZE (16 * 1024)
+#endif
+
+#if DSME_LOG_BUFFER_SIZE < 1024 || (DSME_LOG_BUFFER_SIZE & (DSME_LOG_BUFFER_SIZE - 1))
+# error DSME_LOG_BUFFER_SIZE must be a power of 2 and at least 1024
+#endif
+
+/* Records are aligned so that headers can be accessed atomically */
+#define LOG_ENTRY_ALIGN   8
+#define LOG_ENTRY_PADDING (-1000) /* prio used for wrap around fillers */
+
+/* Variable length log record.
+ *
+ * The size field doubles as commit flag: it is written last by the
+ * producer. After the record has been passed to the logging backend,
+ * the consumer zeroes the whole record, so that whatever record later
+ * gets placed over it finds a zero size until it is committed. */
 typedef struct log_entry {
-    int  prio;
-    char message[DSME_MAX_LOG_MESSAGE_LENGTH + 1];
+    uint32_t size;      /* Record size in bytes, zero while incomplete */
+    int32_t  prio;      /* LOG_* level or LOG_ENTRY_PADDING */
+    uint32_t msgtype;   /* Message being handled, journal method only */
+    int32_t  pid;       /* Client that sent it, journal method only */
+    char     message[]; /* Zero terminated message text, followed by
+                         * zero terminated module name */
 } log_entry;
 
 /* ring buffer for log entries */
-static log_entry ring_buffer[DSME_MAX_LOG_BUFFER_ENTRIES];
-
-/* ring buffer access counters */
+static char ring_buffer[DSME_LOG_BUFFER_SIZE]
+    __attribute__((aligned(LOG_ENTRY_ALIGN)));
 
 /* ring buffer semaphore */
 static sem_t ring_buffer_sem;
 
-/* ring buffer write and read counters */
-static volatile unsigned write_count = 0;
-static volatile unsigned read_count  = 0;
+/* ring buffer write and read counters
+ *
+ * Both are byte offsets that are allowed to wrap around. Producers
+ * reserve space by advancing write_count with compare-and-swap, only
+ * the logging thread (or dsme_log_close() after the thread has been
+ * stopped) advances read_count. */
+static unsigned write_count = 0;
+static unsigned read_count  = 0;
 
 /* Thread enable & status */
 static volatile int thread_enabled = 0;
 static volatile int thread_running = 0;
+static bool         thread_created = false;
+static pthread_t    thread_id;
 
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 // SIMO HACKING
@@ -152,45 +191,43 @@ static void log_to_null(int prio, const char* message)
 static void log_to_sti(int prio, const char* message)
 {
     if (logopt.sock != -1) {
-        if (logopt.verbosity >= prio) {
-            char buf[256];
-            int len;
-            struct nlmsghdr nlh;
-            struct sockaddr_nl snl;
-
-            if (prio >= 0) {
-                snprintf(buf,
-                         sizeof(buf),
-                         "%s %s: ",
-                         logopt.prefix,
-                         log_prio_str(prio));
-            }
-            len = strlen(buf);
-            snprintf(buf+len, sizeof(buf)-len, "%s", message);
-            len = strlen(buf);
-
-            struct iovec iov[2];
-            iov[0].iov_base = &nlh;
-            iov[0].iov_len  = sizeof(struct nlmsghdr);
-            iov[1].iov_base = buf;
-            iov[1].iov_len  = len;
-
-            struct msghdr msg;
-            msg.msg_name    = (void *)&snl;
-            msg.msg_namelen = sizeof(struct sockaddr_nl);
-            msg.msg_iov     = iov;
-            msg.msg_iovlen  = sizeof(iov)/sizeof(*iov);
-            msg.msg_flags = 0;
-
-            memset(&snl, 0, sizeof(struct sockaddr_nl));
-
-            snl.nl_family   = AF_NETLINK;
-            nlh.nlmsg_len   = NLMSG_LENGTH(len);
-            nlh.nlmsg_type  = (0xC0 << 8) | (1 << 0); /* STI Write */
-            nlh.nlmsg_flags = (logopt.channel << 8);
-
-            sendmsg(logopt.sock, &msg, 0);
+        char buf[256];
+        int len;
+        struct nlmsghdr nlh;
+        struct sockaddr_nl snl;
+
+        if (prio >= 0) {
+            snprintf(buf,
+                     sizeof(buf),
+                     "%s %s: ",
+                     logopt.prefix,
+                     log_prio_str(prio));
         }
+        len = strlen(buf);
+        snprintf(buf+len, sizeof(buf)-len, "%s", message);
+        len = strlen(buf);
+
+        struct iovec iov[2];
+        iov[0].iov_base = &nlh;
+        iov[0].iov_len  = sizeof(struct nlmsghdr);
+        iov[1].iov_base = buf;
+        iov[1].iov_len  = len;
+
+        struct msghdr msg;
+        msg.msg_name    = (void *)&snl;
+        msg.msg_namelen = sizeof(struct sockaddr_nl);
+        msg.msg_iov     = iov;
+        msg.msg_iovlen  = sizeof(iov)/sizeof(*iov);
+        msg.msg_flags = 0;
+
+        memset(&snl, 0, sizeof(struct sockaddr_nl));
+
+        snl.nl_family   = AF_NETLINK;
+        nlh.nlmsg_len   = NLMSG_LENGTH(len);
+        nlh.nlmsg_type  = (0xC0 << 8) | (1 << 0); /* STI Write */
+        nlh.nlmsg_flags = (logopt.channel << 8);
+
+        sendmsg(logopt.sock, &msg, 0);
     } else {
         fprintf(stderr, "dsme trace: ");
         fprintf(stderr, "%s", message);
@@ -203,12 +240,10 @@ static void log_to_sti(int prio, const char* message)
  */
 static void log_to_stdout(int prio, const char* message)
 {
-    if (logopt.verbosity >= prio) {
-        if (prio >= 0) {
-            fprintf(stdout, "%s %s: ", logopt.prefix, log_prio_str(prio));
-        }
-        fprintf(stdout, "%s\n", message);
+    if (prio >= 0) {
+        fprintf(stdout, "%s %s: ", logopt.prefix, log_prio_str(prio));
     }
+    fprintf(stdout, "%s\n", message);
 }
 
 
@@ -217,12 +252,10 @@ static void log_to_stdout(int prio, const char* message)
  */
 static void log_to_stderr(int prio, const char* message)
 {
-    if (logopt.verbosity >= prio) {
-        if (prio >= 0) {
-            fprintf(stderr, "%s %s: ", logopt.prefix, log_prio_str(prio));
-        }
-        fprintf(stderr, "%s\n", message);
+    if (prio >= 0) {
+        fprintf(stderr, "%s %s: ", logopt.prefix, log_prio_str(prio));
     }
+    fprintf(stderr, "%s\n", message);
 }
 
 
@@ -231,77 +264,1022 @@ static void log_to_stderr(int prio, const char* message)
  */
 static void log_to_syslog(int prio, const char* message)
 {
-    if (logopt.verbosity >= prio) {
-        if (prio < 0) prio = LOG_DEBUG;
-        syslog(prio, "%s", message);
+    if (prio < 0) prio = LOG_DEBUG;
+    syslog(prio, "%s", message);
+}
+
+
+/*
+ * Buffered file sink
+ *
+ * Formatted records are collected into a staging buffer and written
+ * out with a single writev() call once enough data has accumulated,
+ * the oldest pending record gets too old, or a critical message is
+ * logged. The log file is rotated when it grows past the configured
+ * size limit.
+ */
+
+#define LOG_FILE_BUFFER_SIZE    (8 * 1024) /* staging buffer size */
+#define LOG_FILE_MAX_RECORDS    64         /* records per writev() */
+#define LOG_FILE_FLUSH_DELAY_MS 2000       /* max age of pending data */
+
+static struct {
+    char*        path;        /* Log file path */
+    int          fd;          /* Log file descriptor */
+    off_t        size;        /* Current log file size */
+    off_t        max_size;    /* Rotate when exceeded, 0 = never */
+    int          generations; /* Number of rotated files to keep */
+    char*        header[LOG_DEBUG + 1]; /* "prefix level: " per prio */
+    struct iovec iov[2 * LOG_FILE_MAX_RECORDS];
+    int          iovcnt;
+    char         data[LOG_FILE_BUFFER_SIZE];
+    size_t       used;
+    int64_t      first_ms;    /* Monotonic time of oldest pending record */
+} logfile = {
+    .fd          = -1,
+    .max_size    = DSME_LOG_FILE_MAX_SIZE,
+    .generations = DSME_LOG_FILE_GENERATIONS,
+};
+
+static int64_t log_file_monotime_ms(void)
+{
+    struct timespec ts = { 0, 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000) + ts.tv_nsec / 1000000;
+}
+
+static bool log_file_open(void)
+{
+    struct stat st;
+
+    logfile.fd = open(logfile.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                      0644);
+    if( logfile.fd == -1 ) {
+        fprintf(stderr, "Can't create log file %s (%s)\n",
+                logfile.path, strerror(errno));
+        return false;
+    }
+
+    logfile.size = (fstat(logfile.fd, &st) == 0) ? st.st_size : 0;
+    return true;
+}
+
+static void log_file_rotate(void)
+{
+    size_t size = strlen(logfile.path) + 16;
+    char   src[size];
+    char   dst[size];
+
+    close(logfile.fd), logfile.fd = -1;
+
+    if( logfile.generations < 1 ) {
+        unlink(logfile.path);
     }
+    else {
+        for( int i = logfile.generations - 1; i > 0; --i ) {
+            snprintf(src, size, "%s.%d", logfile.path, i);
+            snprintf(dst, size, "%s.%d", logfile.path, i + 1);
+            rename(src, dst);
+        }
+        snprintf(dst, size, "%s.1", logfile.path);
+        rename(logfile.path, dst);
+    }
+
+    log_file_open();
 }
 
+static void log_file_flush(void)
+{
+    struct iovec *iov = logfile.iov;
+    int           cnt = logfile.iovcnt;
+
+    while( cnt > 0 && logfile.fd != -1 ) {
+        ssize_t rc = writev(logfile.fd, iov, cnt);
+
+        if( rc < 0 ) {
+            if( errno == EINTR )
+                continue;
+            break;
+        }
+
+        logfile.size += rc;
+
+        /* Skip fully written parts, adjust partially written one */
+        while( cnt > 0 && (size_t)rc >= iov->iov_len )
+            rc -= iov->iov_len, ++iov, --cnt;
+        if( cnt > 0 ) {
+            iov->iov_base = (char *)iov->iov_base + rc;
+            iov->iov_len -= rc;
+        }
+    }
+
+    logfile.iovcnt = 0;
+    logfile.used   = 0;
+
+    if( logfile.fd != -1 && logfile.max_size > 0 &&
+        logfile.size >= logfile.max_size )
+        log_file_rotate();
+}
+
+/*
+ * Returns milliseconds until pending data must be written out,
+ * or -1 if there is nothing pending
+ */
+static int log_file_flush_timeout(void)
+{
+    if( logfile.iovcnt == 0 )
+        return -1;
+
+    int64_t left = logfile.first_ms + LOG_FILE_FLUSH_DELAY_MS -
+        log_file_monotime_ms();
+
+    return (left < 0) ? 0 : (int)left;
+}
 
 /*
  * This routine is used when file logging method is set
  */
 static void log_to_file(int prio, const char* message)
 {
-    if (logopt.verbosity >= prio) {
-        if (prio >= 0)
-            fprintf(logopt.filep, "%s %s: ", logopt.prefix, log_prio_str(prio));
-        fprintf(logopt.filep, "%s\n", message);
-        fflush(logopt.filep);
+    size_t len = strlen(message) + 1;
+
+    if( len > sizeof logfile.data )
+        len = sizeof logfile.data;
+
+    if( logfile.used + len > sizeof logfile.data ||
+        logfile.iovcnt + 2 > (int)(sizeof logfile.iov / sizeof *logfile.iov) )
+        log_file_flush();
+
+    if( logfile.iovcnt == 0 )
+        logfile.first_ms = log_file_monotime_ms();
+
+    if( prio >= 0 && prio <= LOG_DEBUG && logfile.header[prio] ) {
+        struct iovec *iov = &logfile.iov[logfile.iovcnt++];
+        iov->iov_base = logfile.header[prio];
+        iov->iov_len  = strlen(logfile.header[prio]);
     }
+
+    char *text = logfile.data + logfile.used;
+    memcpy(text, message, len - 1);
+    text[len - 1] = '\n';
+    logfile.used += len;
+
+    struct iovec *iov = &logfile.iov[logfile.iovcnt++];
+    iov->iov_base = text;
+    iov->iov_len  = len;
+
+    if( prio >= 0 && prio <= LOG_CRIT )
+        log_file_flush();
+}
+
+/*
+ * Sets log file size limit and number of rotated files to keep.
+ * Must be called before dsme_log_open(). A zero size disables rotation.
+ */
+void dsme_log_set_file_rotation(size_t max_size, int generations)
+{
+    logfile.max_size    = max_size;
+    logfile.generations = generations;
+}
+
+static bool log_file_init(const char* filename)
+{
+    if( !(logfile.path = strdup(filename)) )
+        return false;
+
+    for( int prio = 0; prio <= LOG_DEBUG; ++prio ) {
+        if( asprintf(&logfile.header[prio], "%s %s: ",
+                     logopt.prefix, log_prio_str(prio)) < 0 )
+            logfile.header[prio] = 0;
+    }
+
+    return log_file_open();
+}
+
+static void log_file_quit(void)
+{
+    log_file_flush();
+
+    if( logfile.fd != -1 )
+        close(logfile.fd), logfile.fd = -1;
+
+    for( int prio = 0; prio <= LOG_DEBUG; ++prio )
+        free(logfile.header[prio]), logfile.header[prio] = 0;
+
+    free(logfile.path), logfile.path = 0;
 }
 
 
 /*
- * This function is the main entry point for logging.
- * It writes log entries to a ring buffer that the logging thread reads.
+ * Native journal sink
+ *
+ * Entries are sent to journald as datagrams using the native protocol,
+ * with the module, message type and client pid captured at the time
+ * of logging as structured fields. Entries are collected while the
+ * logging thread drains the ring buffer and sent with sendmmsg().
  */
-void dsme_log_txt(int level, const char* fmt, ...)
+
+#define LOG_JOURNAL_SOCKET    "/run/systemd/journal/socket"
+#define LOG_JOURNAL_BATCH     16
+#define LOG_JOURNAL_ENTRY_MAX 768
+
+static struct {
+    int                fd;
+    struct sockaddr_un addr;
+    struct mmsghdr     msg[LOG_JOURNAL_BATCH];
+    struct iovec       iov[LOG_JOURNAL_BATCH];
+    char               data[LOG_JOURNAL_BATCH][LOG_JOURNAL_ENTRY_MAX];
+    int                count;
+} logjournal = { .fd = -1 };
+
+static bool log_journal_open(void)
 {
-    static bool     overflow = false;
-    static unsigned skipped  = 0;
+    logjournal.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (logjournal.fd == -1)
+        return false;
 
-    log_entry* entry;
+    logjournal.addr.sun_family = AF_UNIX;
+    strncpy(logjournal.addr.sun_path, LOG_JOURNAL_SOCKET,
+            sizeof logjournal.addr.sun_path - 1);
 
-    /* Do verbosity filtering first */
-    if( logopt.verbosity < level )
-	goto EXIT;
+    if (access(LOG_JOURNAL_SOCKET, W_OK) == -1) {
+        close(logjournal.fd), logjournal.fd = -1;
+        return false;
+    }
+
+    for (int i = 0; i < LOG_JOURNAL_BATCH; ++i) {
+        struct msghdr* hdr = &logjournal.msg[i].msg_hdr;
+        hdr->msg_name    = &logjournal.addr;
+        hdr->msg_namelen = sizeof logjournal.addr;
+        hdr->msg_iov     = &logjournal.iov[i];
+        hdr->msg_iovlen  = 1;
+        logjournal.iov[i].iov_base = logjournal.data[i];
+    }
 
-    /* Handle ring buffer overflows */
-    unsigned buffered = write_count - read_count;
+    return true;
+}
 
-    if( buffered >= DSME_MAX_LOG_BUFFER_ENTRIES ) {
-	overflow = true;
-	++skipped;
-	goto EXIT;
+static void log_journal_flush(void)
+{
+    int done = 0;
+
+    while (done < logjournal.count) {
+        int rc = sendmmsg(logjournal.fd, logjournal.msg + done,
+                          logjournal.count - done, 0);
+        if (rc <= 0) {
+            if (rc == -1 && errno == EINTR)
+                continue;
+            break;
+        }
+        done += rc;
+    }
+
+    logjournal.count = 0;
+}
+
+static void log_journal_close(void)
+{
+    if (logjournal.fd != -1) {
+        log_journal_flush();
+        close(logjournal.fd), logjournal.fd = -1;
+    }
+}
+
+static void log_to_journal(const log_entry* entry)
+{
+    if (logjournal.count >= LOG_JOURNAL_BATCH)
+        log_journal_flush();
+
+    char*       buf    = logjournal.data[logjournal.count];
+    size_t      size   = LOG_JOURNAL_ENTRY_MAX;
+    size_t      used   = 0;
+    const char* text   = entry->message;
+    const char* module = text + strlen(text) + 1;
+    size_t      len    = strlen(text);
+    int         prio   = (entry->prio < 0) ? LOG_DEBUG : entry->prio;
+
+    while (len > 0 && text[len - 1] == '\n')
+        --len;
+
+    used += snprintf(buf + used, size - used,
+                     "PRIORITY=%d\nSYSLOG_IDENTIFIER=%s\n",
+                     prio, logopt.prefix);
+    if (*module)
+        used += snprintf(buf + used, size - used,
+                         "DSME_MODULE=%s\n", module);
+    if (entry->msgtype)
+        used += snprintf(buf + used, size - used,
+                         "DSME_MSGTYPE=0x%08x\n", (unsigned)entry->msgtype);
+    if (entry->pid > 0)
+        used += snprintf(buf + used, size - used,
+                         "DSME_CLIENT_PID=%d\n", (int)entry->pid);
+
+    /* Multiline messages need the length prefixed form */
+    if (used + len + 32 > size)
+        len = size - used - 32;
+
+    if (memchr(text, '\n', len)) {
+        uint64_t le = htole64(len);
+        memcpy(buf + used, "MESSAGE\n", 8), used += 8;
+        memcpy(buf + used, &le, sizeof le), used += sizeof le;
+    } else {
+        memcpy(buf + used, "MESSAGE=", 8), used += 8;
+    }
+    memcpy(buf + used, text, len), used += len;
+    buf[used++] = '\n';
+
+    logjournal.iov[logjournal.count].iov_len = used;
+    logjournal.count += 1;
+}
+
+
+/*
+ * Crash persistent trace ring
+ *
+ * All records that pass through the logging thread are mirrored into
+ * an mmap'd ring file, see logtrace.h for the format. No syscalls are
+ * made per record. Error and more severe records are synced to storage
+ * right away, others get scheduled for writeback at most
+ * LOG_TRACE_SYNC_DELAY_MS after they were appended - that is how much
+ * of the trail a hardware reset or power loss can take out.
+ */
+
+#define LOG_TRACE_SYNC_DELAY_MS 1000
+
+static struct {
+    int                  fd;
+    char*                map;
+    dsme_trace_header_t* hdr;
+    char*                data;
+    int64_t              dirty_ms; /* Time of oldest unsynced record, or 0 */
+} logtrace = { -1, 0, 0, 0, 0 };
+
+static const char* log_trace_file = 0;
+
+static void log_trace_get_boot_id(char* buf, size_t size)
+{
+    int     fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+    ssize_t rc = (fd == -1) ? -1 : read(fd, buf, size - 1);
+
+    if (rc < 0) rc = 0;
+    buf[rc] = 0;
+    buf[strcspn(buf, "\n")] = 0;
+
+    if (fd != -1) close(fd);
+}
+
+/*
+ * Checks whether an existing trace file is usable as is
+ */
+static bool log_trace_header_is_valid(const dsme_trace_header_t* hdr)
+{
+    return (!memcmp(hdr->magic, DSME_TRACE_MAGIC, sizeof hdr->magic) &&
+            hdr->header_size == DSME_TRACE_HEADER_SIZE &&
+            hdr->data_size   == DSME_TRACE_DATA_SIZE &&
+            hdr->write_pos   <  DSME_TRACE_DATA_SIZE &&
+            hdr->write_pos % DSME_TRACE_ALIGN == 0);
+}
+
+static bool log_trace_open(const char* path)
+{
+    dsme_trace_header_t old;
+    char                boot_id[sizeof old.boot_id];
+    struct stat         st;
+    bool                reuse = false;
+
+    log_trace_get_boot_id(boot_id, sizeof boot_id);
+
+    if ((logtrace.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1)
+        goto FAIL;
+
+    memset(&old, 0, sizeof old);
+    if (fstat(logtrace.fd, &st) == 0 && st.st_size == DSME_TRACE_FILE_SIZE &&
+        pread(logtrace.fd, &old, sizeof old, 0) == sizeof old &&
+        log_trace_header_is_valid(&old))
+    {
+        /* Continue the trail left by a previous dsme-server instance
+         * of the same boot, preserve trail from earlier boots */
+        old.boot_id[sizeof old.boot_id - 1] = 0;
+        if (!strcmp(old.boot_id, boot_id)) {
+            reuse = true;
+        } else {
+            size_t size = strlen(path) + 8;
+            char   prev[size];
+            snprintf(prev, size, "%s.prev", path);
+            rename(path, prev);
+            close(logtrace.fd);
+            logtrace.fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                               0644);
+            if (logtrace.fd == -1)
+                goto FAIL;
+        }
+    }
+
+    if (!reuse && ftruncate(logtrace.fd, 0) == -1)
+        goto FAIL;
+    if (ftruncate(logtrace.fd, DSME_TRACE_FILE_SIZE) == -1)
+        goto FAIL;
+
+    logtrace.map = mmap(0, DSME_TRACE_FILE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, logtrace.fd, 0);
+    if (logtrace.map == MAP_FAILED) {
+        logtrace.map = 0;
+        goto FAIL;
     }
 
+    logtrace.hdr  = (dsme_trace_header_t*)logtrace.map;
+    logtrace.data = logtrace.map + DSME_TRACE_HEADER_SIZE;
+
+    if (!reuse) {
+        /* File was truncated, i.e. contents are zero filled */
+        logtrace.hdr->header_size = DSME_TRACE_HEADER_SIZE;
+        logtrace.hdr->data_size   = DSME_TRACE_DATA_SIZE;
+        strncpy(logtrace.hdr->boot_id, boot_id,
+                sizeof logtrace.hdr->boot_id - 1);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(logtrace.hdr->magic, DSME_TRACE_MAGIC,
+               sizeof logtrace.hdr->magic);
+    }
+
+    return true;
+
+FAIL:
+    fprintf(stderr, "Can't open trace file %s (%s)\n", path, strerror(errno));
+    if (logtrace.fd != -1)
+        close(logtrace.fd), logtrace.fd = -1;
+    return false;
+}
+
+/*
+ * Pushes appended records towards storage; if wait is true, returns
+ * only after the data has been written
+ */
+static void log_trace_sync(bool wait)
+{
+    if (logtrace.map)
+        msync(logtrace.map, DSME_TRACE_FILE_SIZE, wait ? MS_SYNC : MS_ASYNC);
+    logtrace.dirty_ms = 0;
+}
+
+/*
+ * Returns milliseconds until appended records must be synced,
+ * or -1 if there is nothing pending
+ */
+static int log_trace_sync_timeout(void)
+{
+    if (!logtrace.dirty_ms)
+        return -1;
+
+    int64_t left = logtrace.dirty_ms + LOG_TRACE_SYNC_DELAY_MS -
+        log_file_monotime_ms();
+
+    return (left < 0) ? 0 : (int)left;
+}
+
+static void log_trace_close(void)
+{
+    if (logtrace.map) {
+        log_trace_sync(true);
+        munmap(logtrace.map, DSME_TRACE_FILE_SIZE);
+    }
+    if (logtrace.fd != -1)
+        close(logtrace.fd);
+
+    logtrace.fd   = -1;
+    logtrace.map  = 0;
+    logtrace.hdr  = 0;
+    logtrace.data = 0;
+}
+
+static void log_trace_append(int prio, const char* message)
+{
+    struct timespec ts = { 0, 0 };
+    size_t          len = strnlen(message, DSME_TRACE_MAX_TEXT - 1) + 1;
+    uint32_t        size = sizeof(dsme_trace_record_t) + len;
+    uint64_t        pos  = logtrace.hdr->write_pos;
+
+    size = (size + DSME_TRACE_ALIGN - 1) & ~(DSME_TRACE_ALIGN - 1u);
+
+    /* Records do not wrap; invalidate whatever is at the tail end */
+    if (pos + size > DSME_TRACE_DATA_SIZE) {
+        dsme_trace_record_t* tail = (dsme_trace_record_t*)(logtrace.data + pos);
+        __atomic_store_n(&tail->size, 0, __ATOMIC_RELAXED);
+        pos = 0;
+    }
+
+    dsme_trace_record_t* rec = (dsme_trace_record_t*)(logtrace.data + pos);
+
+    /* Mark the slot incomplete before overwriting anything */
+    __atomic_store_n(&rec->size, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    rec->seq     = logtrace.hdr->next_seq++;
+    rec->time_ms = ts.tv_sec * UINT64_C(1000) + ts.tv_nsec / 1000000;
+    rec->prio    = prio;
+    memcpy(rec->text, message, len - 1);
+    rec->text[len - 1] = 0;
+    rec->check   = dsme_trace_record_check(rec, len);
+
+    __atomic_store_n(&rec->size, size, __ATOMIC_RELEASE);
+    __atomic_store_n(&logtrace.hdr->write_pos,
+                     (pos + size) % DSME_TRACE_DATA_SIZE, __ATOMIC_RELEASE);
+
+    /* Errors are often the last thing logged before a reset */
+    if (prio <= LOG_ERR)
+        log_trace_sync(true);
+    else if (!logtrace.dirty_ms)
+        logtrace.dirty_ms = log_file_monotime_ms();
+}
+
+/*
+ * Enables mirroring of log records to a crash persistent trace file.
+ * Must be called before dsme_log_open().
+ */
+void dsme_log_set_trace_file(const char* path)
+{
+    log_trace_file = path;
+}
+
+
+/*
+ * Per module verbosity
+ *
+ * Modules are identified by a short key derived either from the module
+ * file name ("libiphb.so" -> "iphb") or from the source file name the
+ * logging call is made from ("modules/iphb.c" -> "iphb").
+ */
+
+#define DSME_LOG_MAX_MODULE_OVERRIDES 16
+#define DSME_LOG_MODULE_KEY_LENGTH    31
+
+typedef struct log_module_override {
+    char key[DSME_LOG_MODULE_KEY_LENGTH + 1];
+    int  verbosity;
+} log_module_override;
+
+/* Overrides are changed from the main thread, but looked up from any
+ * thread that logs; both sides hold the mutex while accessing them */
+static pthread_mutex_t     log_module_mutex = PTHREAD_MUTEX_INITIALIZER;
+static log_module_override log_module_overrides[DSME_LOG_MAX_MODULE_OVERRIDES];
+static int                 log_module_override_count = 0;
+
+/* Maximum of global and per module verbosities */
+int dsme_log_verbosity_limit = LOG_NOTICE;
+
+/*
+ * Derives module key from module or source file name
+ */
+static void log_module_key(char *key, const char *name)
+{
+    const char *beg = strrchr(name, '/');
+    beg = beg ? beg + 1 : name;
+
+    if( !strncmp(beg, "lib", 3) && beg[3] )
+        beg += 3;
+
+    size_t len = strcspn(beg, ".");
+    if( len > DSME_LOG_MODULE_KEY_LENGTH )
+        len = DSME_LOG_MODULE_KEY_LENGTH;
+
+    memcpy(key, beg, len);
+    key[len] = 0;
+}
+
+/*
+ * Returns index of override for given key, or -1 if none exists
+ *
+ * Caller must hold log_module_mutex.
+ */
+static int log_module_override_find(const char *key)
+{
+    for( int i = 0; i < log_module_override_count; ++i ) {
+        if( !strcmp(log_module_overrides[i].key, key) )
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Recalculates the limit used for inline filtering in dsme_log()
+ */
+static void log_update_verbosity_limit(void)
+{
+    int limit = logopt.verbosity;
+
+    pthread_mutex_lock(&log_module_mutex);
+    for( int i = 0; i < log_module_override_count; ++i ) {
+        if( limit < log_module_overrides[i].verbosity )
+            limit = log_module_overrides[i].verbosity;
+    }
+    pthread_mutex_unlock(&log_module_mutex);
+
+    dsme_log_verbosity_limit = limit;
+}
+
+/*
+ * Slow path of dsme_log_p(); called only for levels that pass
+ * the inline dsme_log_verbosity_limit check.
+ */
+bool dsme_log_p_(int level, const char *file)
+{
+    int verbosity = logopt.verbosity;
+    int i         = -1;
+    char key[DSME_LOG_MODULE_KEY_LENGTH + 1];
+    char alt[DSME_LOG_MODULE_KEY_LENGTH + 1];
+
+    /* Unlocked peek is fine, stale value just means one message
+     * more or less gets filtered out while overrides are changed */
+    if( __atomic_load_n(&log_module_override_count, __ATOMIC_RELAXED) == 0 )
+        goto EXIT;
+
+    *key = *alt = 0;
+
+    const char *module = current_module_name();
+    if( module )
+        log_module_key(key, module);
+
+    if( file )
+        log_module_key(alt, file);
+
+    pthread_mutex_lock(&log_module_mutex);
+
+    if( *key )
+        i = log_module_override_find(key);
+
+    if( i < 0 && *alt )
+        i = log_module_override_find(alt);
+
+    if( i >= 0 )
+        verbosity = log_module_overrides[i].verbosity;
+
+    pthread_mutex_unlock(&log_module_mutex);
+
+EXIT:
+    return verbosity >= level;
+}
+
+/*
+ * Sets verbosity for a module; negative verbosity removes the override
+ */
+void dsme_log_set_module_verbosity(const char *module, int verbosity)
+{
+    char key[DSME_LOG_MODULE_KEY_LENGTH + 1];
+
+    log_module_key(key, module);
+    if( !*key )
+        goto EXIT;
+
+    dsme_log(LOG_DEBUG, "setting logging verbosity of %s to %d",
+             key, verbosity);
+
+    bool full = false;
+
+    pthread_mutex_lock(&log_module_mutex);
+
+    int i = log_module_override_find(key);
+
+    if( verbosity < 0 ) {
+        if( i >= 0 ) {
+            int last = log_module_override_count - 1;
+            log_module_overrides[i] = log_module_overrides[last];
+            __atomic_store_n(&log_module_override_count, last,
+                             __ATOMIC_RELAXED);
+        }
+    }
+    else if( i >= 0 ) {
+        log_module_overrides[i].verbosity = verbosity;
+    }
+    else if( log_module_override_count < DSME_LOG_MAX_MODULE_OVERRIDES ) {
+        i = log_module_override_count;
+        strcpy(log_module_overrides[i].key, key);
+        log_module_overrides[i].verbosity = verbosity;
+        __atomic_store_n(&log_module_override_count, i + 1,
+                         __ATOMIC_RELAXED);
+    }
+    else {
+        full = true;
+    }
+
+    pthread_mutex_unlock(&log_module_mutex);
+
+    /* Log only after releasing the lock, dsme_log() needs it too */
+    if( full )
+        dsme_log(LOG_WARNING, "too many module verbosity overrides; "
+                 "ignoring %s", key);
+
+    log_update_verbosity_limit();
+
+EXIT:
+    return;
+}
+
+/*
+ * Per call site rate limiting
+ *
+ * Call sites keep their own token buckets. Suppressed message counts
+ * are collected into a table that holds copies of the file names, so
+ * that nothing refers to data in modules that might get unloaded.
+ */
+
+#define LOG_LIMIT_MAX_SITES     32
+#define LOG_LIMIT_FILE_LENGTH   39
+#define LOG_LIMIT_REPORT_PERIOD 10000 /* [ms] */
+
+typedef struct log_limit_stats {
+    char     file[LOG_LIMIT_FILE_LENGTH + 1];
+    int      line;
+    unsigned count;
+} log_limit_stats;
+
+static pthread_mutex_t log_limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static log_limit_stats log_limit_table[LOG_LIMIT_MAX_SITES + 1];
+static int             log_limit_rows  = 0;
+static bool            log_limit_pending = false;
+static long long       log_limit_report_time = 0;
+
+static long long log_limit_monotime_ms(void)
+{
+    struct timespec ts = { 0, 0 };
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Counts a suppressed message; caller must hold log_limit_mutex
+ */
+static void log_limit_suppressed(dsme_log_limit_t* site, const char* file,
+                                 int line, long long now)
+{
+    if (!site->slot) {
+        const char* base = strrchr(file, '/');
+        base = base ? base + 1 : file;
+
+        if (log_limit_rows < LOG_LIMIT_MAX_SITES) {
+            log_limit_stats* row = &log_limit_table[log_limit_rows++];
+            snprintf(row->file, sizeof row->file, "%s", base);
+            row->line = line;
+            site->slot = log_limit_rows;
+        } else {
+            /* Shared overflow row for sites that do not fit the table */
+            log_limit_stats* row = &log_limit_table[LOG_LIMIT_MAX_SITES];
+            snprintf(row->file, sizeof row->file, "<other sites>");
+            site->slot = LOG_LIMIT_MAX_SITES + 1;
+        }
+    }
+
+    log_limit_table[site->slot - 1].count += 1;
+
+    if (!log_limit_pending) {
+        log_limit_pending     = true;
+        log_limit_report_time = now + LOG_LIMIT_REPORT_PERIOD;
+
+        /* Let the logging thread pick up the report deadline */
+        sem_post(&ring_buffer_sem);
+    }
+}
+
+/*
+ * Returns milliseconds until suppressed messages must be reported,
+ * or -1 if there is nothing to report
+ */
+static int log_limit_report_timeout(void)
+{
+    int left = -1;
+
+    pthread_mutex_lock(&log_limit_mutex);
+    if (log_limit_pending) {
+        long long delay = log_limit_report_time - log_limit_monotime_ms();
+        left = (delay < 0) ? 0 : (int)delay;
+    }
+    pthread_mutex_unlock(&log_limit_mutex);
+
+    return left;
+}
+
+/*
+ * Logs summary of messages suppressed since the previous report
+ */
+static void log_limit_report(void)
+{
+    log_limit_stats rows[LOG_LIMIT_MAX_SITES + 1];
+    int             count = 0;
+
+    pthread_mutex_lock(&log_limit_mutex);
+    for (int i = 0; i <= LOG_LIMIT_MAX_SITES; ++i) {
+        if (log_limit_table[i].count) {
+            rows[count++] = log_limit_table[i];
+            log_limit_table[i].count = 0;
+        }
+    }
+    log_limit_pending = false;
+    pthread_mutex_unlock(&log_limit_mutex);
+
+    for (int i = 0; i < count; ++i) {
+        if (rows[i].line)
+            dsme_log_txt(LOG_WARNING, "suppressed %u messages from %s:%d",
+                         rows[i].count, rows[i].file, rows[i].line);
+        else
+            dsme_log_txt(LOG_WARNING, "suppressed %u messages from %s",
+                         rows[i].count, rows[i].file);
+    }
+}
+
+/*
+ * Token bucket check for dsme_log(); returns true if the call site
+ * is allowed to log a message now
+ */
+bool dsme_log_limit_p(dsme_log_limit_t* site, const char* file, int line)
+{
+    long long now = log_limit_monotime_ms();
+
+    /* The same call site can be reached from several threads */
+    pthread_mutex_lock(&log_limit_mutex);
+
+    if (site->tokens >= DSME_LOG_LIMIT_BURST) {
+        site->stamp = now;
+    } else {
+        long long add = (now - site->stamp) * DSME_LOG_LIMIT_RATE / 1000;
+        if (add >= DSME_LOG_LIMIT_BURST - site->tokens) {
+            site->tokens = DSME_LOG_LIMIT_BURST;
+            site->stamp  = now;
+        } else if (add > 0) {
+            site->tokens += add;
+            site->stamp  += add * 1000 / DSME_LOG_LIMIT_RATE;
+        }
+    }
+
+    bool allowed = (site->tokens > 0);
+
+    if (allowed)
+        site->tokens -= 1;
+    else
+        log_limit_suppressed(site, file, line, now);
+
+    pthread_mutex_unlock(&log_limit_mutex);
+
+    return allowed;
+}
+
+/*
+ * Returns number of bytes currently reserved in the ring buffer
+ */
+static unsigned log_ring_fill_level(void)
+{
+    unsigned tail = __atomic_load_n(&read_count, __ATOMIC_ACQUIRE);
+    unsigned head = __atomic_load_n(&write_count, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+/*
+ * Reserves space for a record of given size from the ring buffer.
+ *
+ * Safe to call from multiple threads. If the record would not fit
+ * in before the end of the buffer, the tail end is consumed by a
+ * padding record and the actual record is placed at the start.
+ *
+ * Returns pointer to reserved record, or NULL if the buffer is full.
+ */
+static log_entry *log_ring_reserve(unsigned size)
+{
+    unsigned head = __atomic_load_n(&write_count, __ATOMIC_RELAXED);
+
+    for( ;; ) {
+	unsigned tail = __atomic_load_n(&read_count, __ATOMIC_ACQUIRE);
+	unsigned offs = head & (DSME_LOG_BUFFER_SIZE - 1);
+	unsigned pad  = 0;
+
+	if( offs + size > DSME_LOG_BUFFER_SIZE )
+	    pad = DSME_LOG_BUFFER_SIZE - offs;
+
+	if( head - tail + pad + size > DSME_LOG_BUFFER_SIZE )
+	    return NULL;
+
+	if( !__atomic_compare_exchange_n(&write_count, &head,
+					 head + pad + size, true,
+					 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) )
+	    continue;
+
+	if( pad ) {
+	    log_entry *filler = (log_entry *)(ring_buffer + offs);
+	    filler->prio = LOG_ENTRY_PADDING;
+	    __atomic_store_n(&filler->size, pad, __ATOMIC_RELEASE);
+	    offs = 0;
+	}
+
+	return (log_entry *)(ring_buffer + offs);
+    }
+}
+
+/*
+ * Formats a message into the ring buffer and wakes up the logging thread.
+ *
+ * Returns true on success, false if the buffer is full.
+ */
+static bool log_ring_push(int prio, const char *fmt, va_list va)
+{
+    char     text[DSME_MAX_LOG_MESSAGE_LENGTH + 1];
+    int      len  = vsnprintf(text, sizeof text, fmt, va);
+    unsigned size;
+
+    if( len < 0 )
+	len = 0;
+    else if( len >= (int)sizeof text )
+	len = sizeof text - 1;
+    text[len] = 0;
+
+    /* Context is captured only when the backend has use for it. It
+     * is available only on the main thread, other threads get none. */
+    const char *module  = "";
+    uint32_t    msgtype = 0;
+    pid_t       pid     = 0;
+
+    if( logopt.method == LOG_METHOD_JOURNAL ) {
+	const char *name = current_module_name();
+	if( name )
+	    module = name;
+	msgtype = current_message_type();
+	pid     = current_sender_pid();
+    }
+
+    size_t modlen = strnlen(module, DSME_LOG_MODULE_KEY_LENGTH * 2);
+
+    size = sizeof(log_entry) + len + 1 + modlen + 1;
+    size = (size + LOG_ENTRY_ALIGN - 1) & ~(LOG_ENTRY_ALIGN - 1u);
+
+    log_entry *entry = log_ring_reserve(size);
+    if( !entry )
+	return false;
+
+    entry->prio    = prio;
+    entry->msgtype = msgtype;
+    entry->pid     = pid;
+    memcpy(entry->message, text, len + 1);
+    memcpy(entry->message + len + 1, module, modlen);
+    entry->message[len + 1 + modlen] = 0;
+    __atomic_store_n(&entry->size, size, __ATOMIC_RELEASE);
+
+    sem_post(&ring_buffer_sem);
+    return true;
+}
+
+static bool log_ring_printf(int prio, const char *fmt, ...)
+    __attribute__((format(printf,2,3)));
+
+static bool log_ring_printf(int prio, const char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    bool ack = log_ring_push(prio, fmt, va);
+    va_end(va);
+    return ack;
+}
+
+/*
+ * This function is the main entry point for logging.
+ * It writes log entries to a ring buffer that the logging thread reads.
+ *
+ * May be called from any thread. Overflow state is tracked separately
+ * for each producer thread so that the lost message counts get reported
+ * by the thread that actually lost them.
+ */
+void dsme_log_txt(int level, const char* fmt, ...)
+{
+    static __thread bool     overflow = false;
+    static __thread unsigned skipped  = 0;
+
+    /* Verbosity filtering is done by dsme_log() via dsme_log_p() */
+
     if( overflow ) {
 	/* must go down enough before overflow is cleared */
-	if( buffered >= DSME_MAX_LOG_BUFFER_ENTRIES * 7 / 8 ) {
+	if( log_ring_fill_level() >= DSME_LOG_BUFFER_SIZE * 7 / 8 ) {
 	    ++skipped;
 	    goto EXIT;
 	}
 
 	/* Add log entry about the overflow itself */
-        entry = &ring_buffer[write_count++ % DSME_MAX_LOG_BUFFER_ENTRIES];
-        entry->prio = LOG_ERR;
-        snprintf(entry->message, sizeof entry->message,
-		 "logging ringbuffer overflow; %u messages lost", skipped);
-	sem_post(&ring_buffer_sem);
+	if( !log_ring_printf(LOG_ERR,
+			     "logging ringbuffer overflow; %u messages lost",
+			     skipped) ) {
+	    ++skipped;
+	    goto EXIT;
+	}
 
 	overflow = false;
 	skipped = 0;
     }
 
     /* Add log entry to the ring buffer */
-    entry = &ring_buffer[write_count++ % DSME_MAX_LOG_BUFFER_ENTRIES];
-    entry->prio = level;
     va_list ap;
     va_start(ap, fmt);
-    vsnprintf(entry->message, sizeof entry->message, fmt, ap);
+    bool ack = log_ring_push(level, fmt, ap);
     va_end(ap);
-    sem_post(&ring_buffer_sem);
+
+    if( !ack ) {
+	overflow = true;
+	++skipped;
+    }
 
 EXIT:
     return;
@@ -309,20 +1287,40 @@ EXIT:
 
 /*
  * Reads messages from buffer and passes them to logger backend
+ *
+ * Returns nonzero if a record was consumed, zero if the buffer is empty
+ * or the oldest record is still being written by some producer.
  */
-static int deque_log_buffer(volatile unsigned *p_read_count)
+static int deque_log_buffer(unsigned *p_read_count)
 {
-    int buffer_not_empty = (*p_read_count != write_count);
+    unsigned tail = *p_read_count;
 
-    if (buffer_not_empty) {
-        log_entry* entry = &ring_buffer[*p_read_count % DSME_MAX_LOG_BUFFER_ENTRIES];
+    if( tail == __atomic_load_n(&write_count, __ATOMIC_ACQUIRE) )
+	return 0;
 
-        dsme_log_routine(entry->prio, entry->message);
+    log_entry *entry = (log_entry *)(ring_buffer +
+				     (tail & (DSME_LOG_BUFFER_SIZE - 1)));
+    unsigned   size  = __atomic_load_n(&entry->size, __ATOMIC_ACQUIRE);
 
-        ++(*p_read_count);
+    if( size == 0 )
+	return 0;
+
+    if( entry->prio != LOG_ENTRY_PADDING ) {
+	if( logjournal.fd != -1 )
+	    log_to_journal(entry);
+	else
+	    dsme_log_routine(entry->prio, entry->message);
+	if( logtrace.hdr )
+	    log_trace_append(entry->prio, entry->message);
     }
 
-    return buffer_not_empty;
+    /* Records are variable length, so the header of some later record
+     * can land anywhere within this one - clear all of it before
+     * making the space available again */
+    memset(entry, 0, size);
+    __atomic_store_n(p_read_count, tail + size, __ATOMIC_RELEASE);
+
+    return 1;
 }
 
 /*
@@ -334,12 +1332,52 @@ static void* logging_thread(void* param)
     thread_running = 1;
 
     while (thread_enabled) {
-        while (sem_wait(&ring_buffer_sem) == -1) {
-            continue;
+        int timeout   = log_file_flush_timeout();
+        int tracing   = log_trace_sync_timeout();
+        int reporting = log_limit_report_timeout();
+
+        if (timeout < 0 || (tracing >= 0 && tracing < timeout))
+            timeout = tracing;
+        if (timeout < 0 || (reporting >= 0 && reporting < timeout))
+            timeout = reporting;
+
+        if (timeout < 0) {
+            while (sem_wait(&ring_buffer_sem) == -1) {
+                continue;
+            }
+        } else {
+            /* Buffered file output, trace data or suppression report
+             * is pending; handle it if nothing new gets logged before
+             * the delay is up */
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec  += timeout / 1000;
+            ts.tv_nsec += (timeout % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec  += 1;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (sem_timedwait(&ring_buffer_sem, &ts) == -1) {
+                if (errno == ETIMEDOUT) {
+                    if (log_file_flush_timeout() == 0)
+                        log_file_flush();
+                    if (log_trace_sync_timeout() == 0)
+                        log_trace_sync(false);
+                    if (log_limit_report_timeout() == 0)
+                        log_limit_report();
+                }
+                continue;
+            }
         }
 
-	// ignore return value, semaphore takes care of that.
-	deque_log_buffer(&read_count);
+	/* A record whose producer has not finished yet blocks the ones
+	 * after it; they get flushed when the pending one is posted. */
+	while( deque_log_buffer(&read_count) ) {
+	    /* EMPTY LOOP */
+	}
+
+	if( logjournal.count )
+	    log_journal_flush();
     }
 
     thread_running = 0;
@@ -370,6 +1408,7 @@ bool dsme_log_open(log_method  method,
         (verbosity < LOG_ERR) ? LOG_ERR : verbosity;
     logopt.usetime = usetime;
     logopt.prefix = prefix;
+    log_update_verbosity_limit();
 
     switch (method) {
 
@@ -418,12 +1457,19 @@ out:
             dsme_log_routine = log_to_syslog;
             break;
 
-        case LOG_METHOD_FILE:
-            if ((logopt.filep = fopen(filename, "a")) == NULL) {
+        case LOG_METHOD_JOURNAL:
+            /* Non-journal paths such as dsme_log_raw() use syslog */
+            openlog(prefix, option, facility);
+            dsme_log_routine = log_to_syslog;
+            if (!log_journal_open()) {
                 fprintf(stderr,
-                        "Can't create log file %s (%s)\n",
-                        filename,
-                        strerror(errno));
+                        "journal init failed, will fall back to syslog method\n");
+                logopt.method = LOG_METHOD_SYSLOG;
+            }
+            break;
+
+        case LOG_METHOD_FILE:
+            if (!log_file_init(filename)) {
                 return false;
             }
             dsme_log_routine = log_to_file;
@@ -433,6 +1479,11 @@ out:
             return false;
     }
 
+    /* trace file is optional, logging works without it too */
+    if (log_trace_file) {
+        log_trace_open(log_trace_file);
+    }
+
     /* initialize the ring buffer semaphore */
     if (sem_init(&ring_buffer_sem, 0, 0) == -1) {
         fprintf(stderr, "sem_init: %s\n", strerror(errno));
@@ -442,7 +1493,6 @@ out:
     /* create the logging thread */
     thread_enabled = 1;
     pthread_attr_t     tattr;
-    pthread_t          tid;
     struct sched_param param;
 
     if (pthread_attr_init(&tattr) != 0) {
@@ -453,10 +1503,11 @@ out:
         fprintf(stderr, "Error getting scheduling parameters\n");
         return false;
     }
-    if (pthread_create(&tid, &tattr, logging_thread, 0) != 0) {
+    if (pthread_create(&thread_id, &tattr, logging_thread, 0) != 0) {
         fprintf(stderr, "Error creating the logging thread\n");
         return false;
     }
+    thread_created = true;
 
     return true;
 }
@@ -465,6 +1516,7 @@ void dsme_log_set_verbosity(int verbosity)
 {
     dsme_log(LOG_DEBUG, "setting logging verbosity to %d\n", verbosity);
     logopt.verbosity = verbosity;
+    log_update_verbosity_limit();
 }
 
 
@@ -474,17 +1526,23 @@ void dsme_log_set_verbosity(int verbosity)
  */
 void dsme_log_close(void)
 {
-    volatile unsigned readcount_copy;
-    // Give logging thread a chance to stop
-    if (thread_running) {
+    // Report rate limited messages before closing
+    log_limit_report();
+
+    // Stop the logging thread before draining the buffer here
+    if (thread_created) {
         dsme_log_stop();
+        sem_post(&ring_buffer_sem);
+        pthread_join(thread_id, 0);
+        thread_created = false;
     }
 
-    readcount_copy = read_count;
-    while (deque_log_buffer(&readcount_copy)) {
+    while (deque_log_buffer(&read_count)) {
         /* EMPTY LOOP */
     }
 
+    log_trace_close();
+
     switch (logopt.method) {
         case LOG_METHOD_STDOUT:
             fflush(stdout);
@@ -492,11 +1550,15 @@ void dsme_log_close(void)
         case LOG_METHOD_STDERR:
             fflush(stderr);
             break;
+        case LOG_METHOD_JOURNAL:
+            log_journal_close();
+            closelog();
+            break;
         case LOG_METHOD_SYSLOG:
             closelog();
             break;
         case LOG_METHOD_FILE:
-            fclose(logopt.filep);
+            log_file_quit();
             break;
         case LOG_METHOD_STI:
             close(logopt.sock);
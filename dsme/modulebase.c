@@ -36,6 +36,7 @@
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <dlfcn.h>
 #include <sys/types.h>
@@ -271,21 +272,52 @@ static void remove_msghandlers(module_t* module)
 }
 
 
-static const module_t* currently_handling_module = 0;
+/* Context of the message handler being run.
+ *
+ * Messages are handled only in the main thread, but the context is
+ * queried also by other threads that log. Thread local storage keeps
+ * them from racing with the main thread and from tagging their
+ * messages with context that is not theirs. Message type, sender pid
+ * and module name are copied, so that nothing refers to data that is
+ * released when the handler returns or the module gets unloaded. */
+static __thread const module_t* currently_handling_module = 0;
+static __thread char            currently_handling_name[64];
+static __thread uint32_t        currently_handled_type    = 0;
+static __thread pid_t           currently_handled_pid     = 0;
 
 const module_t* current_module(void)
 {
     return currently_handling_module;
 }
 
+const char* current_module_name(void)
+{
+    return *currently_handling_name ? currently_handling_name : 0;
+}
+
+uint32_t current_message_type(void)
+{
+    return currently_handled_type;
+}
+
+pid_t current_sender_pid(void)
+{
+    return currently_handled_pid;
+}
+
 void enter_module(const module_t* module)
 {
+    const char* name = module ? module_name(module) : 0;
+    const char* base = name ? strrchr(name, '/') : 0;
+
     currently_handling_module = module;
+    snprintf(currently_handling_name, sizeof currently_handling_name,
+             "%s", base ? base + 1 : name ? name : "");
 }
 
 void leave_module()
 {
-    currently_handling_module = 0;
+    enter_module(0);
 }
 
 
@@ -504,6 +536,20 @@ bool endpoint_same(const endpoint_t* a, const endpoint_t* b)
   return same;
 }
 
+/* Hash value that is equal for endpoints that are endpoint_same() */
+unsigned endpoint_hash(const endpoint_t* endpoint)
+{
+  uintptr_t key = 0;
+
+  if (endpoint) {
+    key = endpoint->module ? (uintptr_t)endpoint->module
+                           : (uintptr_t)endpoint->conn;
+  }
+
+  /* discard alignment bits */
+  return (unsigned)(key >> 4) ^ (unsigned)(key >> 20);
+}
+
 bool endpoint_is_dsme(const endpoint_t* endpoint)
 {
     return (endpoint && endpoint->conn == 0);
@@ -572,9 +618,14 @@ static int handle_message(endpoint_t*              from,
               if (msg->line_size_ >= handler->msg_size &&
                   msg->size_      == handler->msg_size)
               {
-                  currently_handling_module = handler->owner;
+                  enter_module(handler->owner);
+                  currently_handled_type = dsmemsg_id(msg);
+                  currently_handled_pid  = ((from && from->conn) ?
+                                            from->ucred.pid : 0);
                   handler->callback(from, msg);
-                  currently_handling_module = 0;
+                  leave_module();
+                  currently_handled_type = 0;
+                  currently_handled_pid  = 0;
               }
           }
       }
@@ -601,9 +652,9 @@ bool unload_module(module_t* module)
                 (module_fini_fn_t *)dlsym(module->handle, "module_fini");
 
             if (finifunc) {
-                currently_handling_module = module;
+                enter_module(module);
                 finifunc();
-                currently_handling_module = 0;
+                leave_module();
             }
 
             dlclose(module->handle);
@@ -674,9 +725,9 @@ module_t* load_module(const char* filename, int priority)
     /* Call module_init() -function if it exists */
     initfunc = (module_init_fn_t *)dlsym(dlhandle, "module_init");
     if (initfunc) {
-        currently_handling_module = module;
+        enter_module(module);
         initfunc(module);
-        currently_handling_module = 0;
+        leave_module();
     }
 
     /* Add message handlers for the module */
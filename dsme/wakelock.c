@@ -0,0 +1,269 @@
+/**
+   @file wakelock.c
+
+   DSME internal interface for manipulating sysfs wakelocks.
+   <p>
+   Copyright (C) 2015 Jolla Ltd.
+
+   This file is part of Dsme.
+
+   Dsme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Dsme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Dsme.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "../include/dsme/wakelock.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Maximum number of named locks to track */
+#define DSME_WAKELOCK_MAX      16
+
+/** Maximum length of tracked lock names */
+#define DSME_WAKELOCK_NAME_MAX 48
+
+/** Tracking data for one named wakelock */
+typedef struct
+{
+    char     name[DSME_WAKELOCK_NAME_MAX];
+    bool     held;     /* lock is held, as far as we know */
+    int64_t  since;    /* when lock was acquired [ms] */
+    int64_t  expires;  /* when timed lock expires [ms], or 0 */
+    int64_t  held_ms;  /* total time held, excluding current hold */
+    unsigned locks;    /* lock requests */
+    unsigned writes;   /* lock / unlock sysfs writes */
+    unsigned elided;   /* requests that did not need sysfs writes */
+} dsme_wakelock_t;
+
+/** Sysfs file descriptors, indexed by lock/unlock flag */
+static int dsme_wakelock_fd[2] = { -1, -1 };
+
+/** Tracked named locks */
+static dsme_wakelock_t dsme_wakelock_lut[DSME_WAKELOCK_MAX];
+
+static int64_t dsme_wakelock_now(void)
+{
+    struct timespec ts = { 0, 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static const char *dsme_wakelock_path(bool lock)
+{
+    return lock ? DSME_WAKELOCK_LOCK_PATH : DSME_WAKELOCK_UNLOCK_PATH;
+}
+
+bool dsme_wakelock_init(void)
+{
+    for( int lock = 0; lock < 2; ++lock ) {
+        if( dsme_wakelock_fd[lock] == -1 )
+            dsme_wakelock_fd[lock] = open(dsme_wakelock_path(lock),
+                                          O_WRONLY | O_CLOEXEC);
+    }
+
+    return dsme_wakelock_fd[0] != -1 && dsme_wakelock_fd[1] != -1;
+}
+
+void dsme_wakelock_quit(void)
+{
+    for( int lock = 0; lock < 2; ++lock ) {
+        int fd = dsme_wakelock_fd[lock];
+        dsme_wakelock_fd[lock] = -1;
+        if( fd != -1 )
+            close(fd);
+    }
+}
+
+bool dsme_wakelock_supported(void)
+{
+    static bool checked   = false;
+    static bool supported = false;
+
+    if( dsme_wakelock_fd[0] != -1 && dsme_wakelock_fd[1] != -1 )
+        return true;
+
+    if( !checked ) {
+        checked = true;
+        supported = (access(DSME_WAKELOCK_LOCK_PATH, W_OK) == 0 &&
+                     access(DSME_WAKELOCK_UNLOCK_PATH, W_OK) == 0);
+    }
+
+    return supported;
+}
+
+bool dsme_wakelock_write(bool lock, const char *data, size_t size)
+{
+    // NOTE: called from signal handler - must stay async-signal-safe
+
+    bool ack = false;
+    int  tmp = -1;
+    int  fd  = dsme_wakelock_fd[lock ? 1 : 0];
+
+    /* fall back to opening the file for each write if
+     * dsme_wakelock_init() has not been called yet */
+    if( fd == -1 ) {
+        if( (fd = tmp = open(dsme_wakelock_path(lock), O_WRONLY)) == -1 )
+            goto EXIT;
+    }
+    else if( lseek(fd, 0, SEEK_SET) == -1 ) {
+        goto EXIT;
+    }
+
+    ack = (write(fd, data, size) == (ssize_t)size);
+
+EXIT:
+    if( tmp != -1 ) {
+        int err = errno;
+        close(tmp);
+        errno = err;
+    }
+
+    return ack;
+}
+
+static dsme_wakelock_t *dsme_wakelock_find(const char *name, bool add)
+{
+    dsme_wakelock_t *avail = 0;
+
+    for( int i = 0; i < DSME_WAKELOCK_MAX; ++i ) {
+        dsme_wakelock_t *wl = &dsme_wakelock_lut[i];
+
+        if( !*wl->name ) {
+            if( !avail )
+                avail = wl;
+        }
+        else if( !strcmp(wl->name, name) ) {
+            return wl;
+        }
+    }
+
+    if( !add || !avail || strlen(name) >= sizeof avail->name )
+        return 0;
+
+    strcpy(avail->name, name);
+    return avail;
+}
+
+/** Account time held for timed lock that has expired */
+static void dsme_wakelock_expire(dsme_wakelock_t *wl, int64_t now)
+{
+    if( wl->held && wl->expires && wl->expires <= now ) {
+        wl->held_ms += wl->expires - wl->since;
+        wl->held = false;
+    }
+}
+
+bool dsme_wakelock_lock(const char *name, int ms)
+{
+    int64_t          now = dsme_wakelock_now();
+    dsme_wakelock_t *wl  = dsme_wakelock_find(name, true);
+    char             tmp[DSME_WAKELOCK_NAME_MAX + 32];
+    int              len;
+
+    if( wl ) {
+        dsme_wakelock_expire(wl, now);
+        wl->locks += 1;
+
+        /* already held without timeout -> nothing to do */
+        if( ms < 0 && wl->held && !wl->expires ) {
+            wl->elided += 1;
+            return true;
+        }
+    }
+
+    if( ms < 0 )
+        len = snprintf(tmp, sizeof tmp, "%s\n", name);
+    else
+        len = snprintf(tmp, sizeof tmp, "%s %lld\n", name, ms * 1000000LL);
+
+    if( len < 0 || len >= (int)sizeof tmp ) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    if( !dsme_wakelock_write(true, tmp, len) )
+        return false;
+
+    if( wl ) {
+        wl->writes += 1;
+        if( !wl->held ) {
+            wl->held  = true;
+            wl->since = now;
+        }
+        wl->expires = (ms < 0) ? 0 : now + ms;
+    }
+
+    return true;
+}
+
+bool dsme_wakelock_unlock(const char *name)
+{
+    int64_t          now = dsme_wakelock_now();
+    dsme_wakelock_t *wl  = dsme_wakelock_find(name, false);
+    char             tmp[DSME_WAKELOCK_NAME_MAX + 32];
+    int              len;
+
+    /* Locks we have not seen before might have been left behind
+     * by a previous dsme instance, so those are always written */
+    if( wl ) {
+        dsme_wakelock_expire(wl, now);
+
+        if( !wl->held ) {
+            wl->elided += 1;
+            return true;
+        }
+
+        wl->held_ms += now - wl->since;
+        wl->held     = false;
+    }
+
+    len = snprintf(tmp, sizeof tmp, "%s\n", name);
+
+    if( len < 0 || len >= (int)sizeof tmp ) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    if( wl )
+        wl->writes += 1;
+
+    return dsme_wakelock_write(false, tmp, len);
+}
+
+void dsme_wakelock_report(FILE *file)
+{
+    int64_t now = dsme_wakelock_now();
+
+    for( int i = 0; i < DSME_WAKELOCK_MAX; ++i ) {
+        dsme_wakelock_t *wl = &dsme_wakelock_lut[i];
+
+        if( !*wl->name )
+            continue;
+
+        dsme_wakelock_expire(wl, now);
+
+        int64_t held = wl->held_ms;
+        if( wl->held )
+            held += now - wl->since;
+
+        fprintf(file, "wakelock %s: %s locks %u writes %u elided %u"
+                " held %lld ms\n",
+                wl->name, wl->held ? "held" : "free",
+                wl->locks, wl->writes, wl->elided, (long long)held);
+    }
+}
@@ -42,7 +42,8 @@ typedef enum {
     LOG_METHOD_STDOUT, /* Print messages to stdout */
     LOG_METHOD_STDERR, /* Print messages to stderr */
     LOG_METHOD_SYSLOG, /* Use syslog(3) */
-    LOG_METHOD_FILE    /* Output messages to the file */
+    LOG_METHOD_FILE,   /* Output messages to the file */
+    LOG_METHOD_JOURNAL /* Send structured entries to systemd journal */
 } log_method;
 
 
@@ -64,18 +65,77 @@ typedef enum {
 
 /* Function prototypes */
 #ifdef DSME_LOG_ENABLE
+
+/* Messages less severe than this are compiled out altogether */
+#ifndef DSME_LOG_MIN_LEVEL
+# define DSME_LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
+/* Highest verbosity in use by any module, for inline filtering */
+extern int dsme_log_verbosity_limit;
+
+/* Per call site rate limiting: each dsme_log() call site may emit
+ * DSME_LOG_LIMIT_BURST messages in a row, after that the rate is
+ * limited to DSME_LOG_LIMIT_RATE messages per second. Errors and
+ * more severe messages are never suppressed. */
+#ifndef DSME_LOG_LIMIT_BURST
+# define DSME_LOG_LIMIT_BURST 20
+#endif
+#ifndef DSME_LOG_LIMIT_RATE
+# define DSME_LOG_LIMIT_RATE 10
+#endif
+
+/* Token bucket state, zero initialized static per call site */
+typedef struct dsme_log_limit_t {
+    long long stamp;  /* Monotonic time of last refill [ms] */
+    int       tokens; /* Messages that can be logged right now */
+    int       slot;   /* Suppression statistics slot + 1, or zero */
+} dsme_log_limit_t;
+
 /* Function prototypes */
+bool dsme_log_p_(int level, const char *file);
+bool dsme_log_limit_p(dsme_log_limit_t *site, const char *file, int line);
 void dsme_log_txt(int level, const char *fmt, ...)
     __attribute__((format(printf,2,3)));
 void dsme_log_raw(int level, const char *fmt, ...) __attribute__((format(printf,2,3)));
 
 /* Macros */
-#define dsme_log(level, fmt...) dsme_log_txt(level, fmt)
+
+/** Check if message of given level from the calling file would be logged
+ *
+ * Constant levels above DSME_LOG_MIN_LEVEL evaluate to false at compile
+ * time, and levels above what any module uses are rejected without
+ * making function calls.
+ */
+#define dsme_log_p(level) \
+    ((level) <= DSME_LOG_MIN_LEVEL && \
+     (level) <= dsme_log_verbosity_limit && \
+     dsme_log_p_(level, __FILE__))
+
+#define dsme_log(level, fmt...) \
+    do { \
+        if( dsme_log_p(level) ) { \
+            static dsme_log_limit_t dsme_log_limit_; \
+            if( (level) <= LOG_ERR || \
+                dsme_log_limit_p(&dsme_log_limit_, __FILE__, __LINE__) ) \
+                dsme_log_txt(level, fmt); \
+        } \
+    } while( 0 )
 #else
+#define dsme_log_p(level) false
 #define dsme_log(level, fmt...)
 #endif
 
 
+
+/**
+   Request for changing logging verbosity.
+
+   If the message carries a module name as extra string data, the
+   verbosity applies only to that module (e.g. "iphb" matches both
+   libiphb.so and modules/iphb.c). Without extra data the global
+   verbosity is changed.
+*/
 typedef struct {
     DSMEMSG_PRIVATE_FIELDS
     int verbosity;
@@ -93,7 +153,30 @@ bool dsme_log_open(log_method method, int verbosity, int usetime,
                    const char *prefix, int facility, int option,
                    const char *filename);
 
+/* Default log file rotation settings */
+#ifndef DSME_LOG_FILE_MAX_SIZE
+# define DSME_LOG_FILE_MAX_SIZE (256 * 1024)
+#endif
+#ifndef DSME_LOG_FILE_GENERATIONS
+# define DSME_LOG_FILE_GENERATIONS 3
+#endif
+
+/**
+   Sets size limit and number of rotated files for LOG_METHOD_FILE.
+
+   Must be called before dsme_log_open(). Zero size disables rotation.
+*/
+void dsme_log_set_file_rotation(size_t max_size, int generations);
+
+/**
+   Mirrors log records to a crash persistent trace file, see logtrace.h.
+
+   Must be called before dsme_log_open().
+*/
+void dsme_log_set_trace_file(const char *path);
+
 void dsme_log_set_verbosity(int verbosity);
+void dsme_log_set_module_verbosity(const char *module, int verbosity);
 
 
 /**
@@ -0,0 +1,114 @@
+/**
+   @file logtrace.h
+
+   On-disk format of the crash persistent DSME trace ring.
+   <p>
+   The trace ring is a fixed size file that dsme-server keeps mmap'd
+   and mirrors all log records into. Since the data lives in shared
+   file backed pages, it survives dsme-server getting killed and can
+   be examined afterwards with the dsmetrace utility. To survive also
+   watchdog resets and power loss, records of error and higher severity
+   are synced to storage immediately, and other records within about a
+   second of being appended; only the records logged during that last
+   second can get lost.
+   <p>
+   Records are written so that a reader can always tell complete records
+   apart from partially written or overwritten ones: the size field is
+   cleared before and set after the rest of the record is written, and
+   the checksum covers all other fields.
+   <p>
+   Copyright (C) 2015 Jolla Ltd.
+
+   This file is part of Dsme.
+
+   Dsme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Dsme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Dsme.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DSME_LOGTRACE_H
+#define DSME_LOGTRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Trace ring used by the currently running system */
+#define DSME_TRACE_FILE        "/var/lib/dsme/trace.ring"
+
+/** Trace ring left behind by the previous boot */
+#define DSME_TRACE_FILE_PREV   DSME_TRACE_FILE ".prev"
+
+#define DSME_TRACE_MAGIC       "DSMETRC1"
+#define DSME_TRACE_HEADER_SIZE 128
+#define DSME_TRACE_DATA_SIZE   (64 * 1024)
+#define DSME_TRACE_FILE_SIZE   (DSME_TRACE_HEADER_SIZE + DSME_TRACE_DATA_SIZE)
+#define DSME_TRACE_ALIGN       8
+#define DSME_TRACE_MAX_TEXT    1024
+
+/** Trace file header, located at the start of the file */
+typedef struct dsme_trace_header_t
+{
+    char     magic[8];    /* DSME_TRACE_MAGIC, no terminator */
+    uint32_t header_size; /* DSME_TRACE_HEADER_SIZE */
+    uint32_t data_size;   /* DSME_TRACE_DATA_SIZE */
+    char     boot_id[40]; /* Boot the trace was recorded in */
+    uint64_t write_pos;   /* Data offset where next record goes */
+    uint32_t next_seq;    /* Sequence number of next record */
+    uint32_t reserved;
+} dsme_trace_header_t;
+
+/** Trace record, located at DSME_TRACE_ALIGN aligned data offset */
+typedef struct dsme_trace_record_t
+{
+    uint32_t size;    /* Record size incl. header and padding, or zero */
+    uint32_t seq;     /* Sequence number */
+    uint64_t time_ms; /* Wall clock time in milliseconds */
+    int32_t  prio;    /* LOG_xxx level */
+    uint32_t check;   /* dsme_trace_record_check() value */
+    char     text[];  /* Zero terminated message text */
+} dsme_trace_record_t;
+
+/** Calculate checksum for a trace record
+ *
+ * @param rec  trace record
+ * @param len  length of the text, including the terminator
+ *
+ * @return FNV-1a hash over seq, time_ms, prio and text
+ */
+static inline uint32_t
+dsme_trace_record_check(const dsme_trace_record_t *rec, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    const unsigned char *pos = (const unsigned char *)&rec->seq;
+    const unsigned char *end = (const unsigned char *)&rec->check;
+
+    while( pos < end )
+        h = (h ^ *pos++) * 16777619u;
+
+    pos = (const unsigned char *)rec->text;
+    end = pos + len;
+
+    while( pos < end )
+        h = (h ^ *pos++) * 16777619u;
+
+    return h;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
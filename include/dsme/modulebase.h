@@ -82,6 +82,24 @@ bool unload_module(module_t* module);
 void process_message_queue(void);
 
 const module_t* current_module(void);
+
+/**
+   Returns file name of the module whose handler is being run, or NULL.
+   Outside the main thread there is never a current module.
+*/
+const char* current_module_name(void);
+
+/**
+   Returns type of the message being handled, or zero if none.
+*/
+uint32_t current_message_type(void);
+
+/**
+   Returns pid of the client that sent the message being handled,
+   or zero if the sender is not an external client.
+*/
+pid_t current_sender_pid(void);
+
 void enter_module(const module_t* module);
 void leave_module(void);
 
@@ -0,0 +1,110 @@
+/**
+   @file wakelock.h
+
+   DSME internal interface for manipulating sysfs wakelocks.
+   <p>
+   The wake_lock and wake_unlock sysfs files are kept open, so that
+   taking and releasing a wakelock costs a single write. Both dsme and
+   dsme-server use this; the raw write function is async-signal-safe
+   and can be used from signal handlers.
+   <p>
+   The lock/unlock functions additionally keep track of the state of
+   named locks: locking a lock that is already held without timeout,
+   or unlocking one that has already been released, does not touch
+   sysfs at all. Time held is accounted per lock name.
+   <p>
+   Copyright (C) 2015 Jolla Ltd.
+
+   This file is part of Dsme.
+
+   Dsme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Dsme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Dsme.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DSME_WAKELOCK_H
+#define DSME_WAKELOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Sysfs entry for acquiring wakelocks */
+#define DSME_WAKELOCK_LOCK_PATH   "/sys/power/wake_lock"
+
+/** Sysfs entry for releasing wakelocks */
+#define DSME_WAKELOCK_UNLOCK_PATH "/sys/power/wake_unlock"
+
+/**
+ * Open the wakelock sysfs files for later use
+ *
+ * @return true if wakelocks are supported, false otherwise
+ */
+bool dsme_wakelock_init(void);
+
+/**
+ * Close the wakelock sysfs files
+ */
+void dsme_wakelock_quit(void);
+
+/**
+ * Check if the wakelock sysfs files are available
+ */
+bool dsme_wakelock_supported(void);
+
+/**
+ * Write raw data to wake_lock or wake_unlock sysfs file
+ *
+ * Async-signal-safe. Does not track lock state.
+ *
+ * @param lock  true to write to wake_lock, false for wake_unlock
+ * @param data  data to write, e.g. "name 1000000000\n"
+ * @param size  length of data
+ *
+ * @return true on success, or false with errno set on failure
+ */
+bool dsme_wakelock_write(bool lock, const char *data, size_t size);
+
+/**
+ * Acquire named wakelock
+ *
+ * @param name  wakelock name
+ * @param ms    timeout in milliseconds, or negative for no timeout
+ *
+ * @return true on success, or false with errno set on failure
+ */
+bool dsme_wakelock_lock(const char *name, int ms);
+
+/**
+ * Release named wakelock
+ *
+ * @param name  wakelock name
+ *
+ * @return true on success, or false with errno set on failure
+ */
+bool dsme_wakelock_unlock(const char *name);
+
+/**
+ * Write per lock statistics as text lines
+ *
+ * @param file  stream to write to
+ */
+void dsme_wakelock_report(FILE *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -35,8 +35,6 @@
 
 #define LOGPFIX "diskmonitor: "
 
-#include <iphbd/iphb_internal.h>
-
 #include "dsme_dbus.h"
 #include "dbusproxy.h"
 
@@ -95,11 +93,19 @@ static int disk_check_interval(void)
 
 static void schedule_next_wakeup(void)
 {
-    DSM_MSGTYPE_WAIT msg = DSME_MSG_INIT(DSM_MSGTYPE_WAIT);
-    msg.req.mintime = disk_check_interval();
-    msg.req.maxtime = msg.req.mintime + 60;
-    msg.req.pid     = 0;
-    msg.data        = 0;
+    DSM_MSGTYPE_HOUSEKEEPING_ADD msg = DSME_MSG_INIT(DSM_MSGTYPE_HOUSEKEEPING_ADD);
+    msg.task      = 0;
+    msg.period    = disk_check_interval() + 60;
+    msg.tolerance = 60;
+
+    broadcast_internally(&msg);
+}
+
+static void cancel_wakeup(void)
+{
+    DSM_MSGTYPE_HOUSEKEEPING_REMOVE msg =
+        DSME_MSG_INIT(DSM_MSGTYPE_HOUSEKEEPING_REMOVE);
+    msg.task = 0;
 
     broadcast_internally(&msg);
 }
@@ -202,11 +208,9 @@ static const dsme_dbus_signal_binding_t signals[] =
  * Internal DSME event handling
  * ========================================================================= */
 
-DSME_HANDLER(DSM_MSGTYPE_WAKEUP, client, msg)
+DSME_HANDLER(DSM_MSGTYPE_HOUSEKEEPING, client, msg)
 {
     check_disk_space();
-
-    schedule_next_wakeup();
 }
 
 DSME_HANDLER(DSM_MSGTYPE_DBUS_CONNECT, client, msg)
@@ -240,7 +244,7 @@ DSME_HANDLER(DSM_MSGTYPE_DISK_SPACE, conn, msg)
 
 module_fn_info_t message_handlers[] =
 {
-    DSME_HANDLER_BINDING(DSM_MSGTYPE_WAKEUP),
+    DSME_HANDLER_BINDING(DSM_MSGTYPE_HOUSEKEEPING),
     DSME_HANDLER_BINDING(DSM_MSGTYPE_DBUS_CONNECT),
     DSME_HANDLER_BINDING(DSM_MSGTYPE_DBUS_DISCONNECT),
     DSME_HANDLER_BINDING(DSM_MSGTYPE_DISK_SPACE),
@@ -260,5 +264,7 @@ void module_init(module_t* module)
 
 void module_fini(void)
 {
+    cancel_wakeup();
+
     dsme_log(LOG_DEBUG, "diskmonitor.so unloaded");
 }
@@ -32,10 +32,122 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <glib.h>
 
 
+/** Periodic task registered by some module */
+typedef struct {
+    endpoint_t* owner;     // module that registered the task
+    int         task;      // task id within owner
+    int         period;    // seconds between runs
+    int         tolerance; // seconds the task can be run early
+    time_t      last;      // when the task was added or last run
+} housekeeping_task_t;
+
+/** Registered housekeeping tasks */
+static GSList* housekeeping_tasks = 0;
+
+/** Heartbeats that had some tasks to run */
+static unsigned housekeeping_beats = 0;
+
+/** Tasks run from heartbeats */
+static unsigned housekeeping_runs  = 0;
+
+static time_t housekeeping_now(void)
+{
+    struct timespec ts = { 0, 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static housekeeping_task_t* housekeeping_find(const endpoint_t* owner,
+                                              int               task)
+{
+    for (GSList* item = housekeeping_tasks; item; item = item->next) {
+        housekeeping_task_t* hk = item->data;
+        if (hk->task == task && endpoint_same(hk->owner, owner)) {
+            return hk;
+        }
+    }
+    return 0;
+}
+
+static void housekeeping_delete(housekeeping_task_t* hk)
+{
+    housekeeping_tasks = g_slist_remove(housekeeping_tasks, hk);
+    endpoint_free(hk->owner);
+    free(hk);
+}
+
+/** Run all tasks that are due, i.e. within tolerance of their period
+ */
+static void housekeeping_run(void)
+{
+    time_t   now = housekeeping_now();
+    unsigned ran = 0;
+
+    for (GSList* item = housekeeping_tasks; item; item = item->next) {
+        housekeeping_task_t* hk = item->data;
+
+        if (now - hk->last < hk->period - hk->tolerance) {
+            continue;
+        }
+
+        DSM_MSGTYPE_HOUSEKEEPING msg = DSME_MSG_INIT(DSM_MSGTYPE_HOUSEKEEPING);
+        msg.task = hk->task;
+        endpoint_send(hk->owner, &msg);
+
+        hk->last = now;
+        ++ran;
+    }
+
+    if (ran) {
+        housekeeping_beats += 1;
+        housekeeping_runs  += ran;
+        dsme_log(LOG_DEBUG, "heartbeat: ran %u tasks (%u tasks in %u beats)",
+                 ran, housekeeping_runs, housekeeping_beats);
+    }
+}
+
+DSME_HANDLER(DSM_MSGTYPE_HOUSEKEEPING_ADD, conn, msg)
+{
+    housekeeping_task_t* hk = housekeeping_find(conn, msg->task);
+
+    if (!hk) {
+        hk = calloc(1, sizeof *hk);
+        hk->owner = endpoint_copy(conn);
+        hk->task  = msg->task;
+        housekeeping_tasks = g_slist_append(housekeeping_tasks, hk);
+    }
+
+    hk->period    = msg->period;
+    hk->tolerance = msg->tolerance;
+    hk->last      = housekeeping_now();
+
+    if (hk->tolerance < 0 || hk->tolerance > hk->period) {
+        hk->tolerance = hk->period;
+    }
+
+    dsme_log(LOG_DEBUG, "heartbeat: task %d: period %d tolerance %d",
+             hk->task, hk->period, hk->tolerance);
+}
+
+DSME_HANDLER(DSM_MSGTYPE_HOUSEKEEPING_REMOVE, conn, msg)
+{
+    housekeeping_task_t* hk = housekeeping_find(conn, msg->task);
+
+    if (hk) {
+        housekeeping_delete(hk);
+    }
+}
+
+module_fn_info_t message_handlers[] = {
+    DSME_HANDLER_BINDING(DSM_MSGTYPE_HOUSEKEEPING_ADD),
+    DSME_HANDLER_BINDING(DSM_MSGTYPE_HOUSEKEEPING_REMOVE),
+    { 0 }
+};
 
 static gboolean emit_heartbeat_message(GIOChannel*  source,
                                        GIOCondition condition,
@@ -71,6 +183,9 @@ static gboolean emit_heartbeat_message(GIOChannel*  source,
         const DSM_MSGTYPE_HEARTBEAT beat = DSME_MSG_INIT(DSM_MSGTYPE_HEARTBEAT);
         broadcast_internally(&beat);
         //dsme_log(LOG_DEBUG, "heartbeat");
+
+        // run periodic tasks in the same wakeup
+        housekeeping_run();
         return true;
     } else {
         // got an EOF (or a read error); remove the watch
@@ -115,5 +230,9 @@ void module_init(module_t* handle)
 
 void module_fini(void)
 {
+    while (housekeeping_tasks) {
+        housekeeping_delete(housekeeping_tasks->data);
+    }
+
     dsme_log(LOG_DEBUG, "heartbeat.so unloaded");
 }
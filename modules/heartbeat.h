@@ -27,9 +27,44 @@
 #include <dsme/messages.h>
 
 enum {
-    DSME_MSG_ENUM(DSM_MSGTYPE_HEARTBEAT, 0x00000702),
+    DSME_MSG_ENUM(DSM_MSGTYPE_HEARTBEAT,           0x00000702),
+    DSME_MSG_ENUM(DSM_MSGTYPE_HOUSEKEEPING_ADD,    0x00000703),
+    DSME_MSG_ENUM(DSM_MSGTYPE_HOUSEKEEPING_REMOVE, 0x00000704),
+    DSME_MSG_ENUM(DSM_MSGTYPE_HOUSEKEEPING,        0x00000705),
 };
 
 typedef dsmemsg_generic_t DSM_MSGTYPE_HEARTBEAT;
 
+/* Periodic housekeeping tasks
+ *
+ * Modules can register periodic tasks that are run from the heartbeat,
+ * so that all of them get served during the same wakeup instead of each
+ * module waking up on its own.
+ *
+ * A task is run at the first heartbeat that happens when at least
+ * (period - tolerance) seconds have passed since the task was added
+ * or last run. Since nothing is run between heartbeats, the task can
+ * also get delayed by up to one heartbeat interval.
+ *
+ * When a task is due, DSM_MSGTYPE_HOUSEKEEPING is sent to the module
+ * that added it. Adding a task that already exists restarts it with
+ * the new period and tolerance.
+ */
+typedef struct {
+    DSMEMSG_PRIVATE_FIELDS
+    int task;      /* task id, unique within the registering module */
+    int period;    /* seconds between task runs */
+    int tolerance; /* seconds the task can be run ahead of period */
+} DSM_MSGTYPE_HOUSEKEEPING_ADD;
+
+typedef struct {
+    DSMEMSG_PRIVATE_FIELDS
+    int task;      /* task id given in DSM_MSGTYPE_HOUSEKEEPING_ADD */
+} DSM_MSGTYPE_HOUSEKEEPING_REMOVE;
+
+typedef struct {
+    DSMEMSG_PRIVATE_FIELDS
+    int task;      /* task id given in DSM_MSGTYPE_HOUSEKEEPING_ADD */
+} DSM_MSGTYPE_HOUSEKEEPING;
+
 #endif
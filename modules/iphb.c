@@ -36,10 +36,12 @@
 #include "dbusproxy.h"
 #include "dsme_dbus.h"
 #include "heartbeat.h"
+#include "iphbstats.h"
 #include "../include/dsme/modules.h"
 #include "../include/dsme/modulebase.h"
 #include "../include/dsme/logging.h"
 #include "../include/dsme/timers.h"
+#include "../include/dsme/wakelock.h"
 #include "../dsme/dsme-wdd-wd.h"
 
 #include <stdlib.h>
@@ -47,11 +49,13 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <glib.h>
 #include <sys/ioctl.h>
@@ -61,6 +65,7 @@
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
 #include <mce/dbus-names.h>
+#include <dsme/dsme_dbus_if.h>
 
 #include "../include/android/android_alarm.h"
 
@@ -71,8 +76,19 @@
 /** Prefix string for diagnostic messages from this module */
 #define PFIX "IPHB: "
 
-/** Maximum number of epoll events to process in one go */
-#define DSME_MAX_EPOLL_EVENTS   10
+/** Maximum number of epoll events to fetch with one epoll_wait() call */
+#define DSME_MAX_EPOLL_EVENTS   32
+
+/** Maximum number of epoll events to process before returning to mainloop */
+#define DSME_EPOLL_EVENT_BUDGET 128
+
+/** Epoll flag for blocking suspend while events are handled (linux 3.5+) */
+#ifndef EPOLLWAKEUP
+# define EPOLLWAKEUP (1u << 29)
+#endif
+
+/** Delay between wakeup triggers and checking which clients to wake up */
+#define CLIENTLIST_WAKEUP_DELAY_MS 200
 
 /** How long it takes to power up to act dead mode to show alarms */
 #define STARTUP_TIME_ESTIMATE_SECS 60
@@ -89,6 +105,13 @@
 /** Maximum time to stay in suspend [seconds]; zero for no limit */
 #define RTC_MAXIMUM_WAKEUP_TIME (30*60) // 30 minutes
 
+/** How much earlier than needed an already programmed rtc alarm can be
+ *  and still be left as it is instead of reprogramming [seconds] */
+#define RTC_ALARM_TOLERANCE_SECS 1
+
+/** Minimum interval between deltatime updates on rtc reprogramming [s] */
+#define DELTATIME_UPDATE_INTERVAL (5*60)
+
 /** Image create time = mtime of mer-release file */
 #define IMAGE_TIME_STAMP_FILE "/etc/mer-release"
 
@@ -102,6 +125,135 @@
  * Custom types
  * ------------------------------------------------------------------------- */
 
+/** Deadline heaps used for indexing waiting clients
+ *
+ * A waiting client is either pending (mintime not reached yet) or
+ * ripe (can be woken up). Pending clients are tracked by mintime, so
+ * that they can be moved to ripe heaps as time passes, and the ones
+ * that need resume also by maxtime for programming timers and rtc.
+ */
+typedef enum {
+    CLIENT_HEAP_PENDING,        /*!< pending clients, by mintime */
+    CLIENT_HEAP_PENDING_RESUME, /*!< pending clients needing resume, by maxtime */
+    CLIENT_HEAP_RIPE_RESUME,    /*!< ripe clients needing resume, by maxtime */
+    CLIENT_HEAP_RIPE_OTHER,     /*!< other ripe clients, by maxtime */
+    CLIENT_HEAP_COUNT
+} client_heap_id_t;
+
+/** Policies for choosing when clients needing resume are woken up */
+typedef enum {
+    /** Wake up ripe clients when some must be woken up or when their
+     *  maxtime is less than a heartbeat away */
+    WAKEUP_ALIGN_LEGACY,
+
+    /** Wake up clients needing resume only at the earliest maxtime,
+     *  i.e. greedy interval stabbing over all wakeup windows */
+    WAKEUP_ALIGN_STABBING,
+} wakeup_align_t;
+
+/** Wakeup window of a client, in monotonic seconds */
+typedef struct {
+    time_t mintime;
+    time_t maxtime;
+} wakeup_window_t;
+
+/** How often wakeup statistics are evaluated [s] */
+#define WAKEUP_STATS_PERIOD (60 * 60)
+
+/** Maximum number of client wakeup windows recorded per period */
+#define WAKEUP_STATS_MAX_WINDOWS 512
+
+/** Hourly resume wakeup statistics */
+typedef struct {
+    time_t          started;      /*!< start of current period */
+    time_t          last_wakeup;  /*!< time of last counted wakeup */
+    int             wakeups;      /*!< distinct wakeups in current period */
+    int             windows;      /*!< windows recorded in current period */
+    bool            overflow;     /*!< window[] was too small */
+    int             hour_wakeups; /*!< wakeups during previous period */
+    int             hour_optimal; /*!< optimum for previous period */
+    wakeup_window_t window[WAKEUP_STATS_MAX_WINDOWS];
+} wakeup_stats_t;
+
+/** Number of power of two buckets in batch size histograms */
+#define BATCH_STATS_BUCKETS 8
+
+/** Batch size statistics */
+typedef struct {
+    unsigned batches;                   /*!< number of batches */
+    unsigned items;                     /*!< total number of items */
+    unsigned largest;                   /*!< largest batch seen */
+    unsigned hist[BATCH_STATS_BUCKETS]; /*!< 1, 2-3, 4-7, ..., 128+ items */
+} batch_stats_t;
+
+/** Events that can trigger client wakeup processing */
+typedef enum {
+    WAKEUP_SOURCE_REQUEST,   /*!< client activity */
+    WAKEUP_SOURCE_HEARTBEAT, /*!< hwwd kicker heartbeat */
+    WAKEUP_SOURCE_TIMER,     /*!< wakeup_timer */
+    WAKEUP_SOURCE_RTC,       /*!< rtc alarm, i.e. resume from suspend */
+    WAKEUP_SOURCE_COUNT
+} wakeup_source_t;
+
+/** Wakeup counters for one wakeup source */
+typedef struct {
+    unsigned passes;  /*!< wakeup passes that woke up clients */
+    unsigned clients; /*!< clients woken up */
+} wakeup_source_stats_t;
+
+/** Clock, timer and I/O operations used by client scheduling
+ *
+ * Normally these map directly to kernel interfaces and glib timers.
+ * The scheduling simulator in test/ substitutes them with versions
+ * operating on virtual time, so that policy changes can be evaluated
+ * deterministically.
+ */
+typedef struct {
+    /** Get monotonic time that advances also during suspend */
+    bool     (*get_time)(struct timeval *tv);
+
+    /** Start / stop mainloop timer */
+    guint    (*timer_add)(guint ms, GSourceFunc cb, gpointer aptr);
+    gboolean (*timer_remove)(guint id);
+
+    /** Acquire / release wakelock that blocks suspend */
+    void     (*wakelock_lock)(const char *name, int ms);
+    void     (*wakelock_unlock)(const char *name);
+
+    /** Program alarm to resume the device after delay, zero disables */
+    bool     (*alarm_program)(const struct timeval *delay);
+
+    /** Send data to external client socket */
+    bool     (*client_send)(int fd, const void *data, size_t size);
+
+    /** Enable / disable iphb wakeups from kernel */
+    void     (*kernel_watch)(bool enable);
+
+    /** Tell hwwd kicker process that we're still alive */
+    void     (*watchdog_sync)(void);
+} iphb_env_t;
+
+/** Mainloop timer that is driven by CLOCK_BOOTTIME timerfd */
+typedef struct {
+    guint            id;       /*!< timer id, or 0 if slot is free */
+    guint            interval; /*!< timer period [ms] */
+    struct timeval   due;      /*!< next trigger time [monotime] */
+    GSourceFunc      cb;       /*!< timer callback */
+    gpointer         aptr;     /*!< callback parameter */
+} boottimer_t;
+
+/** Counters for rtc access avoided by caching */
+typedef struct {
+    unsigned alarm_writes;  /*!< rtc alarm programmings */
+    unsigned alarm_elided;  /*!< reprogrammings skipped, alarm already set */
+    unsigned delta_updates; /*!< rtc vs system time delta calculations */
+    unsigned delta_elided;  /*!< delta calculations skipped */
+    unsigned delta_writes;  /*!< DELTATIME_CACHE_FILE updates */
+} rtc_stats_t;
+
+/** Maximum number of concurrent timerfd driven timers */
+#define BOOTTIMER_MAX 8
+
 /** @brief  Allocated structure of one client in the linked client list in iphbd
  */
 typedef struct _client_t {
@@ -115,8 +267,26 @@ typedef struct _client_t {
     pid_t             pid;     /*!< client process ID */
     bool              wakeup;  /*!< resume to handle */
     struct _client_t *next;    /*!< pointer to the next client in the list (NULL if none) */
+    struct _client_t *prev;    /*!< pointer to the previous client in the list (NULL if none) */
+    int               heap_pos[CLIENT_HEAP_COUNT]; /*!< slots in client_heap[], -1 if not included */
+
+    unsigned          stat_requests; /*!< wait requests made */
+    unsigned          stat_wakeups;  /*!< wakeups delivered */
+    unsigned          stat_resumes;  /*!< wakeups delivered after rtc alarm */
+    unsigned          stat_late;     /*!< wakeups delivered after maxtime */
+    long long         stat_late_ms;  /*!< total lateness relative to maxtime */
+    long              stat_late_max; /*!< largest lateness relative to maxtime */
 } client_t;
 
+/** Binary min-heap of clients, positions are stored in the clients */
+typedef struct {
+    client_heap_id_t  id;         /*!< index to client_t::heap_pos[] */
+    bool              by_mintime; /*!< ordered by mintime instead of maxtime */
+    client_t        **vec;        /*!< heap array */
+    int               used;       /*!< entries in use */
+    int               size;       /*!< entries allocated */
+} client_heap_t;
+
 /* ------------------------------------------------------------------------- *
  * Function prototypes
  * ------------------------------------------------------------------------- */
@@ -125,11 +295,32 @@ static void clientlist_wakeup_clients_now(const struct timeval *now);
 static void clientlist_wakeup_clients_later(const struct timeval *now);
 static void clientlist_wakeup_clients_cancel(void);
 
+static const char *wakeup_align_repr(wakeup_align_t policy);
+static void wakeup_source_set(wakeup_source_t source);
+static void batch_stats_add(batch_stats_t *stats, unsigned items);
+
+static void clientlist_queue_wakeup(client_t *client, time_t waited);
+static void clientlist_index_client(client_t *client);
+static void clientlist_unindex_client(client_t *client);
+
 static bool epollfd_add_fd(int fd, void *ptr);
+static bool epollfd_add_fd_ex(int fd, void *ptr, uint32_t events);
 static void epollfd_remove_fd(int fd);
 
 static void systemtime_init(void);
 
+static bool monotime_get_tv_system(struct timeval *tv);
+static void wakelock_lock_system(const char *name, int ms);
+static void wakelock_unlock_system(const char *name);
+static bool rtc_set_alarm_after(time_t delay);
+static bool rtc_program_system(const struct timeval *delay);
+static bool alarmfd_program(const struct timeval *delay);
+static guint boottimer_add(guint ms, GSourceFunc cb, gpointer aptr);
+static gboolean boottimer_remove(guint id);
+static bool client_send_system(int fd, const void *data, size_t size);
+static void kernelfd_watch_system(bool enable);
+static void hwwd_feeder_sync_system(void);
+
 static char *tm_repr(const struct tm *tm, char *buff, size_t size);
 static char *t_repr(time_t t, char *buff, size_t size);
 
@@ -137,6 +328,37 @@ static char *t_repr(time_t t, char *buff, size_t size);
  * Variables
  * ------------------------------------------------------------------------- */
 
+/** Scheduling environment for a real device */
+static const iphb_env_t iphb_env_system =
+{
+    .get_time        = monotime_get_tv_system,
+    .timer_add       = g_timeout_add,
+    .timer_remove    = g_source_remove,
+    .wakelock_lock   = wakelock_lock_system,
+    .wakelock_unlock = wakelock_unlock_system,
+    .alarm_program   = rtc_program_system,
+    .client_send     = client_send_system,
+    .kernel_watch    = kernelfd_watch_system,
+    .watchdog_sync   = hwwd_feeder_sync_system,
+};
+
+/** Scheduling environment for devices with CLOCK_BOOTTIME_ALARM timerfd */
+static const iphb_env_t iphb_env_timerfd =
+{
+    .get_time        = monotime_get_tv_system,
+    .timer_add       = boottimer_add,
+    .timer_remove    = boottimer_remove,
+    .wakelock_lock   = wakelock_lock_system,
+    .wakelock_unlock = wakelock_unlock_system,
+    .alarm_program   = alarmfd_program,
+    .client_send     = client_send_system,
+    .kernel_watch    = kernelfd_watch_system,
+    .watchdog_sync   = hwwd_feeder_sync_system,
+};
+
+/** Scheduling environment in use */
+static const iphb_env_t *iphb_env = &iphb_env_system;
+
 /** Path to android alarm device node */
 static const char android_alarm_path[] = "/dev/alarm";
 
@@ -161,9 +383,88 @@ static const char rtc_path[] = "/dev/rtc0";
 /** File descriptor for RTC device node */
 static int rtc_fd = -1;
 
+/** Resume alarm programmed to rtc [monotime seconds]
+ *
+ * Zero if the alarm is disabled, or -1 if the rtc alarm state
+ * is not known and needs to be programmed on the next rethink.
+ */
+static time_t rtc_alarm_programmed = -1;
+
+/** When deltatime was last updated due to rtc programming [monotime] */
+static time_t rtc_deltatime_checked = 0;
+
+/** Rtc access statistics */
+static rtc_stats_t rtc_stats;
+
+/** Timerfd for resuming from suspend, or -1 if rtc is used instead */
+static int alarmfd = -1;
+
+/** Timerfd driving the boottimer table */
+static int boottimerfd = -1;
+
+/** Timers that keep running during suspend */
+static boottimer_t boottimer[BOOTTIMER_MAX];
+
+/** Id to assign to the next boottimer */
+static guint boottimer_id = 0;
+
 /** Linked lits of connected clients */
 static client_t *clients = NULL;
 
+/** Last client in the list of connected clients */
+static client_t *clients_tail = NULL;
+
+/** Lookup table for internal clients: client_t* -> client_t* */
+static GHashTable *internal_clients = NULL;
+
+/** Deadline heaps for waiting clients */
+static client_heap_t client_heap[CLIENT_HEAP_COUNT] =
+{
+    [CLIENT_HEAP_PENDING]        = { CLIENT_HEAP_PENDING,        true,  0, 0, 0 },
+    [CLIENT_HEAP_PENDING_RESUME] = { CLIENT_HEAP_PENDING_RESUME, false, 0, 0, 0 },
+    [CLIENT_HEAP_RIPE_RESUME]    = { CLIENT_HEAP_RIPE_RESUME,    false, 0, 0, 0 },
+    [CLIENT_HEAP_RIPE_OTHER]     = { CLIENT_HEAP_RIPE_OTHER,     false, 0, 0, 0 },
+};
+
+/** Number of waiting external clients */
+static int clients_waiting_external = 0;
+
+/** Active wakeup alignment policy */
+static wakeup_align_t wakeup_align_policy = WAKEUP_ALIGN_LEGACY;
+
+/** Resume wakeup statistics */
+static wakeup_stats_t wakeup_stats;
+
+/** Source of the next client wakeup pass */
+static wakeup_source_t wakeup_source_pending = WAKEUP_SOURCE_REQUEST;
+
+/** Source of the client wakeup pass in progress */
+static wakeup_source_t wakeup_source_active = WAKEUP_SOURCE_REQUEST;
+
+/** Wakeup counters per wakeup source */
+static wakeup_source_stats_t wakeup_source_stats[WAKEUP_SOURCE_COUNT];
+
+/** Flag for: D-Bus methods have been bound */
+static bool dbus_methods_bound = false;
+
+/** Sizes of epoll event batches handled per mainloop iteration */
+static batch_stats_t epoll_batch_stats;
+
+/** Sizes of external client wakeup batches */
+static batch_stats_t wakeup_batch_stats;
+
+/** External clients queued for wakeup */
+static struct {
+    client_t *client; /*!< client to wake up */
+    time_t    waited; /*!< seconds client has been sleeping */
+} *wakeup_batch = 0;
+
+/** Number of entries used in wakeup_batch */
+static int wakeup_batch_used = 0;
+
+/** Number of entries allocated for wakeup_batch */
+static int wakeup_batch_size = 0;
+
 /** Timer for serving wakeups with shorter than heartbeat range */
 static guint wakeup_timer = 0;
 
@@ -173,12 +474,6 @@ static DBusConnection *systembus = 0;
 /** Status of com.nokia.mce on systembus */
 static bool mce_is_running = false;
 
-/** Sysfs entry for acquiring wakelocks */
-static const char lock_path[]   = "/sys/power/wake_lock";
-
-/** Sysfs entry for releasing wakelocks */
-static const char unlock_path[] = "/sys/power/wake_unlock";
-
 /** RTC wakeup wakelock - acquired by dsme and released by mce / timeout */
 static const char rtc_wakeup[] = "mce_rtc_wakeup";
 
@@ -194,6 +489,9 @@ static time_t alarm_powerup = 0;
 /** When the next alarm that should resume the device is due [systime] */
 static time_t alarm_resume  = 0;
 
+/** "infinity" value for struct timeval data */
+static const struct timeval tv_invalid = { INT_MAX, 0 };
+
 /* ------------------------------------------------------------------------- *
  * Generic utility functions
  * ------------------------------------------------------------------------- */
@@ -241,6 +539,17 @@ static inline bool tv_ge(const struct timeval *tv1, const struct timeval *tv2)
  * @return true on success, or false on failure
  */
 static bool monotime_get_tv(struct timeval *tv)
+{
+    return iphb_env->get_time(tv);
+}
+
+/** Helper for getting monotonic time as struct timeval
+ *
+ * @param tv place to store the monotonic time
+ *
+ * @return true on success, or false on failure
+ */
+static bool monotime_get_tv_system(struct timeval *tv)
 {
     bool res = false;
 
@@ -321,6 +630,12 @@ cleanup:
 
 /** Tell hwwd kicker process that we're still alive */
 static void hwwd_feeder_sync(void)
+{
+    iphb_env->watchdog_sync();
+}
+
+/** Send SIGHUP to hwwd kicker process */
+static void hwwd_feeder_sync_system(void)
 {
     /* The parent process is hwwd kicker, and the SIGHUP will interrupt
      * the nanosleep() it is most likely at */
@@ -331,47 +646,15 @@ static void hwwd_feeder_sync(void)
  * Utilities for manipulating wakelocks
  * ------------------------------------------------------------------------- */
 
-/** Whether the wakelock sysfs paths are available
- *
- * @return true if wakelocks are supported, false otherwise
- */
-static bool wakelock_supported(void)
-{
-    static bool checked = false;
-    static bool supported = false;
-
-    if( !checked ) {
-	checked = true;
-	supported = (access(lock_path, W_OK) == 0 &&
-		     access(unlock_path, W_OK) == 0);
-    }
-
-    return supported;
-}
-
-/** Helper for writing to sysfs files
+/** Create and enable a wakelock.
  *
- * @param path file to write to
- * @param data string to write
+ * @param name The name of the wakelock to obtain
+ * @param ms   Time in milliseconds before the wakelock gets released
+ *             automatically, or negative value for no timeout.
  */
-static void wakelock_write(const char *path, const char *data, int ignore)
+static void wakelock_lock(const char *name, int ms)
 {
-    int file;
-
-    if( (file = TEMP_FAILURE_RETRY(open(path, O_WRONLY))) == -1 ) {
-	dsme_log(LOG_WARNING, PFIX"%s: open: %m", path);
-    }
-    else {
-	int size = strlen(data);
-	errno = 0;
-	if( TEMP_FAILURE_RETRY(write(file, data, size)) != size ) {
-	    if( errno != ignore )
-		dsme_log(LOG_WARNING, PFIX"%s: write: %m", path);
-	}
-	if( TEMP_FAILURE_RETRY(close(file)) == -1 ) {
-	    dsme_log(LOG_WARNING, PFIX"%s: close: %m", path);
-	}
-    }
+    iphb_env->wakelock_lock(name, ms);
 }
 
 /** Use sysfs interface to create and enable a wakelock.
@@ -380,36 +663,37 @@ static void wakelock_write(const char *path, const char *data, int ignore)
  * @param ms   Time in milliseconds before the wakelock gets released
  *             automatically, or negative value for no timeout.
  */
-static void wakelock_lock(const char *name, int ms)
+static void wakelock_lock_system(const char *name, int ms)
 {
     dsme_log(LOG_DEBUG, PFIX"LOCK: %s %d", name, ms);
-    if( wakelock_supported() ) {
-	char tmp[256];
-	if( ms < 0 ) {
-	    snprintf(tmp, sizeof tmp, "%s\n", name);
-	}
-	else {
-	    long long ns = ms * 1000000LL;
-	    snprintf(tmp, sizeof tmp, "%s %lld\n", name, ns);
-	}
-	wakelock_write(lock_path, tmp, -1);
+    if( dsme_wakelock_supported() ) {
+	if( !dsme_wakelock_lock(name, ms) )
+	    dsme_log(LOG_WARNING, PFIX"%s: lock: %m", name);
     }
 }
 
+/** Disable a wakelock.
+ *
+ * @param name The name of the wakelock to release
+ */
+static void wakelock_unlock(const char *name)
+{
+    iphb_env->wakelock_unlock(name);
+}
+
 /** Use sysfs interface to disable a wakelock.
  *
  * @param name The name of the wakelock to release
  *
  * Note: This will not delete the wakelocks.
  */
-static void wakelock_unlock(const char *name)
+static void wakelock_unlock_system(const char *name)
 {
     dsme_log(LOG_DEBUG, PFIX"UNLK: %s", name);
-    if( wakelock_supported() ) {
-	char tmp[256];
-	snprintf(tmp, sizeof tmp, "%s\n", name);
+    if( dsme_wakelock_supported() ) {
 	/* assume EINVAL == the wakelock did not exist */
-	wakelock_write(unlock_path, tmp, EINVAL);
+	if( !dsme_wakelock_unlock(name) && errno != EINVAL )
+	    dsme_log(LOG_WARNING, PFIX"%s: unlock: %m", name);
     }
 }
 
@@ -858,6 +1142,8 @@ static void deltatime_set(time_t delta)
         goto cleanup;
     }
 
+    rtc_stats.delta_writes += 1;
+
 cleanup:
 
     if( fd != -1 ) close(fd);
@@ -875,6 +1161,8 @@ static void deltatime_update(void)
 
     time_t delta = 0;
 
+    rtc_stats.delta_updates += 1;
+
     if( deltatime_is_needed ) {
         /* Calculate system time - rtc time delta */
         time_t t_rtc = rtc_get_time_tm(&tm);
@@ -1241,9 +1529,14 @@ static bool rtc_set_alarm_after(time_t delay)
     dsme_log(LOG_INFO, PFIX"system : %s", t_repr(sys, tmp, sizeof tmp));
     dsme_log(LOG_INFO, PFIX"alarm  : %s", t_repr(alm, tmp, sizeof tmp));
 
+    /* whatever happens below, cached alarm state is no longer valid */
+    rtc_alarm_programmed = -1;
+
     if( rtc_fd == -1 )
 	goto cleanup;
 
+    rtc_stats.alarm_writes += 1;
+
     if( rtc_get_time_tm(&tm) == (time_t)-1 )
 	goto cleanup;
 
@@ -1267,6 +1560,83 @@ cleanup:
     return result;
 }
 
+/** Check if rtc alarm needs to be reprogrammed
+ *
+ * @param alarm  wanted alarm time [monotime seconds], or 0 for disabled
+ * @param now    current time [monotime seconds]
+ *
+ * @return true if the alarm already programmed to rtc can be used
+ */
+static bool rtc_alarm_is_programmed(time_t alarm, time_t now)
+{
+    if( rtc_alarm_programmed < 0 )
+	return false;
+
+    if( !alarm || !rtc_alarm_programmed )
+	return alarm == rtc_alarm_programmed;
+
+    /* alarm that has already triggered must be reprogrammed */
+    if( rtc_alarm_programmed <= now )
+	return false;
+
+    /* resuming slightly early is harmless, clients that are not
+     * ripe yet just cause the alarm to be programmed again */
+    return (rtc_alarm_programmed <= alarm &&
+	    alarm - rtc_alarm_programmed <= RTC_ALARM_TOLERANCE_SECS);
+}
+
+/** Program resume alarm via /dev/rtc
+ *
+ * The rtc has one second resolution, so the alarm is set to the start
+ * of the second the wakeup time falls in. Reprogramming is skipped if
+ * the alarm that is already set is close enough.
+ *
+ * Since the rtc alarm is set relative to rtc time, the sys_time vs
+ * rtc_time delta statistics are updated too - but not more often
+ * than once per DELTATIME_UPDATE_INTERVAL.
+ *
+ * @param delay time from now to alarm time, or zero to disable
+ *
+ * @return true on success, or false in case of errors
+ */
+static bool rtc_program_system(const struct timeval *delay)
+{
+    bool           result = true;
+    time_t         secs   = 0;
+    time_t         alarm  = 0;
+    struct timeval now;
+
+    monotime_get_tv(&now);
+
+    if( timerisset(delay) ) {
+	struct timeval alm;
+	timeradd(&now, delay, &alm);
+	if( (secs = alm.tv_sec - now.tv_sec) < 1 )
+	    secs = 1;
+	alarm = now.tv_sec + secs;
+    }
+
+    if( rtc_alarm_is_programmed(alarm, now.tv_sec) ) {
+	dsme_log(LOG_DEBUG, PFIX"wakeup delay %d; rtc alarm already set",
+		 (int)secs);
+	rtc_stats.alarm_elided += 1;
+    }
+    else if( (result = rtc_set_alarm_after(secs)) ) {
+	rtc_alarm_programmed = alarm;
+    }
+
+    if( !rtc_deltatime_checked ||
+	now.tv_sec - rtc_deltatime_checked >= DELTATIME_UPDATE_INTERVAL ) {
+	rtc_deltatime_checked = now.tv_sec;
+	deltatime_update();
+    }
+    else {
+	rtc_stats.delta_elided += 1;
+    }
+
+    return result;
+}
+
 /** Set rtc wakeup to happen at the next power up alarm time
  *
  * To be called at module unload time so that wakeup alarm
@@ -1312,6 +1682,9 @@ static bool rtc_handle_input(void)
 
     dsme_log(LOG_INFO, PFIX"wakeup via RTC alarm");
 
+    /* the alarm might have triggered; make sure it gets reprogrammed */
+    rtc_alarm_programmed = -1;
+
     if( rtc_fd == -1 ) {
 	dsme_log(LOG_WARNING, PFIX"failed to read %s: %s",  rtc_path,
 		"the device node is not opened");
@@ -1363,6 +1736,9 @@ static bool rtc_handle_input(void)
     /* acquire wakelock that is passed to mce via ipc */
     wakelock_lock(rtc_wakeup, -1);
 
+    /* clients woken up next have been waiting for resume */
+    wakeup_source_set(WAKEUP_SOURCE_RTC);
+
     result = true;
 
 cleanup:
@@ -1379,6 +1755,7 @@ static void rtc_detach(void)
     if( rtc_fd != -1 ) {
 	epollfd_remove_fd(rtc_fd);
 	close(rtc_fd), rtc_fd = -1;
+	rtc_alarm_programmed = -1;
 
 	dsme_log(LOG_INFO, PFIX"closed %s", rtc_path);
     }
@@ -1420,129 +1797,430 @@ cleanup:
 }
 
 /* ------------------------------------------------------------------------- *
- * kernelfd
+ * alarmfd
  * ------------------------------------------------------------------------- */
 
-/** Handle iphb event from kernel side
+/** Program resume alarm via CLOCK_BOOTTIME_ALARM timerfd
+ *
+ * Unlike the rtc alarm, this operates directly on the same clock
+ * as the client wakeup times and has sub-second resolution. The
+ * alarm is triggered early by the amount clients wakeups get
+ * delayed after it, so that clients get woken up on time.
+ *
+ * @param delay time from now to alarm time, or zero to disable
+ *
+ * @return true on success, or false in case of errors
  */
-static void kernelfd_handle_event(void)
+static bool alarmfd_program(const struct timeval *delay)
 {
-    /* tell the driver that we have dealt with the event */
-    while (read(kernelfd, 0, 0) == -1 && errno == EINTR);
+    struct itimerspec its;
+
+    struct timeval early = {
+	CLIENTLIST_WAKEUP_DELAY_MS / 1000,
+	CLIENTLIST_WAKEUP_DELAY_MS % 1000 * 1000
+    };
+    struct timeval alarm = *delay;
+
+    if( tv_gt(&alarm, &early) )
+	timersub(&alarm, &early, &alarm);
+
+    memset(&its, 0, sizeof its);
+    its.it_value.tv_sec  = alarm.tv_sec;
+    its.it_value.tv_nsec = alarm.tv_usec * 1000;
+
+    if( timerisset(delay) )
+	dsme_log(LOG_INFO, PFIX"wakeup delay %ld.%03ld",
+		 (long)delay->tv_sec, (long)(delay->tv_usec / 1000));
+    else
+	dsme_log(LOG_INFO, PFIX"wakeup delay disabled");
+
+    if( alarmfd == -1 )
+	return false;
+
+    if( timerfd_settime(alarmfd, 0, &its, 0) == -1 ) {
+	dsme_log(LOG_WARNING, PFIX"failed to program alarm timerfd: %m");
+	return false;
+    }
+
+    return true;
 }
 
-/** Open kernel module handle if not already open
+/** Handle input from alarm timerfd
  *
- * Can retry later if fails (meaning LKM is not loaded)
+ * @return true if the alarm has triggered, false otherwise
  */
-static void kernelfd_open(void)
+static bool alarmfd_handle_input(void)
 {
-    static const char msg[] = HB_LKM_KICK_ME_PERIOD;
+    uint64_t count = 0;
 
-    static bool kernel_module_load_error_logged = false;
+    if( read(alarmfd, &count, sizeof count) != sizeof count ) {
+	if( errno != EAGAIN && errno != EINTR )
+	    dsme_log(LOG_WARNING, PFIX"failed to read alarm timerfd: %m");
+	return false;
+    }
 
-    int saved_errno;
+    dsme_log(LOG_INFO, PFIX"wakeup via timerfd alarm");
 
-    if( kernelfd != -1 )
-	return;
+    /* acquire wakelock that is passed to mce via ipc */
+    wakelock_lock(rtc_wakeup, -1);
 
-    if( (kernelfd = open(HB_KERNEL_DEVICE, O_RDWR)) != -1 )
-	goto initialize;
+    /* clients woken up next have been waiting for resume */
+    wakeup_source_set(WAKEUP_SOURCE_RTC);
 
-    saved_errno = errno; /* log with errno from HB_KERNEL_DEVICE */
+    return true;
+}
 
-    if( (kernelfd = open(HB_KERNEL_DEVICE_TEST, O_RDWR)) != -1 )
-	goto initialize;
+/** Reprogram boottimerfd to trigger when the first boottimer is due
+ */
+static void boottimer_rethink(void)
+{
+    struct timeval    due = tv_invalid;
+    struct itimerspec its;
 
-    if( !kernel_module_load_error_logged ) {
-	kernel_module_load_error_logged = true;
-	errno = saved_errno;
-	if( errno == ENOENT ) {
-	    /* Having a kernel that supports iphb wakeups is a special case.
-	     *
-	     * Not having it just means we are missing one wakeup source to
-	     * synchronize with i.e. no need to create noise about it on
-	     * default verbosity level */
-	    dsme_log(LOG_INFO, PFIX"kernel does not support iphb wakeups");
-	}
-	else
-	    dsme_log(LOG_ERR, PFIX"failed to open kernel connection '%s' (%m)",
-		     HB_KERNEL_DEVICE);
+    for( int i = 0; i < BOOTTIMER_MAX; ++i ) {
+	if( boottimer[i].id && tv_lt(&boottimer[i].due, &due) )
+	    due = boottimer[i].due;
     }
 
-    return;
-
-initialize:
-    dsme_log(LOG_DEBUG, PFIX"opened kernel socket %d to %s, "
-	     "wakeup from kernel=%s",
-	     kernelfd,
-	     HB_KERNEL_DEVICE,
-	     msg);
+    memset(&its, 0, sizeof its);
+    if( tv_lt(&due, &tv_invalid) ) {
+	its.it_value.tv_sec  = due.tv_sec;
+	its.it_value.tv_nsec = due.tv_usec * 1000;
 
-    if( write(kernelfd, msg, sizeof msg) == -1 ) {
-	dsme_log(LOG_ERR, PFIX"failed to write kernel message (%m)");
-	// TODO: do something clever?
-    }
-    else if( !epollfd_add_fd(kernelfd, &kernelfd) ) {
-	dsme_log(LOG_ERR, PFIX"failed to add kernel fd to epoll set");
-	// TODO: do something clever?
+	/* zero it_value would disarm the timer */
+	if( !its.it_value.tv_sec && !its.it_value.tv_nsec )
+	    its.it_value.tv_nsec = 1;
     }
-}
 
-/** Close kernel module handle */
-static void kernelfd_close(void)
-{
-    if( kernelfd != -1 ) {
-	epollfd_remove_fd(kernelfd);
-        close(kernelfd);
-        dsme_log(LOG_DEBUG, PFIX"closed kernel socket %d", kernelfd);
-        kernelfd = -1;
-    }
+    if( timerfd_settime(boottimerfd, TFD_TIMER_ABSTIME, &its, 0) == -1 )
+	dsme_log(LOG_WARNING, PFIX"failed to program boottime timerfd: %m");
 }
 
-/* ------------------------------------------------------------------------- *
- * libiphb clients
- * ------------------------------------------------------------------------- */
-
-/** Create a new external client instance
+/** Start a timer that keeps running during suspend
  *
- * @param fd	Socket descriptor
+ * Drop-in replacement for g_timeout_add(), but the time spent
+ * in suspend is included in the timeout.
  *
- * @return pointer to client object
+ * @param ms    timeout in milliseconds
+ * @param cb    callback function, return TRUE to repeat the timer
+ * @param aptr  parameter to pass to the callback
+ *
+ * @return timer id, or 0 in case of errors
  */
-static client_t *client_new_external(int fd)
+static guint boottimer_add(guint ms, GSourceFunc cb, gpointer aptr)
 {
-    client_t *self = calloc(1, sizeof *self);
+    struct timeval now, tmo;
+    boottimer_t   *timer = 0;
 
-    if( !self )
-	abort();
+    for( int i = 0; i < BOOTTIMER_MAX; ++i ) {
+	if( !boottimer[i].id ) {
+	    timer = &boottimer[i];
+	    break;
+	}
+    }
 
-    self->fd = fd;
+    if( !timer ) {
+	dsme_log(LOG_ERR, PFIX"boottimer table is full");
+	return 0;
+    }
 
-    /* Have something valid as description. Overrides are
-     * in client_new_internal() and client_handle_wait_req() */
-    self->pidtxt = strdup("unknown");
+    if( !++boottimer_id )
+	++boottimer_id;
 
-    /* All external clients should wake up from suspend too */
-    self->wakeup = true;
+    monotime_get_tv(&now);
+    tmo.tv_sec  = ms / 1000;
+    tmo.tv_usec = ms % 1000 * 1000;
 
-    return self;
+    timer->id       = boottimer_id;
+    timer->interval = ms;
+    timer->cb       = cb;
+    timer->aptr     = aptr;
+    timeradd(&now, &tmo, &timer->due);
+
+    boottimer_rethink();
+
+    return timer->id;
 }
 
-/** Create a new internal client instance
+/** Stop a timer started with boottimer_add()
  *
- * @param conn endpoint to wake up when triggered
- * @param data message data to be send on trigger
+ * @param id  timer id
  *
- * @return pointer to client object
+ * @return TRUE if the timer was found, FALSE otherwise
  */
-static client_t *client_new_internal(endpoint_t *conn, void* data)
+static gboolean boottimer_remove(guint id)
 {
-    static unsigned id = 0;
-    client_t *self = client_new_external(-1);
+    for( int i = 0; i < BOOTTIMER_MAX; ++i ) {
+	if( id && boottimer[i].id == id ) {
+	    memset(&boottimer[i], 0, sizeof boottimer[i]);
+	    boottimer_rethink();
+	    return TRUE;
+	}
+    }
 
-    self->conn   = endpoint_copy(conn);
-    self->data   = data;
+    return FALSE;
+}
+
+/** Handle input from boottime timerfd; dispatch timers that are due
+ */
+static void boottimer_handle_input(void)
+{
+    uint64_t       count = 0;
+    struct timeval now;
+
+    if( read(boottimerfd, &count, sizeof count) != sizeof count ) {
+	if( errno != EAGAIN && errno != EINTR )
+	    dsme_log(LOG_WARNING, PFIX"failed to read boottime timerfd: %m");
+    }
+
+    monotime_get_tv(&now);
+
+    for( int i = 0; i < BOOTTIMER_MAX; ++i ) {
+	boottimer_t *timer = &boottimer[i];
+	guint        id    = timer->id;
+
+	if( !id || tv_gt(&timer->due, &now) )
+	    continue;
+
+	gboolean repeat = timer->cb(timer->aptr);
+
+	/* the callback might have removed the timer already */
+	if( timer->id != id )
+	    continue;
+
+	if( repeat ) {
+	    struct timeval tmo = {
+		timer->interval / 1000,
+		timer->interval % 1000 * 1000
+	    };
+	    timeradd(&now, &tmo, &timer->due);
+	}
+	else {
+	    memset(timer, 0, sizeof *timer);
+	}
+    }
+
+    boottimer_rethink();
+}
+
+/** Close alarm and boottime timerfds
+ *
+ * Switches scheduling back to rtc alarms and glib timers.
+ */
+static void alarmfd_quit(void)
+{
+    if( iphb_env == &iphb_env_timerfd )
+	iphb_env = &iphb_env_system;
+
+    if( alarmfd != -1 ) {
+	epollfd_remove_fd(alarmfd);
+	close(alarmfd), alarmfd = -1;
+    }
+
+    if( boottimerfd != -1 ) {
+	epollfd_remove_fd(boottimerfd);
+	close(boottimerfd), boottimerfd = -1;
+    }
+
+    memset(boottimer, 0, sizeof boottimer);
+}
+
+/** Use timerfds for resume alarms and timers, if kernel supports it
+ *
+ * With CLOCK_BOOTTIME_ALARM the rtc alarm does not need to be kept
+ * in sync with system time on every reprogramming, and wakeups can
+ * be scheduled with sub-second precision. If the timerfds can't be
+ * created, rtc alarms and glib timers remain in use.
+ *
+ * @return true if timerfd backend is in use, false otherwise
+ */
+static bool alarmfd_init(void)
+{
+    int afd = -1;
+    int bfd = -1;
+
+    if( alarmfd != -1 )
+	goto cleanup;
+
+#if defined(CLOCK_BOOTTIME_ALARM)
+    afd = timerfd_create(CLOCK_BOOTTIME_ALARM, TFD_NONBLOCK | TFD_CLOEXEC);
+    if( afd == -1 ) {
+	dsme_log(LOG_INFO, PFIX"alarm timerfd not available: %m");
+	goto cleanup;
+    }
+
+    bfd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if( bfd == -1 ) {
+	dsme_log(LOG_WARNING, PFIX"boottime timerfd not available: %m");
+	goto cleanup;
+    }
+#else
+    dsme_log(LOG_INFO, PFIX"alarm timerfd not supported");
+    goto cleanup;
+#endif
+
+    /* make sure the device stays awake until the alarm is handled */
+    if( !epollfd_add_fd_ex(afd, &alarmfd, EPOLLIN | EPOLLWAKEUP) )
+	goto cleanup;
+
+    if( !epollfd_add_fd(bfd, &boottimerfd) ) {
+	epollfd_remove_fd(afd);
+	goto cleanup;
+    }
+
+    alarmfd     = afd, afd = -1;
+    boottimerfd = bfd, bfd = -1;
+    iphb_env    = &iphb_env_timerfd;
+
+    dsme_log(LOG_INFO, PFIX"using timerfd for resume alarms");
+
+cleanup:
+
+    if( afd != -1 ) close(afd);
+    if( bfd != -1 ) close(bfd);
+
+    return alarmfd != -1;
+}
+
+/* ------------------------------------------------------------------------- *
+ * kernelfd
+ * ------------------------------------------------------------------------- */
+
+/** Handle iphb event from kernel side
+ */
+static void kernelfd_handle_event(void)
+{
+    /* tell the driver that we have dealt with the event */
+    while (read(kernelfd, 0, 0) == -1 && errno == EINTR);
+}
+
+/** Open kernel module handle if not already open
+ *
+ * Can retry later if fails (meaning LKM is not loaded)
+ */
+static void kernelfd_open(void)
+{
+    static const char msg[] = HB_LKM_KICK_ME_PERIOD;
+
+    static bool kernel_module_load_error_logged = false;
+
+    int saved_errno;
+
+    if( kernelfd != -1 )
+	return;
+
+    if( (kernelfd = open(HB_KERNEL_DEVICE, O_RDWR)) != -1 )
+	goto initialize;
+
+    saved_errno = errno; /* log with errno from HB_KERNEL_DEVICE */
+
+    if( (kernelfd = open(HB_KERNEL_DEVICE_TEST, O_RDWR)) != -1 )
+	goto initialize;
+
+    if( !kernel_module_load_error_logged ) {
+	kernel_module_load_error_logged = true;
+	errno = saved_errno;
+	if( errno == ENOENT ) {
+	    /* Having a kernel that supports iphb wakeups is a special case.
+	     *
+	     * Not having it just means we are missing one wakeup source to
+	     * synchronize with i.e. no need to create noise about it on
+	     * default verbosity level */
+	    dsme_log(LOG_INFO, PFIX"kernel does not support iphb wakeups");
+	}
+	else
+	    dsme_log(LOG_ERR, PFIX"failed to open kernel connection '%s' (%m)",
+		     HB_KERNEL_DEVICE);
+    }
+
+    return;
+
+initialize:
+    dsme_log(LOG_DEBUG, PFIX"opened kernel socket %d to %s, "
+	     "wakeup from kernel=%s",
+	     kernelfd,
+	     HB_KERNEL_DEVICE,
+	     msg);
+
+    if( write(kernelfd, msg, sizeof msg) == -1 ) {
+	dsme_log(LOG_ERR, PFIX"failed to write kernel message (%m)");
+	// TODO: do something clever?
+    }
+    else if( !epollfd_add_fd(kernelfd, &kernelfd) ) {
+	dsme_log(LOG_ERR, PFIX"failed to add kernel fd to epoll set");
+	// TODO: do something clever?
+    }
+}
+
+/** Close kernel module handle */
+static void kernelfd_close(void)
+{
+    if( kernelfd != -1 ) {
+	epollfd_remove_fd(kernelfd);
+        close(kernelfd);
+        dsme_log(LOG_DEBUG, PFIX"closed kernel socket %d", kernelfd);
+        kernelfd = -1;
+    }
+}
+
+/** Open or close kernel iphb connection
+ *
+ * @param enable true to open, false to close
+ */
+static void kernelfd_watch_system(bool enable)
+{
+    if( enable )
+	kernelfd_open();
+    else
+	kernelfd_close();
+}
+
+/* ------------------------------------------------------------------------- *
+ * libiphb clients
+ * ------------------------------------------------------------------------- */
+
+/** Create a new external client instance
+ *
+ * @param fd	Socket descriptor
+ *
+ * @return pointer to client object
+ */
+static client_t *client_new_external(int fd)
+{
+    client_t *self = calloc(1, sizeof *self);
+
+    if( !self )
+	abort();
+
+    self->fd = fd;
+
+    for( int i = 0; i < CLIENT_HEAP_COUNT; ++i )
+	self->heap_pos[i] = -1;
+
+    /* Have something valid as description. Overrides are
+     * in client_new_internal() and client_handle_wait_req() */
+    self->pidtxt = strdup("unknown");
+
+    /* All external clients should wake up from suspend too */
+    self->wakeup = true;
+
+    return self;
+}
+
+/** Create a new internal client instance
+ *
+ * @param conn endpoint to wake up when triggered
+ * @param data message data to be send on trigger
+ *
+ * @return pointer to client object
+ */
+static client_t *client_new_internal(endpoint_t *conn, void* data)
+{
+    static unsigned id = 0;
+    client_t *self = client_new_external(-1);
+
+    self->conn   = endpoint_copy(conn);
+    self->data   = data;
 
     free(self->pidtxt);
     if( asprintf(&self->pidtxt,"internal-%u", ++id) < 0 )
@@ -1605,13 +2283,29 @@ static bool client_wakeup(client_t *self, const struct timeval *now)
     dsme_log(LOG_DEBUG, PFIX"waking up client %s who has slept %ld secs",
 	     self->pidtxt, (long)tv.tv_sec);
 
-    if( client_is_external(self) ) {
-        struct _iphb_wait_resp_t resp = { 0 };
+    /* update wakeup statistics */
+    self->stat_wakeups += 1;
 
-        resp.waited = tv.tv_sec;
+    if( wakeup_source_active == WAKEUP_SOURCE_RTC )
+	self->stat_resumes += 1;
 
-        if( send(self->fd, &resp, sizeof resp, MSG_DONTWAIT|MSG_NOSIGNAL) == sizeof resp)
-            woken_up = true;
+    if( tv_lt(&self->maxtime, now) ) {
+	struct timeval late;
+	timersub(now, &self->maxtime, &late);
+
+	long ms = late.tv_sec * 1000L + late.tv_usec / 1000;
+	self->stat_late    += 1;
+	self->stat_late_ms += ms;
+	if( self->stat_late_max < ms )
+	    self->stat_late_max = ms;
+    }
+
+    wakeup_source_stats[wakeup_source_active].clients += 1;
+
+    if( client_is_external(self) ) {
+	/* actual sending is done in clientlist_flush_wakeups() */
+	clientlist_queue_wakeup(self, tv.tv_sec);
+	woken_up = true;
     }
     else {
         DSM_MSGTYPE_WAKEUP msg = DSME_MSG_INIT(DSM_MSGTYPE_WAKEUP);
@@ -1624,6 +2318,7 @@ static bool client_wakeup(client_t *self, const struct timeval *now)
     }
 
     timerclear(&self->reqtime);
+    clientlist_unindex_client(self);
 
     return woken_up;
 }
@@ -1764,6 +2459,8 @@ static bool client_handle_wait_req(client_t                      *self,
 	self->pidtxt = pid2text(req->pid);
     }
 
+    self->stat_requests += 1;
+
     /* reset mintime & maxtime to time-of-request */
     self->reqtime = self->mintime = self->maxtime = *now;
 
@@ -1821,55 +2518,478 @@ static bool client_handle_wait_req(client_t                      *self,
     if( self->wakeup )
 	dsme_log(LOG_DEBUG, PFIX"client %s wakeup flag set", self->pidtxt);
 
+    /* update position in deadline heaps */
+    clientlist_index_client(self);
+
     return client_woken;
 }
 
-/** Send status report to external client
+/** Send status report to external client
+ *
+ * The status data includes
+ * - number of clients
+ * - number of clients with active wakeup request
+ * - seconds to the next client to be woken up
+ *
+ * @param self pointer to client object
+ */
+static void client_handle_stat_req(client_t *self)
+{
+    struct iphb_stats stats   = { 0 };
+    int               next_hb = INT_MAX;
+    int               flags   = MSG_DONTWAIT | MSG_NOSIGNAL;
+
+    struct timeval    tv_now;
+
+    monotime_get_tv(&tv_now);
+
+    for( client_t *c = clients; c; c = c->next ) {
+        stats.clients++;
+
+	if( !client_wait_started(c) )
+	    continue;
+
+	stats.waiting++;
+
+	if( next_hb > c->maxtime.tv_sec )
+	    next_hb = c->maxtime.tv_sec;
+    }
+
+    if( next_hb < INT_MAX )
+	stats.next_hb = next_hb - tv_now.tv_sec;
+
+    if( send(self->fd, &stats, sizeof stats, flags) != sizeof stats )
+    {
+        dsme_log(LOG_ERR, PFIX"failed to send to client %s (%m)",
+		 self->pidtxt);
+	// do not drop yet
+    }
+}
+
+/* ------------------------------------------------------------------------- *
+ * wakeup alignment policy & statistics
+ * ------------------------------------------------------------------------- */
+
+/** Select wakeup alignment policy based on DSME_IPHB_ALIGN env variable
+ */
+static void wakeup_align_init(void)
+{
+    const char *env = getenv("DSME_IPHB_ALIGN");
+
+    if( env && !strcmp(env, "stabbing") )
+	wakeup_align_policy = WAKEUP_ALIGN_STABBING;
+    else if( env && strcmp(env, "legacy") )
+	dsme_log(LOG_WARNING, PFIX"unknown alignment policy '%s'", env);
+
+    dsme_log(LOG_INFO, PFIX"using %s wakeup alignment",
+	     wakeup_align_repr(wakeup_align_policy));
+}
+
+/** Get human readable name of wakeup alignment policy
+ *
+ * @param policy WAKEUP_ALIGN_xxx value
+ *
+ * @return policy name
+ */
+static const char *wakeup_align_repr(wakeup_align_t policy)
+{
+    return (policy == WAKEUP_ALIGN_STABBING) ? "stabbing" : "legacy";
+}
+
+/** Record size of a processed batch
+ *
+ * @param stats batch statistics
+ * @param items number of items in the batch
+ */
+static void batch_stats_add(batch_stats_t *stats, unsigned items)
+{
+    int bucket = 0;
+
+    while( bucket < BATCH_STATS_BUCKETS - 1 && (items >> (bucket + 1)) )
+	++bucket;
+
+    stats->batches += 1;
+    stats->items   += items;
+    stats->hist[bucket] += 1;
+
+    if( stats->largest < items )
+	stats->largest = items;
+}
+
+/** Log batch size statistics
+ *
+ * @param stats batch statistics
+ * @param what  name of the batched items
+ */
+static void batch_stats_log(const batch_stats_t *stats, const char *what)
+{
+    const unsigned *h = stats->hist;
+
+    dsme_log(LOG_INFO, PFIX"%s batches: %u, items: %u, largest: %u,"
+	     " histogram: %u %u %u %u %u %u %u %u", what,
+	     stats->batches, stats->items, stats->largest,
+	     h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7]);
+}
+
+/** Get human readable name of wakeup source
+ *
+ * @param source WAKEUP_SOURCE_xxx value
+ *
+ * @return source name
+ */
+static const char *wakeup_source_repr(wakeup_source_t source)
+{
+    static const char * const lut[WAKEUP_SOURCE_COUNT] =
+    {
+	[WAKEUP_SOURCE_REQUEST]   = "request",
+	[WAKEUP_SOURCE_HEARTBEAT] = "heartbeat",
+	[WAKEUP_SOURCE_TIMER]     = "timer",
+	[WAKEUP_SOURCE_RTC]       = "rtc",
+    };
+
+    return (source < WAKEUP_SOURCE_COUNT) ? lut[source] : "unknown";
+}
+
+/** Mark what triggers the next client wakeup pass
+ *
+ * If several events occur before the pass, the one most likely
+ * to have been caused by iphb itself is used, rtc alarms first.
+ *
+ * @param source WAKEUP_SOURCE_xxx value
+ */
+static void wakeup_source_set(wakeup_source_t source)
+{
+    if( wakeup_source_pending < source )
+	wakeup_source_pending = source;
+}
+
+/** Generate human readable wakeup statistics report
+ *
+ * @return report text, to be released with free()
+ */
+static char *iphb_stats_report(void)
+{
+    char   *data = 0;
+    size_t  size = 0;
+    FILE   *file = open_memstream(&data, &size);
+
+    if( !file )
+	goto EXIT;
+
+    fprintf(file, "policy: %s\n", wakeup_align_repr(wakeup_align_policy));
+
+    if( wakeup_stats.hour_wakeups || wakeup_stats.hour_optimal )
+	fprintf(file, "wakeups/hour: %d (optimal %d)\n",
+		wakeup_stats.hour_wakeups, wakeup_stats.hour_optimal);
+
+    fprintf(file, "rtc alarm: writes %u elided %u\n",
+	    rtc_stats.alarm_writes, rtc_stats.alarm_elided);
+    fprintf(file, "rtc delta: updates %u elided %u writes %u\n",
+	    rtc_stats.delta_updates, rtc_stats.delta_elided,
+	    rtc_stats.delta_writes);
+
+    for( int i = 0; i < WAKEUP_SOURCE_COUNT; ++i ) {
+	fprintf(file, "source %s: passes %u clients %u\n",
+		wakeup_source_repr(i),
+		wakeup_source_stats[i].passes,
+		wakeup_source_stats[i].clients);
+    }
+
+    dsme_wakelock_report(file);
+
+    for( client_t *client = clients; client; client = client->next ) {
+	long avg = 0;
+
+	if( client->stat_late )
+	    avg = (long)(client->stat_late_ms / client->stat_late);
+
+	fprintf(file, "client %s: %s requests %u wakeups %u resumes %u"
+		" late %u avg %ld ms max %ld ms\n",
+		client->pidtxt,
+		client_is_external(client) ? "external" : "internal",
+		client->stat_requests, client->stat_wakeups,
+		client->stat_resumes, client->stat_late,
+		avg, client->stat_late_max);
+    }
+
+    if( fclose(file) == EOF )
+	free(data), data = 0;
+
+EXIT:
+    return data;
+}
+
+/** Qsort callback for ordering wakeup windows by maxtime
+ */
+static int wakeup_window_compare_cb(const void *a, const void *b)
+{
+    const wakeup_window_t *w1 = a;
+    const wakeup_window_t *w2 = b;
+
+    return (w1->maxtime > w2->maxtime) - (w1->maxtime < w2->maxtime);
+}
+
+/** Count minimum number of wakeups that can serve a set of windows
+ *
+ * Greedy interval stabbing: sort windows by end time, wake up at the
+ * end of the first window not yet served, and let that wakeup serve
+ * all windows it falls within.
+ *
+ * @param vec array of wakeup windows, will be reordered
+ * @param cnt number of wakeup windows
+ *
+ * @return number of wakeup instants needed
+ */
+static int wakeup_windows_stab(wakeup_window_t *vec, int cnt)
+{
+    int    stabs = 0;
+    time_t point = 0;
+
+    qsort(vec, cnt, sizeof *vec, wakeup_window_compare_cb);
+
+    for( int i = 0; i < cnt; ++i ) {
+	if( stabs && vec[i].mintime <= point )
+	    continue;
+	point = vec[i].maxtime;
+	stabs += 1;
+    }
+
+    return stabs;
+}
+
+/** Record resume wakeup of a client for statistics
+ *
+ * @param client client object that is about to be woken up
+ * @param now    current monotonic time
+ */
+static void wakeup_stats_add_client(const client_t *client,
+				    const struct timeval *now)
+{
+    if( wakeup_stats.last_wakeup != now->tv_sec ) {
+	wakeup_stats.last_wakeup = now->tv_sec;
+	wakeup_stats.wakeups += 1;
+    }
+
+    if( wakeup_stats.windows < WAKEUP_STATS_MAX_WINDOWS ) {
+	wakeup_window_t *win = &wakeup_stats.window[wakeup_stats.windows++];
+	win->mintime = client->mintime.tv_sec;
+	win->maxtime = client->maxtime.tv_sec;
+    }
+    else {
+	wakeup_stats.overflow = true;
+    }
+}
+
+/** Evaluate and report wakeup statistics once per hour
+ *
+ * Compares the number of resume wakeups the active policy made with
+ * the minimum achievable for the same client wakeup windows.
+ *
+ * @param now current monotonic time
+ */
+static void wakeup_stats_rethink(const struct timeval *now)
+{
+    if( !wakeup_stats.started ) {
+	wakeup_stats.started = now->tv_sec;
+	return;
+    }
+
+    if( now->tv_sec - wakeup_stats.started < WAKEUP_STATS_PERIOD )
+	return;
+
+    int optimal = wakeup_windows_stab(wakeup_stats.window,
+				      wakeup_stats.windows);
+
+    wakeup_stats.hour_wakeups = wakeup_stats.wakeups;
+    wakeup_stats.hour_optimal = optimal;
+
+    dsme_log(LOG_INFO, PFIX"wakeups/hour: %d with %s policy, %d%s with"
+	     " interval stabbing (%d clients)",
+	     wakeup_stats.wakeups, wakeup_align_repr(wakeup_align_policy),
+	     optimal, wakeup_stats.overflow ? "+" : "",
+	     wakeup_stats.windows);
+
+    batch_stats_log(&epoll_batch_stats, "epoll event");
+    batch_stats_log(&wakeup_batch_stats, "client wakeup");
+
+    wakeup_stats.started  = now->tv_sec;
+    wakeup_stats.wakeups  = 0;
+    wakeup_stats.windows  = 0;
+    wakeup_stats.overflow = false;
+}
+
+/* ------------------------------------------------------------------------- *
+ * deadline ordered client index
+ * ------------------------------------------------------------------------- */
+
+/** Get the time stamp a heap is ordered by
+ *
+ * @param heap   client heap
+ * @param client client object
+ *
+ * @return pointer to mintime or maxtime of the client
+ */
+static const struct timeval *client_heap_key(const client_heap_t *heap,
+					     const client_t *client)
+{
+    return heap->by_mintime ? &client->mintime : &client->maxtime;
+}
+
+/** Helper for storing client to a heap slot
+ *
+ * @param heap   client heap
+ * @param pos    slot index
+ * @param client client object
+ */
+static void client_heap_set(client_heap_t *heap, int pos, client_t *client)
+{
+    heap->vec[pos] = client;
+    client->heap_pos[heap->id] = pos;
+}
+
+/** Move heap entry towards the root until heap order is restored
+ *
+ * @param heap client heap
+ * @param pos  slot index
+ */
+static void client_heap_sift_up(client_heap_t *heap, int pos)
+{
+    client_t *client = heap->vec[pos];
+    const struct timeval *key = client_heap_key(heap, client);
+
+    while( pos > 0 ) {
+	int parent = (pos - 1) / 2;
+	if( !tv_lt(key, client_heap_key(heap, heap->vec[parent])) )
+	    break;
+	client_heap_set(heap, pos, heap->vec[parent]);
+	pos = parent;
+    }
+    client_heap_set(heap, pos, client);
+}
+
+/** Move heap entry towards the leaves until heap order is restored
  *
- * The status data includes
- * - number of clients
- * - number of clients with active wakeup request
- * - seconds to the next client to be woken up
+ * @param heap client heap
+ * @param pos  slot index
+ */
+static void client_heap_sift_down(client_heap_t *heap, int pos)
+{
+    client_t *client = heap->vec[pos];
+    const struct timeval *key = client_heap_key(heap, client);
+
+    for( ;; ) {
+	int child = pos * 2 + 1;
+	if( child >= heap->used )
+	    break;
+	if( child + 1 < heap->used &&
+	    tv_lt(client_heap_key(heap, heap->vec[child + 1]),
+		  client_heap_key(heap, heap->vec[child])) )
+	    child += 1;
+	if( !tv_lt(client_heap_key(heap, heap->vec[child]), key) )
+	    break;
+	client_heap_set(heap, pos, heap->vec[child]);
+	pos = child;
+    }
+    client_heap_set(heap, pos, client);
+}
+
+/** Add client to a heap
  *
- * @param self pointer to client object
+ * @param heap   client heap
+ * @param client client object, must not be in the heap already
  */
-static void client_handle_stat_req(client_t *self)
+static void client_heap_insert(client_heap_t *heap, client_t *client)
 {
-    struct iphb_stats stats   = { 0 };
-    int               next_hb = INT_MAX;
-    int               flags   = MSG_DONTWAIT | MSG_NOSIGNAL;
+    if( heap->used == heap->size ) {
+	int size = heap->size ? heap->size * 2 : 16;
+	client_t **vec = realloc(heap->vec, size * sizeof *vec);
+	if( !vec )
+	    abort();
+	heap->vec  = vec;
+	heap->size = size;
+    }
 
-    struct timeval    tv_now;
+    client_heap_set(heap, heap->used++, client);
+    client_heap_sift_up(heap, heap->used - 1);
+}
 
-    monotime_get_tv(&tv_now);
+/** Remove client from a heap
+ *
+ * @param heap   client heap
+ * @param client client object; no-op if not in the heap
+ */
+static void client_heap_remove(client_heap_t *heap, client_t *client)
+{
+    int pos = client->heap_pos[heap->id];
 
-    for( client_t *c = clients; c; c = c->next ) {
-        stats.clients++;
+    if( pos < 0 )
+	return;
 
-	if( !client_wait_started(c) )
-	    continue;
+    client->heap_pos[heap->id] = -1;
 
-	stats.waiting++;
+    if( --heap->used == pos )
+	return;
 
-	if( next_hb > c->maxtime.tv_sec )
-	    next_hb = c->maxtime.tv_sec;
-    }
+    /* Fill the hole with the last entry and restore heap order */
+    client_heap_set(heap, pos, heap->vec[heap->used]);
+    client_heap_sift_down(heap, pos);
+    client_heap_sift_up(heap, heap->vec[pos]->heap_pos[heap->id]);
+}
 
-    if( next_hb < INT_MAX )
-	stats.next_hb = next_hb - tv_now.tv_sec;
+/** Get client with the earliest time stamp in a heap
+ *
+ * @param heap client heap
+ *
+ * @return client object, or NULL if the heap is empty
+ */
+static client_t *client_heap_top(const client_heap_t *heap)
+{
+    return heap->used ? heap->vec[0] : 0;
+}
 
-    if( send(self->fd, &stats, sizeof stats, flags) != sizeof stats )
-    {
-        dsme_log(LOG_ERR, PFIX"failed to send to client %s (%m)",
-		 self->pidtxt);
-	// do not drop yet
-    }
+/** Release dynamic resources held by a heap
+ *
+ * @param heap client heap
+ */
+static void client_heap_quit(client_heap_t *heap)
+{
+    free(heap->vec), heap->vec = 0;
+    heap->used = heap->size = 0;
 }
 
 /* ------------------------------------------------------------------------- *
  * list of IPHB clients
  * ------------------------------------------------------------------------- */
 
+/** Hash function for internal client lookup table
+ *
+ * @param key client object
+ *
+ * @return hash value derived from endpoint and data
+ */
+static guint clientlist_internal_hash_cb(gconstpointer key)
+{
+    const client_t *client = key;
+
+    return endpoint_hash(client->conn) ^ g_direct_hash(client->data);
+}
+
+/** Equality function for internal client lookup table
+ *
+ * @param a client object
+ * @param b client object
+ *
+ * @return TRUE if clients have same endpoint and data, FALSE otherwise
+ */
+static gboolean clientlist_internal_equal_cb(gconstpointer a, gconstpointer b)
+{
+    const client_t *client1 = a;
+    const client_t *client2 = b;
+
+    return (client1->data == client2->data &&
+	    endpoint_same(client1->conn, client2->conn));
+}
+
 /** Find internal client based on endpoint and data to be sent
  *
  * @param conn endpoint to wake up when triggered
@@ -1879,14 +2999,12 @@ static void client_handle_stat_req(client_t *self)
  */
 static client_t *clientlist_find_internal_client(endpoint_t *conn, void* data)
 {
-    for( client_t *client = clients; client; client = client->next ) {
-        if( client_is_external(client) )
-	    continue;
+    client_t key = { .fd = -1, .conn = conn, .data = data };
 
-	if( client->data == data && endpoint_same(client->conn, conn) )
-	    return client;
-    }
-    return 0;
+    if( !internal_clients )
+	return 0;
+
+    return g_hash_table_lookup(internal_clients, &key);
 }
 
 /** Add client instance to list of clients
@@ -1895,17 +3013,22 @@ static client_t *clientlist_find_internal_client(endpoint_t *conn, void* data)
  */
 static void clientlist_add_client(client_t *newclient)
 {
-    client_t *client;
+    /* add to end */
+    newclient->next = 0;
+    newclient->prev = clients_tail;
 
-    if( (client = clients) != 0 ) {
-	/* add to end */
-	while (client->next)
-	    client = client->next;
-	client->next = newclient;
-    }
-    else {
-	/* first one */
+    if( clients_tail )
+	clients_tail->next = newclient;
+    else
 	clients = newclient;
+
+    clients_tail = newclient;
+    /* internal clients can be looked up by endpoint and data */
+    if( !client_is_external(newclient) ) {
+	if( !internal_clients )
+	    internal_clients = g_hash_table_new(clientlist_internal_hash_cb,
+						clientlist_internal_equal_cb);
+	g_hash_table_insert(internal_clients, newclient, newclient);
     }
 }
 
@@ -1915,13 +3038,26 @@ static void clientlist_add_client(client_t *newclient)
  */
 static void clientlist_remove_client(client_t *client)
 {
-    for( client_t **pos = &clients; *pos; pos = &(*pos)->next ) {
-	if( *pos == client ) {
-	    *pos = client->next;
-	    client->next = 0;
-	    break;
-	}
-    }
+    /* not in the list? */
+    if( !client->prev && clients != client )
+	return;
+
+    clientlist_unindex_client(client);
+
+    if( !client_is_external(client) && internal_clients )
+	g_hash_table_remove(internal_clients, client);
+
+    if( client->prev )
+	client->prev->next = client->next;
+    else
+	clients = client->next;
+
+    if( client->next )
+	client->next->prev = client->prev;
+    else
+	clients_tail = client->prev;
+
+    client->next = client->prev = 0;
 }
 
 /** Remove client instance from list of clients and then delete it
@@ -1937,19 +3073,161 @@ static void clientlist_delete_client(client_t *client)
     client_close_and_free(client);
 }
 
+/** Queue external client for wakeup
+ *
+ * @param client client instance
+ * @param waited seconds the client has been waiting
+ */
+static void clientlist_queue_wakeup(client_t *client, time_t waited)
+{
+    if( wakeup_batch_used == wakeup_batch_size ) {
+	int size = wakeup_batch_size ? wakeup_batch_size * 2 : 16;
+	void *vec = realloc(wakeup_batch, size * sizeof *wakeup_batch);
+	if( !vec )
+	    abort();
+	wakeup_batch = vec;
+	wakeup_batch_size = size;
+    }
+
+    wakeup_batch[wakeup_batch_used].client = client;
+    wakeup_batch[wakeup_batch_used].waited = waited;
+    wakeup_batch_used += 1;
+}
+
+/** Send data to external client socket without blocking
+ *
+ * @param fd   client socket
+ * @param data data to send
+ * @param size size of data
+ *
+ * @return true if all data was sent, false otherwise
+ */
+static bool client_send_system(int fd, const void *data, size_t size)
+{
+    return send(fd, data, size, MSG_DONTWAIT|MSG_NOSIGNAL) == (ssize_t)size;
+}
+
+/** Send wakeup responses to all queued external clients
+ *
+ * Clients that can't be sent to are removed and deleted.
+ */
+static void clientlist_flush_wakeups(void)
+{
+    int failed = 0;
+
+    if( !wakeup_batch_used )
+	return;
+
+    batch_stats_add(&wakeup_batch_stats, wakeup_batch_used);
+
+    for( int i = 0; i < wakeup_batch_used; ++i ) {
+	client_t *client = wakeup_batch[i].client;
+	struct _iphb_wait_resp_t resp = { 0 };
+
+	resp.waited = wakeup_batch[i].waited;
+
+	if( iphb_env->client_send(client->fd, &resp, sizeof resp) )
+	    continue;
+
+	dsme_log(LOG_ERR, PFIX"failed to send to client %s (%m),"
+		 " drop client", client->pidtxt);
+	clientlist_delete_client(client);
+	failed += 1;
+    }
+
+    dsme_log(LOG_DEBUG, PFIX"woke up %d external clients, %d failed",
+	     wakeup_batch_used, failed);
+
+    wakeup_batch_used = 0;
+}
+
 /** Delete all clients included in the list of clients
  */
 static void clientlist_delete_clients(void)
 {
     client_t *client;
 
-    while( (client = clients) != 0 ) {
-	/* detach head from list*/
-	clients = client->next;
-	client->next = 0;
+    while( (client = clients) != 0 )
+	clientlist_delete_client(client);
+
+    if( internal_clients )
+	g_hash_table_unref(internal_clients), internal_clients = 0;
+
+    free(wakeup_batch), wakeup_batch = 0;
+    wakeup_batch_used = wakeup_batch_size = 0;
+
+    for( int i = 0; i < CLIENT_HEAP_COUNT; ++i )
+	client_heap_quit(&client_heap[i]);
+}
+
+/** Test if client is included in the deadline heaps
+ *
+ * @param client client instance
+ *
+ * @return true if client is indexed, false otherwise
+ */
+static bool clientlist_client_is_indexed(const client_t *client)
+{
+    return (client->heap_pos[CLIENT_HEAP_PENDING]     >= 0 ||
+	    client->heap_pos[CLIENT_HEAP_RIPE_RESUME] >= 0 ||
+	    client->heap_pos[CLIENT_HEAP_RIPE_OTHER]  >= 0);
+}
+
+/** Remove client from the deadline heaps
+ *
+ * @param client client instance
+ */
+static void clientlist_unindex_client(client_t *client)
+{
+    if( !clientlist_client_is_indexed(client) )
+	return;
+
+    if( client_is_external(client) )
+	clients_waiting_external -= 1;
+
+    for( int i = 0; i < CLIENT_HEAP_COUNT; ++i )
+	client_heap_remove(&client_heap[i], client);
+}
+
+/** Place client in the deadline heaps according to its wait state
+ *
+ * @param client client instance
+ */
+static void clientlist_index_client(client_t *client)
+{
+    clientlist_unindex_client(client);
+
+    if( !client_wait_started(client) )
+	return;
+
+    if( client_is_external(client) )
+	clients_waiting_external += 1;
 
-	/* release dynamic resources */
-	client_close_and_free(client);
+    client_heap_insert(&client_heap[CLIENT_HEAP_PENDING], client);
+
+    if( client_needs_resume(client) )
+	client_heap_insert(&client_heap[CLIENT_HEAP_PENDING_RESUME], client);
+}
+
+/** Move clients whose mintime has passed from pending to ripe heaps
+ *
+ * @param now current monotonic time
+ */
+static void clientlist_ripen_clients(const struct timeval *now)
+{
+    client_t *client;
+
+    while( (client = client_heap_top(&client_heap[CLIENT_HEAP_PENDING])) ) {
+	if( tv_lt(now, &client->mintime) )
+	    break;
+
+	client_heap_remove(&client_heap[CLIENT_HEAP_PENDING], client);
+	client_heap_remove(&client_heap[CLIENT_HEAP_PENDING_RESUME], client);
+
+	if( client_needs_resume(client) )
+	    client_heap_insert(&client_heap[CLIENT_HEAP_RIPE_RESUME], client);
+	else
+	    client_heap_insert(&client_heap[CLIENT_HEAP_RIPE_OTHER], client);
     }
 }
 
@@ -1983,63 +3261,60 @@ static time_t clientlist_get_alarm_time(void)
     return res;
 }
 
-/** "infinity" value for struct timeval data */
-static const struct timeval tv_invalid = { INT_MAX, 0 };
-
-/** Reprogram the rtc wakeup alarm
+/** Reprogram the resume wakeup alarm
  *
  * Calculate the time when the next client needs to be woken up.
  *
  * Adjust down if there are alarms before that.
  *
- * Synchronize rtc clock with system time and enable/disable
- * the rtc wakeup alarm.
+ * Then enable/disable the rtc or timerfd wakeup alarm.
  */
 static void clientlist_rethink_rtc_wakeup(const struct timeval *now)
 {
     /* start with no wakeup */
     struct timeval wakeup = tv_invalid;
-    time_t         sleeptime = INT_MAX;
+    struct timeval sleeptime = tv_invalid;
     time_t         alarmtime = 0;
 
-    /* scan closest external client wakeup time */
-    for( client_t *client = clients; client; client = client->next ) {
-	if( !client_needs_resume(client) )
-	    continue;
+    /* closest wakeup time of clients that need resume */
+    const client_t *pending = client_heap_top(&client_heap[CLIENT_HEAP_PENDING_RESUME]);
+    const client_t *ripe    = client_heap_top(&client_heap[CLIENT_HEAP_RIPE_RESUME]);
 
-	if( !client_wait_started(client) )
-	    continue;
+    if( pending && tv_gt(&wakeup, &pending->maxtime) )
+	wakeup = pending->maxtime;
 
-	if( tv_gt(&client->maxtime, now) && tv_gt(&wakeup, &client->maxtime) )
-	    wakeup = client->maxtime;
-    }
+    if( ripe && tv_gt(&wakeup, &ripe->maxtime) )
+	wakeup = ripe->maxtime;
 
-    /* convert from monotonic time stamp to delay */
-    if( tv_gt(&wakeup, now) && tv_lt(&wakeup, &tv_invalid) )
-	sleeptime = wakeup.tv_sec - now->tv_sec;
+    /* convert from monotonic time stamp to delay; clients that are
+     * already overdue will be woken up shortly, but make sure the
+     * alarm does not get disabled while they are waiting for it */
+    if( tv_lt(&wakeup, &tv_invalid) ) {
+	timersub(&wakeup, now, &sleeptime);
+	if( sleeptime.tv_sec < 1 )
+	    sleeptime = (struct timeval) { 1, 0 };
+    }
 
     /* check time to next timed alarm, adjust delay if sooner */
     alarmtime = clientlist_get_alarm_time();
-    if( alarmtime > 0 && sleeptime > alarmtime )
-	sleeptime = alarmtime;
+    if( alarmtime > 0 && sleeptime.tv_sec >= alarmtime )
+	sleeptime = (struct timeval) { alarmtime, 0 };
 
     /* Even if there are not clients, we want rtc wakeup every
      * now and then to drive the battery monitoring during suspend */
 #if RTC_MAXIMUM_WAKEUP_TIME
-    if( sleeptime < 0 || sleeptime > RTC_MAXIMUM_WAKEUP_TIME ) {
+    if( sleeptime.tv_sec >= RTC_MAXIMUM_WAKEUP_TIME ) {
 	dsme_log(LOG_DEBUG, PFIX"truncating sleep: %ld -> %ld seconds",
-		 (long)sleeptime, (long)RTC_MAXIMUM_WAKEUP_TIME);
-	sleeptime = RTC_MAXIMUM_WAKEUP_TIME;
+		 (long)sleeptime.tv_sec, (long)RTC_MAXIMUM_WAKEUP_TIME);
+	sleeptime = (struct timeval) { RTC_MAXIMUM_WAKEUP_TIME, 0 };
     }
 #endif
 
-    /* program rtc wakeup alarm (or disable it) */
-    if( sleeptime < 0 || sleeptime >= INT_MAX )
-	sleeptime = 0;
-
-    rtc_set_alarm_after(sleeptime);
+    /* program wakeup alarm (or disable it) */
+    if( sleeptime.tv_sec >= INT_MAX )
+	timerclear(&sleeptime);
 
-    deltatime_update();
+    iphb_env->alarm_program(&sleeptime);
 }
 
 /** Timer callback function for waking up clients between heartbeats
@@ -2059,6 +3334,7 @@ static gboolean clientlist_handle_wakeup_timeout(gpointer userdata)
     wakeup_timer = 0;
 
     dsme_log(LOG_DEBUG, PFIX"wakeup via normal timer");
+    wakeup_source_set(WAKEUP_SOURCE_TIMER);
 
     struct timeval   tv_now;
     monotime_get_tv(&tv_now);
@@ -2081,7 +3357,7 @@ static void clientlist_start_wakeup_timeout(const struct timeval *sleep_time)
     int ms = sleep_time->tv_sec * 1000 + sleep_time->tv_usec / 1000;
 
     dsme_log(LOG_DEBUG, PFIX"setting a wakeup in %d ms", ms);
-    wakeup_timer = g_timeout_add(ms, clientlist_handle_wakeup_timeout, 0);
+    wakeup_timer = iphb_env->timer_add(ms, clientlist_handle_wakeup_timeout, 0);
 }
 
 /** Cancel timer for waking up clients before the next heartbeat
@@ -2089,7 +3365,7 @@ static void clientlist_start_wakeup_timeout(const struct timeval *sleep_time)
 static void clientlist_cancel_wakeup_timeout(void)
 {
     if( wakeup_timer )
-	g_source_remove(wakeup_timer), wakeup_timer = 0;
+	iphb_env->timer_remove(wakeup_timer), wakeup_timer = 0;
 }
 
 /** Helper for formatting time-to values for logging purposes
@@ -2149,101 +3425,112 @@ static void clientlist_wakeup_clients_now(const struct timeval *now)
 {
     struct timeval sleep_time = { INT_MAX, 0 };
 
-    int externals_left = 0;
-
-    struct timeval tv_to_max;
-    struct timeval tv_to_min;
+    struct timeval tv_limit;
     char stamp[64];
 
+    client_t *client;
+
     dsme_log(LOG_DEBUG, PFIX"check if clients need waking up");
     clientlist_wakeup_clients_cancel();
     clientlist_cancel_wakeup_timeout();
 
-    bool must_wake = false;
+    /* attribute wakeups to whatever triggered this pass */
+    wakeup_source_active  = wakeup_source_pending;
+    wakeup_source_pending = WAKEUP_SOURCE_REQUEST;
+    unsigned woken_before = wakeup_source_stats[wakeup_source_active].clients;
 
-    /* 1st pass: are there external clients that we *must* wake up */
-    for( client_t *client = clients; client; client = client->next ) {
-        if( !client_wait_started(client) )
-	    continue;
+    /* clients with maxtime before this can't wait for the next heartbeat */
+    tv_limit = *now;
+    tv_limit.tv_sec += DSME_HEARTBEAT_INTERVAL;
 
-	if( !client_needs_resume(client) )
-	    continue;
+    /* move clients whose mintime has passed to ripe heaps */
+    clientlist_ripen_clients(now);
 
-	if( tv_lt(now, &client->mintime) )
-	    continue;
+    dsme_log(LOG_DEBUG, PFIX"%d pending, %d ripe clients",
+	     client_heap[CLIENT_HEAP_PENDING].used,
+	     client_heap[CLIENT_HEAP_RIPE_RESUME].used +
+	     client_heap[CLIENT_HEAP_RIPE_OTHER].used);
 
-	timersub(&client->maxtime, now, &tv_to_max);
-	if( tv_to_max.tv_sec >= DSME_HEARTBEAT_INTERVAL )
-	    continue;
+    /* with interval stabbing, resume clients are woken up only when
+     * the earliest maxtime is reached; allow for rtc alarms having
+     * only one second resolution */
+    struct timeval tv_stab = *now;
+    bool stabbing = (wakeup_align_policy == WAKEUP_ALIGN_STABBING);
+
+    if( stabbing )
+	tv_stab.tv_sec += 1;
+    else
+	tv_stab = tv_limit;
+
+    /* are there clients that we *must* wake up */
+    bool must_wake = false;
 
+    client = client_heap_top(&client_heap[CLIENT_HEAP_RIPE_RESUME]);
+    if( client && tv_lt(&client->maxtime, &tv_stab) ) {
 	/* mintime passed and maxtime is less than heartbeat away */
 	dsme_log(LOG_DEBUG, PFIX"client %s must be woken up", client->pidtxt);
 	must_wake = true;
-	break;
     }
 
-    /* 2nd pass: actually wake up clients */
-    for( client_t *client = clients, *next; client; client = next ) {
-	/* get next before possible clientlist_delete_client() call */
-	next = client->next;
-
-        if( !client_wait_started(client) ) {
-            dsme_log(LOG_DEBUG, PFIX"client %s not scheduled", client->pidtxt);
-	    continue;
-        }
+    /* actually wake up clients: if we must wake up anyway, all ripe
+     * clients, otherwise only those that can't wait for the next
+     * heartbeat */
+    for( int id = CLIENT_HEAP_RIPE_RESUME; id <= CLIENT_HEAP_RIPE_OTHER; ++id ) {
+	while( (client = client_heap_top(&client_heap[id])) ) {
+	    if( !must_wake && !tv_lt(&client->maxtime, &tv_limit) )
+		break;
 
-	timersub(&client->maxtime, now, &tv_to_max);
+	    if( !must_wake && stabbing && id == CLIENT_HEAP_RIPE_RESUME )
+		break;
 
-	if( tv_lt(now, &client->mintime) ) {
-	    timersub(&client->mintime, now, &tv_to_min);
-	    dsme_log(LOG_DEBUG, PFIX"client %s min wakeup %s",
-		     client->pidtxt,
-		     time_minus(&tv_to_min, stamp, sizeof stamp));
+	    if( id == CLIENT_HEAP_RIPE_RESUME )
+		wakeup_stats_add_client(client, now);
 
-	    /* mintime not reached yet */
-	    if( tv_to_max.tv_sec >= DSME_HEARTBEAT_INTERVAL || !client_needs_resume(client) ) {
-		/* timer is not used for internal clients */
-	    }
-	    else {
-		/* we need timer if maxtime is before the next heartbeat */
-		if( tv_gt(&sleep_time, &tv_to_max) )
-		    sleep_time = tv_to_max;
-	    }
-	}
-	else if( !must_wake && tv_to_max.tv_sec >= DSME_HEARTBEAT_INTERVAL ) {
-	    /* maxtime is at least one heartbeat away */
-	    dsme_log(LOG_DEBUG, PFIX"client %s max wakeup %s",
-		     client->pidtxt,
-		     time_minus(&tv_to_max, stamp, sizeof stamp));
-	}
-	else {
-	    /* due now, wakeup */
-	    if( !client_wakeup(client, now) ) {
-		dsme_log(LOG_ERR, PFIX"failed to send to client %s (%m),"
-			 " drop client", client->pidtxt);
-		clientlist_delete_client(client), client = 0;
-	    }
-	    continue;
+	    client_wakeup(client, now);
 	}
+    }
+
+    /* send wakeups to external clients */
+    clientlist_flush_wakeups();
+
+    if( wakeup_source_stats[wakeup_source_active].clients != woken_before )
+	wakeup_source_stats[wakeup_source_active].passes += 1;
+    wakeup_source_active = WAKEUP_SOURCE_REQUEST;
 
-	/* count active, but untriggered external clients */
-	if( client_is_external(client) )
-	    externals_left += 1;
+    /* we need timer if maxtime of a client that has not reached
+     * mintime yet is before the next heartbeat */
+    client = client_heap_top(&client_heap[CLIENT_HEAP_PENDING_RESUME]);
+
+    /* with interval stabbing also ripe clients can be waiting for it */
+    if( stabbing ) {
+	client_t *ripe = client_heap_top(&client_heap[CLIENT_HEAP_RIPE_RESUME]);
+	if( ripe && (!client || tv_lt(&ripe->maxtime, &client->maxtime)) )
+	    client = ripe;
+    }
+
+    if( client && tv_lt(&client->maxtime, &tv_limit) ) {
+	timersub(&client->maxtime, now, &sleep_time);
+	dsme_log(LOG_DEBUG, PFIX"client %s max wakeup %s",
+		 client->pidtxt,
+		 time_minus(&sleep_time, stamp, sizeof stamp));
     }
 
+    /* count active, but untriggered external clients */
+    int externals_left = clients_waiting_external;
+
     if( sleep_time.tv_sec < INT_MAX ) {
 	clientlist_start_wakeup_timeout(&sleep_time);
     }
 
     /* open or close the kernel fd as needed */
-    if( !externals_left )
-        kernelfd_close();
-    else
-        kernelfd_open();
+    iphb_env->kernel_watch(externals_left > 0);
 
     /* reprogram the rtc wakeup */
     clientlist_rethink_rtc_wakeup(now);
 
+    /* evaluate wakeup statistics */
+    wakeup_stats_rethink(now);
+
     /* and tell hwwd kicker we are alive */
     hwwd_feeder_sync();
 }
@@ -2295,7 +3582,7 @@ static void clientlist_wakeup_clients_cancel(void)
 {
     if( clientlist_wakeup_clients_id ) {
 	dsme_log(LOG_DEBUG, PFIX"cancel delayed wakeup checking");
-	g_source_remove(clientlist_wakeup_clients_id),
+	iphb_env->timer_remove(clientlist_wakeup_clients_id),
 	    clientlist_wakeup_clients_id = 0;
 	wakelock_unlock(iphb_wakeup);
     }
@@ -2324,7 +3611,8 @@ static void clientlist_wakeup_clients_later(const struct timeval *now)
 	dsme_log(LOG_DEBUG, PFIX"schedule delayed wakeup checking");
 	wakelock_lock(iphb_wakeup, -1);
 	clientlist_wakeup_clients_id =
-	    g_timeout_add(200, clientlist_wakeup_clients_cb, 0);
+	    iphb_env->timer_add(CLIENTLIST_WAKEUP_DELAY_MS,
+				clientlist_wakeup_clients_cb, 0);
     }
 }
 /* ------------------------------------------------------------------------- *
@@ -2581,9 +3869,22 @@ cleanup:
  * @return true on success, or false on failure
  */
 static bool epollfd_add_fd(int fd, void* ptr)
+{
+    return epollfd_add_fd_ex(fd, ptr, EPOLLIN);
+}
+
+/** Add filedescriptor to the epoll set with explicit event mask
+ *
+ * @param fd      file descriptor to add
+ * @param ptr     data to associate with the file descriptor
+ * @param events  epoll events to wait for
+ *
+ * @return true on success, or false on failure
+ */
+static bool epollfd_add_fd_ex(int fd, void* ptr, uint32_t events)
 {
     struct epoll_event ev = { 0, { 0 } };
-    ev.events   = EPOLLIN;
+    ev.events   = events;
     ev.data.ptr = ptr;
 
     if( epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) == -1 ) {
@@ -2674,6 +3975,7 @@ static gboolean epollfd_iowatch_cb(GIOChannel*  source,
 				   gpointer     data)
 {
     bool               wakeup_mce = false;
+    gboolean           keep_going = TRUE;
 
     struct timeval     tv_now;
     struct epoll_event events[DSME_MAX_EPOLL_EVENTS];
@@ -2687,40 +3989,77 @@ static gboolean epollfd_iowatch_cb(GIOChannel*  source,
 	return FALSE;
     }
 
-    nfds = epoll_wait(epollfd, events, DSME_MAX_EPOLL_EVENTS, 0);
+    monotime_get_tv(&tv_now);
 
-    if( nfds == -1 ) {
-	if( errno == EINTR || errno == EAGAIN )
-	    return TRUE;
+    /* Drain the epoll set, but leave the rest for the next mainloop
+     * iteration if the event budget gets exhausted */
+    int handled = 0;
 
-        dsme_log(LOG_ERR, PFIX"epoll waiting failed (%m)");
-        dsme_log(LOG_CRIT, PFIX"epoll waiting disabled");
-	return FALSE;
-    }
+    while( handled < DSME_EPOLL_EVENT_BUDGET ) {
+	int todo = DSME_EPOLL_EVENT_BUDGET - handled;
 
-    monotime_get_tv(&tv_now);
+	if( todo > DSME_MAX_EPOLL_EVENTS )
+	    todo = DSME_MAX_EPOLL_EVENTS;
 
-    /* go through new events */
-    for( int i = 0; i < nfds; ++i ) {
-        if (events[i].data.ptr == &listenfd) {
-            /* accept new clients */
-	    listenfd_handle_connect();
-        }
-	else if (events[i].data.ptr == &kernelfd) {
-	    /* iphb event from kernel */
-	    kernelfd_handle_event();
-        }
-	else if (events[i].data.ptr == &rtc_fd) {
-	    /* rtc wakeup (and possibly resume from suspend) */
-	    if( !(wakeup_mce = rtc_handle_input()) )
-		rtc_detach();
-        }
-	else {
-            /* deal with old clients */
-            epollfd_handle_client_req(&events[i], &tv_now);
-        }
+	nfds = epoll_wait(epollfd, events, todo, 0);
+
+	if( nfds == -1 ) {
+	    if( errno == EINTR )
+		continue;
+
+	    if( errno == EAGAIN )
+		break;
+
+	    dsme_log(LOG_ERR, PFIX"epoll waiting failed (%m)");
+	    dsme_log(LOG_CRIT, PFIX"epoll waiting disabled");
+	    keep_going = FALSE;
+	    break;
+	}
+
+	/* go through new events */
+	for( int i = 0; i < nfds; ++i ) {
+	    if (events[i].data.ptr == &listenfd) {
+		/* accept new clients */
+		listenfd_handle_connect();
+	    }
+	    else if (events[i].data.ptr == &kernelfd) {
+		/* iphb event from kernel */
+		kernelfd_handle_event();
+	    }
+	    else if (events[i].data.ptr == &rtc_fd) {
+		/* rtc wakeup (and possibly resume from suspend) */
+		if( rtc_handle_input() )
+		    wakeup_mce = true;
+		else
+		    rtc_detach();
+	    }
+	    else if (events[i].data.ptr == &alarmfd) {
+		/* timerfd alarm (and possibly resume from suspend) */
+		if( alarmfd_handle_input() )
+		    wakeup_mce = true;
+	    }
+	    else if (events[i].data.ptr == &boottimerfd) {
+		/* timers that keep running during suspend */
+		boottimer_handle_input();
+	    }
+	    else {
+		/* deal with old clients */
+		epollfd_handle_client_req(&events[i], &tv_now);
+	    }
+	}
+
+	handled += nfds;
+
+	if( nfds < todo )
+	    break;
     }
 
+    if( handled > 0 )
+	batch_stats_add(&epoll_batch_stats, handled);
+
+    if( !handled && !keep_going )
+	return FALSE;
+
     clientlist_wakeup_clients_later(&tv_now);
 
     if( wakeup_mce ) {
@@ -2736,7 +4075,7 @@ static gboolean epollfd_iowatch_cb(GIOChannel*  source,
     if( rtc_fd == -1 )
 	rtc_attach();
 
-    return TRUE;
+    return keep_going;
 }
 
 /** Stop the epoll io watch */
@@ -2850,6 +4189,7 @@ DSME_HANDLER(DSM_MSGTYPE_HEARTBEAT, conn, msg)
 
     dsme_log(LOG_DEBUG, PFIX"HEARTBEAT from HWWD");
     monotime_get_tv(&tv_now);
+    wakeup_source_set(WAKEUP_SOURCE_HEARTBEAT);
     clientlist_wakeup_clients_now(&tv_now);
 }
 
@@ -2883,11 +4223,48 @@ DSME_HANDLER(DSM_MSGTYPE_WAIT, conn, msg)
 
 }
 
+/** Handle iphb statistics query from dsmetool etc */
+DSME_HANDLER(DSM_MSGTYPE_IPHB_STATS_QUERY, conn, msg)
+{
+    DSM_MSGTYPE_IPHB_STATS rsp = DSME_MSG_INIT(DSM_MSGTYPE_IPHB_STATS);
+    char *report = iphb_stats_report();
+
+    if( report )
+	endpoint_send_with_extra(conn, &rsp, strlen(report) + 1, report);
+
+    free(report);
+}
+
+/** Handle iphb_get_stats D-Bus method call
+ *
+ * @param req   D-Bus method call message
+ * @param rsp   Where to store D-Bus method return message
+ */
+static void iphb_get_stats_cb(const DsmeDbusMessage *req,
+			      DsmeDbusMessage **rsp)
+{
+    char *report = iphb_stats_report();
+
+    *rsp = dsme_dbus_reply_new(req);
+    dsme_dbus_message_append_string(*rsp, report ?: "");
+
+    free(report);
+}
+
+/** D-Bus method calls handled by this module */
+static const dsme_dbus_binding_t dbus_methods[] =
+{
+    { iphb_get_stats_cb, DSME_IPHB_GET_STATS },
+    { 0, 0 }
+};
+
 /** Handle connected to system bus */
 DSME_HANDLER(DSM_MSGTYPE_DBUS_CONNECT, client, msg)
 {
     dsme_log(LOG_INFO, PFIX"DBUS_CONNECT");
     dsme_dbus_bind_signals(&bound, signals);
+    dsme_dbus_bind_methods(&dbus_methods_bound, dbus_methods,
+			   dsme_service, dsme_req_interface);
     systembus_connect();
 }
 
@@ -2896,6 +4273,8 @@ DSME_HANDLER(DSM_MSGTYPE_DBUS_DISCONNECT, client, msg)
 {
     dsme_log(LOG_INFO, PFIX"DBUS_DISCONNECT");
     dsme_dbus_unbind_signals(&bound, signals);
+    dsme_dbus_unbind_methods(&dbus_methods_bound, dbus_methods,
+			     dsme_service, dsme_req_interface);
     systembus_disconnect();
 }
 
@@ -2903,6 +4282,7 @@ module_fn_info_t message_handlers[] =
 {
     DSME_HANDLER_BINDING(DSM_MSGTYPE_HEARTBEAT),
     DSME_HANDLER_BINDING(DSM_MSGTYPE_WAIT),
+    DSME_HANDLER_BINDING(DSM_MSGTYPE_IPHB_STATS_QUERY),
 
     DSME_HANDLER_BINDING(DSM_MSGTYPE_DBUS_CONNECT),
     DSME_HANDLER_BINDING(DSM_MSGTYPE_DBUS_DISCONNECT),
@@ -3068,6 +4448,9 @@ void module_init(module_t *handle)
 
     dsme_log(LOG_INFO, PFIX"iphb.so loaded");
 
+    /* select wakeup alignment policy */
+    wakeup_align_init();
+
     /* restore alarm queue state */
     xtimed_status_load();
 
@@ -3089,6 +4472,11 @@ void module_init(module_t *handle)
     /* if available, open android alarm device */
     android_alarm_init();
 
+    /* prefer timerfd over rtc for resume alarms; disable the
+     * rtc alarm that might have been left behind */
+    if( alarmfd_init() )
+	rtc_set_alarm_after(0);
+
     success = true;
 
 cleanup:
@@ -3110,6 +4498,8 @@ void module_fini(void)
 
     /* detach dbus handlers */
     dsme_dbus_unbind_signals(&bound, signals);
+    dsme_dbus_unbind_methods(&dbus_methods_bound, dbus_methods,
+			     dsme_service, dsme_req_interface);
 
     /* store alarm queue state to a file*/
     xtimed_status_save();
@@ -3147,6 +4537,7 @@ void module_fini(void)
     android_alarm_quit();
 
     /* cleanup rest of what is in the epoll set */
+    alarmfd_quit();
     listenfd_quit();
     kernelfd_close();
     clientlist_delete_clients();
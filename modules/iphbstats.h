@@ -0,0 +1,44 @@
+/**
+   @file iphbstats.h
+
+   Querying IP heartbeat wakeup statistics from DSME.
+   <p>
+   Copyright (C) 2015 Jolla Ltd.
+
+   This file is part of Dsme.
+
+   Dsme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Dsme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Dsme.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DSME_IPHBSTATS_H
+#define DSME_IPHBSTATS_H
+
+#include <dsme/messages.h>
+
+/** D-Bus method on the dsme request interface returning the report */
+#define DSME_IPHB_GET_STATS "iphb_get_stats"
+
+enum {
+    DSME_MSG_ENUM(DSM_MSGTYPE_IPHB_STATS_QUERY, 0x00002100),
+    DSME_MSG_ENUM(DSM_MSGTYPE_IPHB_STATS,       0x00002101),
+};
+
+/** Request for iphb statistics report */
+typedef dsmemsg_generic_t DSM_MSGTYPE_IPHB_STATS_QUERY;
+
+/** Reply to DSM_MSGTYPE_IPHB_STATS_QUERY
+
+   The report is carried as zero terminated text in extra data.
+*/
+typedef dsmemsg_generic_t DSM_MSGTYPE_IPHB_STATS;
+
+#endif
@@ -38,8 +38,7 @@
 
 #define _XOPEN_SOURCE
 
-#include <iphbd/iphb_internal.h>
-
+#include "heartbeat.h"
 #include "../include/dsme/modules.h"
 #include "../include/dsme/logging.h"
 #include "../include/dsme/timers.h"
@@ -70,6 +69,7 @@
 
 static void ping_all(void);
 static void subscribe_to_wakeup(void);
+static void unsubscribe_from_wakeup(void);
 
 
 typedef struct {
@@ -153,12 +153,10 @@ static int abort_timeout_func(void* data)
   return 0; /* stop the interval */
 }
 
-DSME_HANDLER(DSM_MSGTYPE_WAKEUP, conn, msg)
+DSME_HANDLER(DSM_MSGTYPE_HOUSEKEEPING, conn, msg)
 {
     dsme_log(LOG_DEBUG, "processwd: ping");
     ping_all();
-
-    subscribe_to_wakeup();
 }
 
 static void ping_all(void)
@@ -208,11 +206,20 @@ static void ping_all(void)
 
 static void subscribe_to_wakeup(void)
 {
-    DSM_MSGTYPE_WAIT msg = DSME_MSG_INIT(DSM_MSGTYPE_WAIT);
-    msg.req.mintime = 24;
-    msg.req.maxtime = 30;
-    msg.req.pid     = 0;
-    msg.data        = 0;
+    /* ping every 24...30 seconds */
+    DSM_MSGTYPE_HOUSEKEEPING_ADD msg = DSME_MSG_INIT(DSM_MSGTYPE_HOUSEKEEPING_ADD);
+    msg.task      = 0;
+    msg.period    = 30;
+    msg.tolerance = 6;
+
+    broadcast_internally(&msg);
+}
+
+static void unsubscribe_from_wakeup(void)
+{
+    DSM_MSGTYPE_HOUSEKEEPING_REMOVE msg =
+      DSME_MSG_INIT(DSM_MSGTYPE_HOUSEKEEPING_REMOVE);
+    msg.task = 0;
 
     broadcast_internally(&msg);
 }
@@ -331,7 +338,7 @@ module_fn_info_t message_handlers[] = {
       DSME_HANDLER_BINDING(DSM_MSGTYPE_PROCESSWD_CREATE),
       DSME_HANDLER_BINDING(DSM_MSGTYPE_PROCESSWD_DELETE),
       DSME_HANDLER_BINDING(DSM_MSGTYPE_PROCESSWD_PONG),
-      DSME_HANDLER_BINDING(DSM_MSGTYPE_WAKEUP),
+      DSME_HANDLER_BINDING(DSM_MSGTYPE_HOUSEKEEPING),
       DSME_HANDLER_BINDING(DSM_MSGTYPE_CLOSE),
       {0}
 };
@@ -351,7 +358,7 @@ void module_fini(void)
     processes = g_slist_delete_link(processes, processes);
   }
 
-  // TODO: cancel wakeup subscription
+  unsubscribe_from_wakeup();
 
   dsme_log(LOG_DEBUG, "processwd.so unloaded");
 }
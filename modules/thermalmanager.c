@@ -41,13 +41,20 @@
  *
  * An example command line to obtain named sensor temperature over D-Bus:
  * $ dbus-send --system --print-reply --dest=com.nokia.thermalmanager /com/nokia/thermalmanager com.nokia.thermalmanager.sensor_temperature string:core
+ *
+ * An example command line to obtain battery temperature statistics for the last hour over D-Bus:
+ * $ dbus-send --system --print-reply --dest=com.nokia.thermalmanager /com/nokia/thermalmanager com.nokia.thermalmanager.sensor_statistics string:battery int32:3600
+ *
+ * An example command line to obtain battery temperature history over D-Bus:
+ * $ dbus-send --system --print-reply --dest=com.nokia.thermalmanager /com/nokia/thermalmanager com.nokia.thermalmanager.sensor_history string:battery int32:0
  */
 
 /* ========================================================================= *
  *
  * Thermal manager:
  * - maintains a set of registered thermal objects
- * - polls status of each thermal object periodically
+ * - polls status of each thermal object periodically, objects
+ *   with overlapping poll windows are updated on the same wakeup
  * - evaluates overall device thermal status
  * - broadcasts thermal status changes within dsme and over D-Bus
  * - handles thermal sensor related D-Bus queries
@@ -157,6 +164,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 /* ========================================================================= *
  * FORWARD_DECLARATIONS
@@ -176,6 +184,75 @@
 const char *thermal_status_name (THERMAL_STATUS status);
 const char *thermal_status_repr (THERMAL_STATUS status);
 
+/* ------------------------------------------------------------------------- *
+ * THERMAL_POLL_GROUP
+ * ------------------------------------------------------------------------- */
+
+/** Minimum length of shared wakeup window [s]
+ *
+ * A thermal object can join a poll group only if the intersection
+ * of the group and object wakeup windows is at least this long.
+ * Shorter windows would leave iphb no room for aligning wakeups
+ * with other activity.
+ */
+#define THERMAL_POLL_GROUP_MIN_WINDOW 1
+
+/** Set of thermal objects that are updated on the same iphb wakeup
+ *
+ * Poll groups are used as iphb cookies. To keep the number of iphb
+ * internal clients bounded, groups are not released when they become
+ * empty, but are reused for later polls.
+ */
+typedef struct
+{
+    /** Thermal objects waiting for poll; NULL when group is idle */
+    GSList *tpg_objects;
+
+    /** Global wakeup slot length [s], or zero for ranged wakeup */
+    int     tpg_slot;
+
+    /** Start of ranged wakeup window [CLOCK_BOOTTIME s] */
+    time_t  tpg_lo;
+
+    /** End of ranged wakeup window [CLOCK_BOOTTIME s] */
+    time_t  tpg_hi;
+
+    /** Flag for: wake up from suspend to do the poll */
+    bool    tpg_resume;
+} thermal_poll_group_t;
+
+static time_t thermal_poll_group_now           (void);
+static void   thermal_poll_group_send_wait     (thermal_poll_group_t *self, time_t now);
+static void   thermal_poll_group_cancel_wait   (thermal_poll_group_t *self);
+static void   thermal_poll_group_add_object    (thermal_object_t *thermal_object, int mintime, int maxtime, bool resume);
+static void   thermal_poll_group_remove_object (thermal_object_t *thermal_object);
+static void   thermal_poll_group_handle_wakeup (thermal_poll_group_t *self);
+static void   thermal_poll_group_delete_all    (void);
+
+/* ------------------------------------------------------------------------- *
+ * THERMAL_NAME_INDEX
+ * ------------------------------------------------------------------------- */
+
+static bool       thermal_name_index_is_key_end     (const char *name, size_t len);
+static void       thermal_name_index_insert         (GHashTable **index, const char *key, thermal_object_t *thermal_object);
+static void       thermal_name_index_erase          (GHashTable *index, const char *key, thermal_object_t *thermal_object);
+static GPtrArray *thermal_name_index_lookup         (const char *sensor_name);
+static GPtrArray *thermal_name_index_lookup_depends (const char *sensor_name);
+static void       thermal_name_index_add_object     (thermal_object_t *thermal_object);
+static void       thermal_name_index_remove_object  (thermal_object_t *thermal_object);
+static void       thermal_name_index_clear          (void);
+
+/* ------------------------------------------------------------------------- *
+ * THERMAL_DEPENDENCY_GRAPH
+ * ------------------------------------------------------------------------- */
+
+static void       thermal_dependency_graph_visit        (thermal_object_t *thermal_object, GHashTable *state, GPtrArray *order);
+static GPtrArray *thermal_dependency_graph_get_plan     (thermal_object_t *thermal_object);
+static bool       thermal_dependency_graph_is_fanned_out(const thermal_object_t *thermal_object);
+static void       thermal_dependency_graph_forget       (const thermal_object_t *thermal_object);
+static void       thermal_dependency_graph_invalidate   (void);
+static void       thermal_dependency_graph_clear        (void);
+
 /* ------------------------------------------------------------------------- *
  * THERMAL_MANAGER
  * ------------------------------------------------------------------------- */
@@ -208,6 +285,10 @@ static void thermal_manager_get_core_temperature_cb    (const DsmeDbusMessage *r
 static void thermal_manager_get_battery_temperature_cb (const DsmeDbusMessage *req, DsmeDbusMessage **rsp);
 static void thermal_manager_get_sensor_temperature_cb  (const DsmeDbusMessage *req, DsmeDbusMessage **rsp);
 
+static thermal_object_t *thermal_manager_find_sensor_object(const char *sensor_name);
+static void thermal_manager_get_sensor_statistics_cb   (const DsmeDbusMessage *req, DsmeDbusMessage **rsp);
+static void thermal_manager_get_sensor_history_cb      (const DsmeDbusMessage *req, DsmeDbusMessage **rsp);
+
 /* ------------------------------------------------------------------------- *
  * MODULE_GLUE
  * ------------------------------------------------------------------------- */
@@ -231,6 +312,35 @@ static THERMAL_STATUS current_status = THERMAL_STATUS_NORMAL;
 /** Flag for: D-Bus method handlers have been registered */
 static bool dbus_methods_bound = false;
 
+/** Lookup table: sensor name / group prefix -> GPtrArray of thermal objects */
+static GHashTable *thermal_name_index = 0;
+
+/** Lookup table: depends_on sensor name -> GPtrArray of meta thermal objects */
+static GHashTable *thermal_depends_index = 0;
+
+/** Lookup table: thermal object -> GPtrArray of objects depending on it
+ *  directly or indirectly, in topological order */
+static GHashTable *thermal_dependency_plans = 0;
+
+/** Set of meta objects that have been re-evaluated due to dependency
+ *  fan-out, but have not finished their update yet */
+static GHashTable *thermal_dependency_fanout = 0;
+
+/** List of allocated poll groups, both active and idle */
+static GSList *thermal_poll_groups = 0;
+
+/** Number of thermal object polls scheduled */
+static unsigned thermal_poll_group_polls   = 0;
+
+/** Number of polls that were merged into already pending group wakeup */
+static unsigned thermal_poll_group_merged  = 0;
+
+/** Number of poll group wakeups handled */
+static unsigned thermal_poll_group_wakeups = 0;
+
+/** Number of thermal object updates initiated from poll group wakeups */
+static unsigned thermal_poll_group_updates = 0;
+
 /* ========================================================================= *
  * THERMAL_STATUS
  * ========================================================================= */
@@ -302,6 +412,575 @@ thermal_status_repr(THERMAL_STATUS status)
     return repr;
 }
 
+/* ========================================================================= *
+ * THERMAL_POLL_GROUP
+ * ========================================================================= */
+
+/** Get current time in the clock domain used by iphb
+ *
+ * @return seconds since boot, including time spent in suspend
+ */
+static time_t
+thermal_poll_group_now(void)
+{
+    struct timespec ts = { 0, 0 };
+
+#if defined(CLOCK_BOOTTIME)
+    if( clock_gettime(CLOCK_BOOTTIME, &ts) == -1 )
+#endif
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec;
+}
+
+/** Send iphb wait request matching poll group wakeup window
+ *
+ * @param self  poll group
+ * @param now   current time from thermal_poll_group_now()
+ */
+static void
+thermal_poll_group_send_wait(thermal_poll_group_t *self, time_t now)
+{
+    DSM_MSGTYPE_WAIT msg = DSME_MSG_INIT(DSM_MSGTYPE_WAIT);
+
+    msg.req.pid    = 0;
+    msg.req.wakeup = self->tpg_resume;
+    msg.data       = self;
+
+    if( self->tpg_slot ) {
+        msg.req.mintime = self->tpg_slot;
+        msg.req.maxtime = self->tpg_slot;
+    }
+    else {
+        msg.req.mintime = (self->tpg_lo > now) ? (self->tpg_lo - now) : 0;
+        msg.req.maxtime = self->tpg_hi - now;
+    }
+
+    /* Wakeup will be sent to "originating module". Since
+     * this function can end up being called from events
+     * dispatched at other modules, we need to maintain
+     * the context manually ... */
+    const module_t *from_module = current_module();
+    enter_module(this_module);
+    broadcast_internally(&msg);
+    enter_module(from_module);
+}
+
+/** Cancel pending iphb wait request for poll group
+ *
+ * @param self  poll group
+ */
+static void
+thermal_poll_group_cancel_wait(thermal_poll_group_t *self)
+{
+    DSM_MSGTYPE_WAIT msg = DSME_MSG_INIT(DSM_MSGTYPE_WAIT);
+
+    /* Zero mintime and maxtime cancels the wait */
+    msg.req.pid = 0;
+    msg.data    = self;
+
+    const module_t *from_module = current_module();
+    enter_module(this_module);
+    broadcast_internally(&msg);
+    enter_module(from_module);
+}
+
+/** Add thermal object to a poll group
+ *
+ * If there is already a pending group wakeup that the object can
+ * share, the object is added to that group and the group wakeup
+ * window is narrowed down to intersection of the group and object
+ * windows. Otherwise an idle / new group is used.
+ *
+ * Requests using global wakeup slots (mintime == maxtime) can be
+ * grouped only with other requests using the same slot length.
+ *
+ * @param thermal_object  registered thermal object
+ * @param mintime         minimum delay until update [s]
+ * @param maxtime         maximum delay until update [s]
+ * @param resume          true if device should be woken up from suspend
+ */
+static void
+thermal_poll_group_add_object(thermal_object_t *thermal_object,
+                              int mintime, int maxtime, bool resume)
+{
+    thermal_poll_group_t *group = 0;
+    thermal_poll_group_t *idle  = 0;
+    bool                  send  = true;
+
+    /* Each object can be waiting in one group only */
+    thermal_poll_group_remove_object(thermal_object);
+
+    time_t now = thermal_poll_group_now();
+    time_t lo  = now + mintime;
+    time_t hi  = now + maxtime;
+
+    for( GSList *item = thermal_poll_groups; item; item = item->next ) {
+        thermal_poll_group_t *iter = item->data;
+
+        if( !iter->tpg_objects ) {
+            if( !idle )
+                idle = iter;
+            continue;
+        }
+
+        if( mintime == maxtime ) {
+            if( iter->tpg_slot != mintime )
+                continue;
+
+            group = iter;
+            send  = resume && !group->tpg_resume;
+            break;
+        }
+
+        if( iter->tpg_slot )
+            continue;
+
+        time_t isect_lo = (iter->tpg_lo > lo) ? iter->tpg_lo : lo;
+        time_t isect_hi = (iter->tpg_hi < hi) ? iter->tpg_hi : hi;
+        time_t start    = (isect_lo > now) ? isect_lo : now;
+
+        if( isect_hi - start < THERMAL_POLL_GROUP_MIN_WINDOW )
+            continue;
+
+        group = iter;
+        send  = ((resume && !group->tpg_resume) ||
+                 group->tpg_lo != isect_lo ||
+                 group->tpg_hi != isect_hi);
+
+        group->tpg_lo = isect_lo;
+        group->tpg_hi = isect_hi;
+        break;
+    }
+
+    if( group ) {
+        thermal_poll_group_merged += 1;
+        group->tpg_resume = group->tpg_resume || resume;
+    }
+    else {
+        if( !(group = idle) ) {
+            group = g_malloc0(sizeof *group);
+            thermal_poll_groups = g_slist_prepend(thermal_poll_groups, group);
+        }
+
+        group->tpg_slot   = (mintime == maxtime) ? mintime : 0;
+        group->tpg_lo     = lo;
+        group->tpg_hi     = hi;
+        group->tpg_resume = resume;
+    }
+
+    group->tpg_objects = g_slist_prepend(group->tpg_objects, thermal_object);
+    thermal_poll_group_polls += 1;
+
+    if( send )
+        thermal_poll_group_send_wait(group, now);
+}
+
+/** Remove thermal object from poll group it is waiting in
+ *
+ * If the group becomes empty, the pending wakeup is canceled.
+ *
+ * @param thermal_object  thermal object
+ */
+static void
+thermal_poll_group_remove_object(thermal_object_t *thermal_object)
+{
+    for( GSList *item = thermal_poll_groups; item; item = item->next ) {
+        thermal_poll_group_t *group = item->data;
+
+        if( !g_slist_find(group->tpg_objects, thermal_object) )
+            continue;
+
+        group->tpg_objects = g_slist_remove(group->tpg_objects,
+                                            thermal_object);
+
+        if( !group->tpg_objects )
+            thermal_poll_group_cancel_wait(group);
+        break;
+    }
+}
+
+/** Update all thermal objects in a poll group
+ *
+ * @param self  poll group, as received in iphb wakeup message
+ */
+static void
+thermal_poll_group_handle_wakeup(thermal_poll_group_t *self)
+{
+    /* Ignore stale / unknown cookies */
+    if( !g_slist_find(thermal_poll_groups, self) )
+        goto EXIT;
+
+    /* Detach the objects: the group becomes idle and
+     * can be reused when the objects schedule new polls */
+    GSList *objects = self->tpg_objects;
+    self->tpg_objects = 0;
+
+    if( !objects )
+        goto EXIT;
+
+    thermal_poll_group_wakeups += 1;
+    thermal_poll_group_updates += g_slist_length(objects);
+
+    dsme_log(LOG_DEBUG, PFIX"poll group wakeup: %u sensors; "
+             "%u wakeups for %u updates, %u wakeups saved",
+             g_slist_length(objects),
+             thermal_poll_group_wakeups, thermal_poll_group_updates,
+             thermal_poll_group_updates - thermal_poll_group_wakeups);
+
+    for( GSList *item = objects; item; item = item->next )
+        thermal_manager_request_object_update(item->data);
+
+    g_slist_free(objects);
+
+EXIT:
+    return;
+}
+
+/** Release all poll groups
+ */
+static void
+thermal_poll_group_delete_all(void)
+{
+    dsme_log(LOG_INFO, PFIX"poll groups: %u polls, %u merged; "
+             "%u wakeups for %u updates, %u wakeups saved",
+             thermal_poll_group_polls, thermal_poll_group_merged,
+             thermal_poll_group_wakeups, thermal_poll_group_updates,
+             thermal_poll_group_updates - thermal_poll_group_wakeups);
+
+    for( GSList *item = thermal_poll_groups; item; item = item->next ) {
+        thermal_poll_group_t *group = item->data;
+        g_slist_free(group->tpg_objects);
+        g_free(group);
+    }
+
+    g_slist_free(thermal_poll_groups),
+        thermal_poll_groups = 0;
+}
+
+/* ========================================================================= *
+ * THERMAL_NAME_INDEX
+ * ========================================================================= */
+
+/** Check if sensor name prefix can be used as sensor group name
+ *
+ * Mirrors the matching done in thermal_object_has_name_like(): "core"
+ * matches "core", "core0", "core:foo", etc.
+ *
+ * @param name  sensor name
+ * @param len   prefix length
+ *
+ * @return true if name[0...len) is valid lookup key, false otherwise
+ */
+static bool
+thermal_name_index_is_key_end(const char *name, size_t len)
+{
+    int ch = (unsigned char)name[len];
+    return (ch == 0) || (ch == ':') || ('0' <= ch && ch <= '9');
+}
+
+/** Add thermal object to an index
+ *
+ * @param index           pointer to lookup table, created on demand
+ * @param key             lookup key
+ * @param thermal_object  thermal object
+ */
+static void
+thermal_name_index_insert(GHashTable **index, const char *key,
+                          thermal_object_t *thermal_object)
+{
+    if( !*index )
+        *index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify)g_ptr_array_unref);
+
+    GPtrArray *objects = g_hash_table_lookup(*index, key);
+
+    if( !objects ) {
+        objects = g_ptr_array_new();
+        g_hash_table_insert(*index, g_strdup(key), objects);
+    }
+
+    g_ptr_array_add(objects, thermal_object);
+}
+
+/** Remove thermal object from an index
+ *
+ * @param index           lookup table, or NULL
+ * @param key             lookup key
+ * @param thermal_object  thermal object
+ */
+static void
+thermal_name_index_erase(GHashTable *index, const char *key,
+                         thermal_object_t *thermal_object)
+{
+    GPtrArray *objects = index ? g_hash_table_lookup(index, key) : 0;
+
+    if( !objects )
+        goto EXIT;
+
+    g_ptr_array_remove(objects, thermal_object);
+
+    if( objects->len == 0 )
+        g_hash_table_remove(index, key);
+
+EXIT:
+    return;
+}
+
+/** Get thermal objects matching sensor name / group prefix
+ *
+ * @param sensor_name  sensor name / sensor group name prefix
+ *
+ * @return array of thermal objects in registration order,
+ *         or NULL if there are none
+ */
+static GPtrArray *
+thermal_name_index_lookup(const char *sensor_name)
+{
+    GPtrArray *objects = 0;
+
+    if( thermal_name_index && sensor_name )
+        objects = g_hash_table_lookup(thermal_name_index, sensor_name);
+
+    return objects;
+}
+
+/** Get meta thermal objects that depend on given sensor name / group
+ *
+ * @param sensor_name  depends_on value used by meta thermal objects
+ *
+ * @return array of thermal objects in registration order,
+ *         or NULL if there are none
+ */
+static GPtrArray *
+thermal_name_index_lookup_depends(const char *sensor_name)
+{
+    GPtrArray *objects = 0;
+
+    if( thermal_depends_index && sensor_name )
+        objects = g_hash_table_lookup(thermal_depends_index, sensor_name);
+
+    return objects;
+}
+
+/** Add thermal object to lookup tables
+ *
+ * The object is added to the name index using all the names it
+ * can be looked up with - "core:cpu1" can be found via "core:cpu1",
+ * "core:cpu" and "core". Meta objects are added also to the
+ * dependency index.
+ *
+ * @param thermal_object  thermal object
+ */
+static void
+thermal_name_index_add_object(thermal_object_t *thermal_object)
+{
+    const char *name = thermal_object_get_name(thermal_object);
+
+    for( size_t len = strlen(name) + 1; len-- > 0; ) {
+        if( !thermal_name_index_is_key_end(name, len) )
+            continue;
+
+        char *key = g_strndup(name, len);
+        thermal_name_index_insert(&thermal_name_index, key, thermal_object);
+        g_free(key);
+    }
+
+    const char *depends_on = thermal_object_get_depends_on(thermal_object);
+
+    if( depends_on )
+        thermal_name_index_insert(&thermal_depends_index, depends_on,
+                                  thermal_object);
+}
+
+/** Remove thermal object from lookup tables
+ *
+ * @param thermal_object  thermal object
+ */
+static void
+thermal_name_index_remove_object(thermal_object_t *thermal_object)
+{
+    const char *name = thermal_object_get_name(thermal_object);
+
+    for( size_t len = strlen(name) + 1; len-- > 0; ) {
+        if( !thermal_name_index_is_key_end(name, len) )
+            continue;
+
+        char *key = g_strndup(name, len);
+        thermal_name_index_erase(thermal_name_index, key, thermal_object);
+        g_free(key);
+    }
+
+    const char *depends_on = thermal_object_get_depends_on(thermal_object);
+
+    if( depends_on )
+        thermal_name_index_erase(thermal_depends_index, depends_on,
+                                 thermal_object);
+}
+
+/** Release lookup tables
+ */
+static void
+thermal_name_index_clear(void)
+{
+    if( thermal_name_index )
+        g_hash_table_unref(thermal_name_index), thermal_name_index = 0;
+
+    if( thermal_depends_index )
+        g_hash_table_unref(thermal_depends_index), thermal_depends_index = 0;
+}
+
+/* ========================================================================= *
+ * THERMAL_DEPENDENCY_GRAPH
+ * ========================================================================= */
+
+/** Depth first traversal of objects depending on a thermal object
+ *
+ * Objects are added to order array after all objects depending on
+ * them have been added, i.e. reversing the array gives topological
+ * order in which the objects need to be re-evaluated.
+ *
+ * @param thermal_object  thermal object
+ * @param state           lookup table: object -> visiting(1) / visited(2)
+ * @param order           array for storing objects in post-order
+ */
+static void
+thermal_dependency_graph_visit(thermal_object_t *thermal_object,
+                               GHashTable *state, GPtrArray *order)
+{
+    const char *name = thermal_object_get_name(thermal_object);
+
+    g_hash_table_insert(state, thermal_object, GINT_TO_POINTER(1));
+
+    for( size_t len = strlen(name) + 1; len-- > 0; ) {
+        if( !thermal_name_index_is_key_end(name, len) )
+            continue;
+
+        char      *key     = g_strndup(name, len);
+        GPtrArray *objects = thermal_name_index_lookup_depends(key);
+
+        for( guint i = 0; objects && i < objects->len; ++i ) {
+            thermal_object_t *object = g_ptr_array_index(objects, i);
+
+            /* Self-dependency must not be allowed */
+            if( object == thermal_object )
+                continue;
+
+            switch( GPOINTER_TO_INT(g_hash_table_lookup(state, object)) ) {
+            case 0:
+                thermal_dependency_graph_visit(object, state, order);
+                break;
+
+            case 1:
+                /* Sensor backends are expected to reject these when
+                 * loading config - skip to avoid infinite recursion */
+                dsme_log(LOG_WARNING, PFIX"%s: cyclic dependency via %s",
+                         thermal_object_get_name(object), key);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        g_free(key);
+    }
+
+    g_hash_table_insert(state, thermal_object, GINT_TO_POINTER(2));
+    g_ptr_array_add(order, thermal_object);
+}
+
+/** Get objects to re-evaluate after thermal object has been updated
+ *
+ * The result is cached until the set of registered thermal
+ * objects changes.
+ *
+ * @param thermal_object  thermal object
+ *
+ * @return array of depending thermal objects in topological order
+ */
+static GPtrArray *
+thermal_dependency_graph_get_plan(thermal_object_t *thermal_object)
+{
+    if( !thermal_dependency_plans )
+        thermal_dependency_plans =
+            g_hash_table_new_full(g_direct_hash, g_direct_equal, 0,
+                                  (GDestroyNotify)g_ptr_array_unref);
+
+    GPtrArray *plan = g_hash_table_lookup(thermal_dependency_plans,
+                                          thermal_object);
+    if( plan )
+        goto EXIT;
+
+    GHashTable *state = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GPtrArray  *order = g_ptr_array_new();
+
+    thermal_dependency_graph_visit(thermal_object, state, order);
+
+    /* Reverse post-order, minus the object itself that comes last */
+    plan = g_ptr_array_new();
+    for( guint i = order->len - 1; i-- > 0; )
+        g_ptr_array_add(plan, g_ptr_array_index(order, i));
+
+    g_ptr_array_unref(order);
+    g_hash_table_unref(state);
+
+    g_hash_table_insert(thermal_dependency_plans, thermal_object, plan);
+
+EXIT:
+    return plan;
+}
+
+/** Check if thermal object has been re-evaluated due to fan-out
+ *
+ * @param thermal_object  thermal object
+ *
+ * @return true if update is in progress, false otherwise
+ */
+static bool
+thermal_dependency_graph_is_fanned_out(const thermal_object_t *thermal_object)
+{
+    return (thermal_dependency_fanout &&
+            g_hash_table_lookup(thermal_dependency_fanout, thermal_object));
+}
+
+/** Clear fan-out tracking for thermal object
+ *
+ * @param thermal_object  thermal object
+ */
+static void
+thermal_dependency_graph_forget(const thermal_object_t *thermal_object)
+{
+    if( thermal_dependency_fanout )
+        g_hash_table_remove(thermal_dependency_fanout, thermal_object);
+}
+
+/** Drop cached re-evaluation plans
+ *
+ * Needs to be called whenever thermal objects are registered
+ * or unregistered.
+ */
+static void
+thermal_dependency_graph_invalidate(void)
+{
+    if( thermal_dependency_plans )
+        g_hash_table_remove_all(thermal_dependency_plans);
+}
+
+/** Release dependency tracking data
+ */
+static void
+thermal_dependency_graph_clear(void)
+{
+    if( thermal_dependency_plans )
+        g_hash_table_unref(thermal_dependency_plans),
+            thermal_dependency_plans = 0;
+
+    if( thermal_dependency_fanout )
+        g_hash_table_unref(thermal_dependency_fanout),
+            thermal_dependency_fanout = 0;
+}
+
 /* ========================================================================= *
  * THERMAL_MANAGER
  * ========================================================================= */
@@ -347,6 +1026,10 @@ EXIT:
  * shorter polling delays are used while the status is in
  * transitional state.
  *
+ * Thermal objects with overlapping poll windows are collected to
+ * poll groups, so that all of them get updated on the same iphb
+ * wakeup instead of each one causing a separate wakeup.
+ *
  * Control returns to thermal manager when iphb wakeup message
  * handler calls thermal_manager_request_object_update() function.
  *
@@ -362,10 +1045,7 @@ thermal_manager_schedule_object_poll(thermal_object_t *thermal_object)
 
     /* Schedule the next measurement point
      */
-    DSM_MSGTYPE_WAIT msg = DSME_MSG_INIT(DSM_MSGTYPE_WAIT);
-
-    msg.req.pid = 0;
-    msg.data    = thermal_object;
+    bool resume = false;
 
     /* Start with fall back defaults */
     int mintime = THERMAL_STATUS_POLL_DELAY_DEFAULT_MINIMUM;
@@ -378,7 +1058,7 @@ thermal_manager_schedule_object_poll(thermal_object_t *thermal_object)
         maxtime = THERMAL_STATUS_POLL_DELAY_TRANSITION_MAXIMUM;
 
         /* and wake up from suspend to do the measurement */
-        msg.req.wakeup  = true;
+        resume = true;
     }
     else if( !thermal_object_get_poll_delay(thermal_object,
                                             &mintime, &maxtime) ) {
@@ -412,20 +1092,11 @@ thermal_manager_schedule_object_poll(thermal_object_t *thermal_object)
                  thermal_object_get_name(thermal_object), mintime, maxtime);
     }
 
-    msg.req.mintime = mintime;
-    msg.req.maxtime = maxtime;
-
-    /* Wakeup will be sent to "originating module". Since
-     * this function can end up being called from events
-     * dispatched at other modules, we need to maintain
-     * the context manually ... */
-    const module_t *from_module = current_module();
-    enter_module(this_module);
-    broadcast_internally(&msg);
-    enter_module(from_module);
+    thermal_poll_group_add_object(thermal_object, mintime, maxtime, resume);
 
     /* ... wait for DSM_MSGTYPE_WAKEUP ...
-     * -> thermal_manager_request_object_update()
+     * -> thermal_poll_group_handle_wakeup()
+     *    -> thermal_manager_request_object_update()
      */
 
 EXIT:
@@ -465,6 +1136,10 @@ thermal_manager_register_object(thermal_object_t *thermal_object)
     // add the thermal object to the list of know thermal objects
     thermal_objects = g_slist_append(thermal_objects, thermal_object);
 
+    // and to the name lookup tables
+    thermal_name_index_add_object(thermal_object);
+    thermal_dependency_graph_invalidate();
+
     thermal_manager_request_object_update(thermal_object);
 
 EXIT:
@@ -485,9 +1160,9 @@ EXIT:
  * to report changes later on, the calls are ignored
  * because the objects are no longer registered.
  *
- * Similarly iphb wakeups relating to unregistered objects
- * are ignored. And once thermal manager plugin is unloaded
- * they will not be even dispatched anymore.
+ * The object is removed from the poll group it is waiting in.
+ * Once thermal manager plugin is unloaded iphb wakeups will
+ * not be even dispatched anymore.
  *
  * @param thermal_object  registered thermal object
  */
@@ -503,6 +1178,14 @@ thermal_manager_unregister_object(thermal_object_t *thermal_object)
     // remove the thermal object from the list of know thermal objects
     thermal_objects = g_slist_remove(thermal_objects, thermal_object);
 
+    // and from the name lookup tables
+    thermal_name_index_remove_object(thermal_object);
+    thermal_dependency_graph_invalidate();
+    thermal_dependency_graph_forget(thermal_object);
+
+    // and from pending poll group wakeups
+    thermal_poll_group_remove_object(thermal_object);
+
     dsme_log(LOG_DEBUG, PFIX"%s: unregistered",
              thermal_object_get_name(thermal_object));
 
@@ -580,11 +1263,10 @@ thermal_manager_get_sensor_status(const char *sensor_name,
     int            temp_lo   = IGNORE_TEMP_ABOVE;
     int            temp_hi   = IGNORE_TEMP_BELOW;
 
-    for( GSList *item = thermal_objects; item; item = item->next ) {
-        thermal_object_t *object = item->data;
+    GPtrArray *objects = thermal_name_index_lookup(sensor_name);
 
-        if( !thermal_object_has_name_like(object, sensor_name) )
-            continue;
+    for( guint i = 0; objects && i < objects->len; ++i ) {
+        thermal_object_t *object = g_ptr_array_index(objects, i);
 
         THERMAL_STATUS s = THERMAL_STATUS_INVALID;
         int            t = INVALID_TEMPERATURE;
@@ -860,13 +1542,10 @@ bool
 thermal_manager_request_sensor_update(const char *sensor_name)
 {
     bool ack = false;
-    for( GSList *item = thermal_objects; item; item = item->next ) {
-        thermal_object_t *object = item->data;
-        if( !thermal_object_has_name_like(object, sensor_name) )
-            continue;
-        thermal_object_request_update(object);
+    GPtrArray *objects = thermal_name_index_lookup(sensor_name);
+    if( objects && objects->len > 0 ) {
+        thermal_object_request_update(g_ptr_array_index(objects, 0));
         ack = true;
-        break;
     }
     return ack;
 }
@@ -889,15 +1568,18 @@ thermal_manager_have_pending_sensor_update(const char *sensor_name)
 {
     bool pending = false;
 
-    for( GSList *item = thermal_objects; item; item = item->next ) {
-        thermal_object_t *object = item->data;
+    /* Must be matching the name */
+    GPtrArray *objects = thermal_name_index_lookup(sensor_name);
 
-        /* Must be waiting for status */
+    for( guint i = 0; objects && i < objects->len; ++i ) {
+        thermal_object_t *object = g_ptr_array_index(objects, i);
+
+        /* And waiting for status */
         if( !thermal_object_update_is_pending(object) )
             continue;
 
-        /* And matching the name */
-        if( !thermal_object_has_name_like(object, sensor_name) )
+        /* Values re-evaluated during fan-out are already up to date */
+        if( thermal_dependency_graph_is_fanned_out(object) )
             continue;
 
         /* But self-dependencies must not be allowed */
@@ -917,44 +1599,55 @@ thermal_manager_have_pending_sensor_update(const char *sensor_name)
  * of the sensor that was updated, this function will
  * re-evaluate the depending sensors.
  *
+ * All meta sensors depending on the changed sensor - either
+ * directly or via other meta sensors - are re-evaluated in
+ * topological order, so that one sensor read is enough to
+ * update the whole dependency chain.
+ *
  * @param changed_object  thermal object that just got updated
  */
 void
 thermal_manager_handle_sensor_update(const thermal_object_t *changed_object)
 {
-    const char *sensor_name = thermal_object_get_name(changed_object);
-
-    for( GSList *item = thermal_objects; item; item = item->next ) {
-        thermal_object_t *object = item->data;
+    /* If the object itself was updated as a part of fan-out,
+     * objects depending on it have already been dealt with */
+    if( thermal_dependency_graph_is_fanned_out(changed_object) ) {
+        thermal_dependency_graph_forget(changed_object);
+        goto EXIT;
+    }
 
-        /* Must be waiting for status */
-        if( !thermal_object_update_is_pending(object) )
-            continue;
+    /* Look up via registered object to get non-const pointer */
+    GSList *link = g_slist_find(thermal_objects, changed_object);
+    if( !link )
+        goto EXIT;
 
-        /* and depending on the changed sensor */
-        const char *depends_on = thermal_object_get_depends_on(object);
-        if( !depends_on )
-            continue;
+    GPtrArray *plan = thermal_dependency_graph_get_plan(link->data);
 
-        if( !thermal_object_has_name_like(changed_object, depends_on) )
-            continue;
-
-        /* but self-dependency must not be allowed */
-        if( thermal_object_has_name(object, sensor_name) )
-            continue;
+    for( guint i = 0; i < plan->len; ++i ) {
+        thermal_object_t *object = g_ptr_array_index(plan, i);
 
         /* in case it is a group dependency, check all matching sensors */
+        const char *depends_on = thermal_object_get_depends_on(object);
         if( thermal_manager_have_pending_sensor_update(depends_on) )
             continue;
 
+        if( !thermal_dependency_fanout )
+            thermal_dependency_fanout =
+                g_hash_table_new(g_direct_hash, g_direct_equal);
+
+        g_hash_table_insert(thermal_dependency_fanout, object, object);
+
         /* Initiate sensor re-evaluation at backend. When finished,
          * a call to thermal_object_handle_update() is made.
          */
-        if( !thermal_object_read_sensor(object) )
-            thermal_object_cancel_update(object);
+        if( !thermal_object_evaluate_update(object) )
+            thermal_dependency_graph_forget(object);
 
         // -> thermal_object_handle_update(object);
     }
+
+EXIT:
+    return;
 }
 
 /* ========================================================================= *
@@ -1058,6 +1751,93 @@ thermal_manager_get_sensor_temperature_cb(const DsmeDbusMessage *req,
     thermal_manager_handle_temperature_query(req, sensor, rsp);
 }
 
+/** Find thermal object for sensor history queries
+ *
+ * Exact name match is preferred, otherwise the first sensor
+ * in the matching sensor group is used.
+ *
+ * @param sensor_name  sensor name / sensor group name prefix
+ *
+ * @return thermal object, or NULL if not found
+ */
+static thermal_object_t *
+thermal_manager_find_sensor_object(const char *sensor_name)
+{
+    thermal_object_t *found = 0;
+
+    GPtrArray *objects = thermal_name_index_lookup(sensor_name);
+
+    for( guint i = 0; objects && i < objects->len; ++i ) {
+        thermal_object_t *object = g_ptr_array_index(objects, i);
+
+        if( thermal_object_has_name(object, sensor_name) ) {
+            found = object;
+            break;
+        }
+
+        if( !found )
+            found = object;
+    }
+
+    return found;
+}
+
+/* Handle com.nokia.thermalmanager.sensor_statistics D-Bus method call
+ *
+ * Statistics are evaluated from temperature readings the thermal
+ * manager has already done, no additional sensor reads are made.
+ *
+ * @param req   D-Bus method call message
+ * @param rsp   Where to store D-Bus method return message
+ */
+static void
+thermal_manager_get_sensor_statistics_cb(const DsmeDbusMessage *req,
+                                         DsmeDbusMessage **rsp)
+{
+    const char *sensor = dsme_dbus_message_get_string(req);
+    int         window = dsme_dbus_message_get_int(req);
+
+    thermal_statistics_t stats;
+
+    thermal_object_get_statistics(thermal_manager_find_sensor_object(sensor),
+                                  window, &stats);
+
+    *rsp = dsme_dbus_reply_new(req);
+    dsme_dbus_message_append_int(*rsp, stats.ts_count);
+    dsme_dbus_message_append_int(*rsp, stats.ts_min);
+    dsme_dbus_message_append_int(*rsp, stats.ts_max);
+    dsme_dbus_message_append_int(*rsp, stats.ts_mean_mC);
+    dsme_dbus_message_append_int(*rsp, stats.ts_slope_mC_min);
+}
+
+/* Handle com.nokia.thermalmanager.sensor_history D-Bus method call
+ *
+ * @param req   D-Bus method call message
+ * @param rsp   Where to store D-Bus method return message
+ */
+static void
+thermal_manager_get_sensor_history_cb(const DsmeDbusMessage *req,
+                                      DsmeDbusMessage **rsp)
+{
+    const char *sensor = dsme_dbus_message_get_string(req);
+    int         window = dsme_dbus_message_get_int(req);
+
+    char   *data = 0;
+    size_t  size = 0;
+    FILE   *file = open_memstream(&data, &size);
+
+    if( file ) {
+        thermal_object_write_history(thermal_manager_find_sensor_object(sensor),
+                                     window, file);
+        fclose(file);
+    }
+
+    *rsp = dsme_dbus_reply_new(req);
+    dsme_dbus_message_append_string(*rsp, data ?: "");
+
+    free(data);
+}
+
 /** Array of D-Bus method calls supported by this plugin */
 static const dsme_dbus_binding_t dbus_methods_lut[] =
 {
@@ -1066,6 +1846,8 @@ static const dsme_dbus_binding_t dbus_methods_lut[] =
     { thermal_manager_get_core_temperature_cb,    thermalmanager_core_temperature  },
     { thermal_manager_get_battery_temperature_cb, thermalmanager_battery_temperature },
     { thermal_manager_get_sensor_temperature_cb,  thermalmanager_sensor_temperature },
+    { thermal_manager_get_sensor_statistics_cb,   THERMALMANAGER_SENSOR_STATISTICS },
+    { thermal_manager_get_sensor_history_cb,      THERMALMANAGER_SENSOR_HISTORY },
 
     { 0, 0 }
 };
@@ -1078,15 +1860,7 @@ static const dsme_dbus_binding_t dbus_methods_lut[] =
  */
 DSME_HANDLER(DSM_MSGTYPE_WAKEUP, client, msg)
 {
-    thermal_object_t *thermal_object = msg->data;
-
-    if( !thermal_manager_object_is_registered(thermal_object) )
-        goto EXIT;
-
-    thermal_manager_request_object_update(thermal_object);
-
-EXIT:
-    return;
+    thermal_poll_group_handle_wakeup(msg->data);
 }
 
 /** Handler for connected to D-Bus system bus event
@@ -1151,6 +1925,13 @@ module_fini(void)
         while( thermal_objects );
     }
 
+    /* Release poll groups */
+    thermal_poll_group_delete_all();
+
+    /* Release name lookup tables */
+    thermal_name_index_clear();
+    thermal_dependency_graph_clear();
+
     /* Remove dbus method call handlers */
     dsme_dbus_unbind_methods(&dbus_methods_bound, dbus_methods_lut,
                              thermalmanager_service, thermalmanager_interface);
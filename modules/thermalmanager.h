@@ -28,6 +28,7 @@
 #define THERMALMANAGER_H_
 
 #include <stdbool.h>
+#include <stdio.h>
 
 /* ------------------------------------------------------------------------- *
  * TEMPERATURE
@@ -92,6 +93,39 @@ const char *thermal_status_repr(THERMAL_STATUS status);
 #define THERMAL_STATUS_TRANSITION_DELAY \
      (THERMAL_STATUS_POLL_DELAY_TRANSITION_MAXIMUM * 5 / 2)
 
+/** Number of recent temperature readings used for trend estimation */
+#define THERMAL_TREND_SAMPLES 4
+
+/** Number of temperature readings kept in thermal object history */
+#define THERMAL_HISTORY_SAMPLES 64
+
+/** Number of accepted status changes kept in thermal object history */
+#define THERMAL_HISTORY_TRANSITIONS 16
+
+/** Distance from thermal status limits considered safe [C]
+ *
+ * Poll delay can be stretched only when temperature is stable and
+ * at least this far from both limits of the current thermal status.
+ */
+#define THERMAL_TREND_SAFE_MARGIN 3
+
+/** D-Bus method for getting sensor temperature statistics
+ *
+ * Arguments: string sensor name, int32 time window [s] (0 = all)
+ *
+ * Returns: int32 reading count, minimum [C], maximum [C],
+ *          mean [mC] and rate of change [mC/min]
+ */
+#define THERMALMANAGER_SENSOR_STATISTICS "sensor_statistics"
+
+/** D-Bus method for getting sensor temperature history
+ *
+ * Arguments: string sensor name, int32 time window [s] (0 = all)
+ *
+ * Returns: string with readings and status changes, one per line
+ */
+#define THERMALMANAGER_SENSOR_HISTORY    "sensor_history"
+
 /* ------------------------------------------------------------------------- *
  * THERMAL_SENSOR_VTAB
  * ------------------------------------------------------------------------- */
@@ -99,6 +133,25 @@ const char *thermal_status_repr(THERMAL_STATUS status);
 typedef struct thermal_sensor_vtab_t thermal_sensor_vtab_t;
 typedef struct thermal_object_t      thermal_object_t;
 
+/** Temperature statistics evaluated from thermal object history */
+typedef struct
+{
+    /** Number of readings used */
+    int ts_count;
+
+    /** Lowest temperature [C] */
+    int ts_min;
+
+    /** Highest temperature [C] */
+    int ts_max;
+
+    /** Mean temperature [mC] */
+    int ts_mean_mC;
+
+    /** Rate of change [mC/min] */
+    int ts_slope_mC_min;
+} thermal_statistics_t;
+
 /** Hook functions thermal sensor needs to provide for thermal object */
 struct thermal_sensor_vtab_t
 {
@@ -120,6 +173,15 @@ struct thermal_sensor_vtab_t
     /** Hook required by thermal_object_read_sensor() */
     bool        (*tsv_read_sensor_cb)(thermal_object_t *);
 
+    /** [Optional] Hook used by thermal_object_get_poll_delay() for
+     *  getting temperature range [lo, hi) of the current status */
+    bool        (*tsv_get_limits_cb)(const thermal_object_t *, int *, int *);
+
+    /** [Optional] Hook used by thermal_object_handle_update() for
+     *  checking if the sensor filters readings, in which case status
+     *  changes are accepted without transition delay */
+    bool        (*tsv_is_filtered_cb)(const thermal_object_t *);
+
 };
 
 /* ------------------------------------------------------------------------- *
@@ -150,7 +212,11 @@ bool              thermal_object_get_sensor_status(thermal_object_t *self, THERM
 bool              thermal_object_read_sensor(thermal_object_t *self);
 
 void              thermal_object_handle_update(thermal_object_t *self);
+bool              thermal_object_get_statistics(const thermal_object_t *self, int window, thermal_statistics_t *stats);
+void              thermal_object_write_history(const thermal_object_t *self, int window, FILE *file);
 void              thermal_object_request_update(thermal_object_t *self);
+bool              thermal_object_evaluate_update(thermal_object_t *self);
+bool              thermal_object_is_reevaluating(const thermal_object_t *self);
 const char       *thermal_object_get_depends_on(const thermal_object_t *self);
 
 /* ------------------------------------------------------------------------- *
@@ -72,6 +72,35 @@ static time_t to_util_monotime(void);
  * THERMAL_OBJECT
  * ------------------------------------------------------------------------- */
 
+/** Time stamped temperature reading */
+typedef struct
+{
+    /** Time of reading [CLOCK_BOOTTIME s] */
+    time_t                       ts_time;
+
+    /** Temperature [C] */
+    int                          ts_temperature;
+
+    /** Thermal status reported by the sensor */
+    THERMAL_STATUS               ts_status;
+} thermal_sample_t;
+
+/** Time stamped accepted thermal status change */
+typedef struct
+{
+    /** Time of change [CLOCK_BOOTTIME s] */
+    time_t                       tt_time;
+
+    /** Temperature that caused the change [C] */
+    int                          tt_temperature;
+
+    /** Previous accepted status */
+    THERMAL_STATUS               tt_from;
+
+    /** New accepted status */
+    THERMAL_STATUS               tt_to;
+} thermal_transition_t;
+
 /** Thermal object state data */
 struct thermal_object_t
 {
@@ -90,11 +119,34 @@ struct thermal_object_t
     /** Temperature request has been issued to sensor */
     bool                         to_request_pending;
 
+    /** Sensor is being read for re-evaluation after the sensors
+     *  it depends on got updated, not on its own request */
+    bool                         to_reevaluating;
+
     /** Sensor backend functions */
     const thermal_sensor_vtab_t *to_sensor_vtab;
 
     /** Sensor backend data */
     void                        *to_sensor_data;
+
+    /** Recent temperature readings, used for estimating trend
+     *  and for statistics queries */
+    thermal_sample_t             to_history[THERMAL_HISTORY_SAMPLES];
+
+    /** Number of valid entries in to_history */
+    int                          to_history_count;
+
+    /** Index of to_history slot to use for the next reading */
+    int                          to_history_next;
+
+    /** Recent accepted thermal status changes */
+    thermal_transition_t         to_transitions[THERMAL_HISTORY_TRANSITIONS];
+
+    /** Number of valid entries in to_transitions */
+    int                          to_transition_count;
+
+    /** Index of to_transitions slot to use for the next change */
+    int                          to_transition_next;
 };
 
 thermal_object_t *thermal_object_create                (const thermal_sensor_vtab_t *vtab, void *data);
@@ -111,6 +163,16 @@ int               thermal_object_get_temperature       (const thermal_object_t *
 bool              thermal_object_get_poll_delay        (thermal_object_t *self, int *mintime, int *maxtime);
 bool              thermal_object_status_in_transition  (const thermal_object_t *self);
 
+static void       thermal_object_add_sample            (thermal_object_t *self, time_t now, int temperature, THERMAL_STATUS status);
+static const thermal_sample_t *thermal_object_get_sample(const thermal_object_t *self, int age);
+static void       thermal_object_add_transition        (thermal_object_t *self, time_t now, THERMAL_STATUS from, THERMAL_STATUS to);
+bool              thermal_object_get_statistics        (const thermal_object_t *self, int window, thermal_statistics_t *stats);
+void              thermal_object_write_history         (const thermal_object_t *self, int window, FILE *file);
+static bool       thermal_object_get_trend             (const thermal_object_t *self, double *slope, int *spread);
+static bool       thermal_object_get_limits            (const thermal_object_t *self, int *lo, int *hi);
+static void       thermal_object_adjust_poll_delay     (thermal_object_t *self, int *mintime, int *maxtime);
+static bool       thermal_object_is_filtered           (const thermal_object_t *self);
+
 #if DSME_THERMAL_LOGGING
 static void       thermal_object_log_status            (const thermal_object_t *self);
 #endif
@@ -121,6 +183,8 @@ void             *thermal_object_get_sensor_data       (const thermal_object_t *
 bool              thermal_object_get_sensor_status     (thermal_object_t *self, THERMAL_STATUS *status, int *temperature);
 
 void              thermal_object_request_update        (thermal_object_t *self);
+bool              thermal_object_evaluate_update       (thermal_object_t *self);
+bool              thermal_object_is_reevaluating       (const thermal_object_t *self);
 bool              thermal_object_update_is_pending     (const thermal_object_t *self);
 void              thermal_object_handle_update         (thermal_object_t *self);
 void              thermal_object_cancel_update         (thermal_object_t *self);
@@ -167,6 +231,7 @@ thermal_object_create(const thermal_sensor_vtab_t *vtab, void *data)
 
     self->to_status_change_started = 0;
     self->to_request_pending = false;
+    self->to_reevaluating = false;
 
     self->to_sensor_vtab = vtab;
     self->to_sensor_data = data;
@@ -313,6 +378,10 @@ thermal_object_get_temperature(const thermal_object_t *self)
  * The polling delay is defined by the sensor backend and depend
  * on the sensor backend status.
  *
+ * If the sensor backend can tell the temperature limits of the
+ * current status, the delay is further adjusted based on the recent
+ * temperature trend, see thermal_object_adjust_poll_delay().
+ *
  * @param self  thermal object pointer
  *
  * @return true if mintime/maxtime was filled in, false otherwise
@@ -328,6 +397,374 @@ thermal_object_get_poll_delay(thermal_object_t *self,
 
     ack = self->to_sensor_vtab->tsv_get_poll_delay_cb(self, mintime, maxtime);
 
+    if( ack )
+        thermal_object_adjust_poll_delay(self, mintime, maxtime);
+
+EXIT:
+    return ack;
+}
+
+/** Add temperature reading to thermal object history
+ *
+ * @param self         thermal object pointer
+ * @param now          time of reading
+ * @param temperature  temperature [C]
+ * @param status       thermal status reported by the sensor
+ */
+static void
+thermal_object_add_sample(thermal_object_t *self, time_t now,
+                          int temperature, THERMAL_STATUS status)
+{
+    thermal_sample_t *sample = &self->to_history[self->to_history_next];
+
+    sample->ts_time        = now;
+    sample->ts_temperature = temperature;
+    sample->ts_status      = status;
+
+    self->to_history_next = (self->to_history_next + 1) % THERMAL_HISTORY_SAMPLES;
+
+    if( self->to_history_count < THERMAL_HISTORY_SAMPLES )
+        self->to_history_count += 1;
+}
+
+/** Get temperature reading from thermal object history
+ *
+ * @param self  thermal object pointer
+ * @param age   0 for the newest reading, 1 for the one before it, etc
+ *
+ * @return sample pointer, or NULL if there is no such reading
+ */
+static const thermal_sample_t *
+thermal_object_get_sample(const thermal_object_t *self, int age)
+{
+    if( age < 0 || age >= self->to_history_count )
+        return 0;
+
+    int slot = (self->to_history_next + THERMAL_HISTORY_SAMPLES - 1 - age)
+        % THERMAL_HISTORY_SAMPLES;
+
+    return &self->to_history[slot];
+}
+
+/** Add accepted thermal status change to thermal object history
+ *
+ * @param self  thermal object pointer
+ * @param now   time of change
+ * @param from  previous status
+ * @param to    new status
+ */
+static void
+thermal_object_add_transition(thermal_object_t *self, time_t now,
+                              THERMAL_STATUS from, THERMAL_STATUS to)
+{
+    thermal_transition_t *tr = &self->to_transitions[self->to_transition_next];
+
+    tr->tt_time        = now;
+    tr->tt_temperature = self->to_temperature;
+    tr->tt_from        = from;
+    tr->tt_to          = to;
+
+    self->to_transition_next = ((self->to_transition_next + 1)
+                                % THERMAL_HISTORY_TRANSITIONS);
+
+    if( self->to_transition_count < THERMAL_HISTORY_TRANSITIONS )
+        self->to_transition_count += 1;
+}
+
+/** Estimate temperature trend from thermal object history
+ *
+ * The rate of change is evaluated from the oldest and the
+ * newest of the last THERMAL_TREND_SAMPLES readings.
+ *
+ * @param self    thermal object pointer
+ * @param slope   where to store rate of change [C/s]
+ * @param spread  where to store difference between highest and
+ *                lowest of the readings [C]
+ *
+ * @return true if trend could be estimated, false otherwise
+ */
+static bool
+thermal_object_get_trend(const thermal_object_t *self,
+                         double *slope, int *spread)
+{
+    bool ack = false;
+
+    int count = self->to_history_count;
+    if( count > THERMAL_TREND_SAMPLES )
+        count = THERMAL_TREND_SAMPLES;
+
+    if( count < 2 )
+        goto EXIT;
+
+    const thermal_sample_t *t1 = thermal_object_get_sample(self, count - 1);
+    const thermal_sample_t *t2 = thermal_object_get_sample(self, 0);
+
+    if( t2->ts_time <= t1->ts_time )
+        goto EXIT;
+
+    int lo = t2->ts_temperature;
+    int hi = t2->ts_temperature;
+
+    for( int i = 1; i < count; ++i ) {
+        int t = thermal_object_get_sample(self, i)->ts_temperature;
+        if( lo > t ) lo = t;
+        if( hi < t ) hi = t;
+    }
+
+    *slope  = (double)(t2->ts_temperature - t1->ts_temperature)
+        / (double)(t2->ts_time - t1->ts_time);
+    *spread = hi - lo;
+
+    ack = true;
+
+EXIT:
+    return ack;
+}
+
+/** Evaluate temperature statistics from thermal object history
+ *
+ * The slope is least squares fit over the readings in the window.
+ *
+ * @param self    thermal object pointer
+ * @param window  how far back to look [s], or zero for whole history
+ * @param stats   where to store the statistics
+ *
+ * @return true if there were readings within the window, false otherwise
+ */
+bool
+thermal_object_get_statistics(const thermal_object_t *self, int window,
+                              thermal_statistics_t *stats)
+{
+    bool ack = false;
+
+    memset(stats, 0, sizeof *stats);
+
+    if( !self || self->to_history_count < 1 )
+        goto EXIT;
+
+    time_t now  = to_util_monotime();
+    time_t base = thermal_object_get_sample(self, 0)->ts_time;
+
+    double sum_t = 0, sum_v = 0, sum_tt = 0, sum_tv = 0;
+
+    for( int i = 0; i < self->to_history_count; ++i ) {
+        const thermal_sample_t *sample = thermal_object_get_sample(self, i);
+
+        if( window > 0 && now - sample->ts_time > window )
+            break;
+
+        int    v = sample->ts_temperature;
+        double t = (double)(sample->ts_time - base);
+
+        if( stats->ts_count == 0 || stats->ts_min > v ) stats->ts_min = v;
+        if( stats->ts_count == 0 || stats->ts_max < v ) stats->ts_max = v;
+
+        stats->ts_count += 1;
+        sum_t  += t;
+        sum_v  += v;
+        sum_tt += t * t;
+        sum_tv += t * v;
+    }
+
+    if( stats->ts_count < 1 )
+        goto EXIT;
+
+    double n = stats->ts_count;
+
+    stats->ts_mean_mC = (int)(sum_v * 1000 / n);
+
+    double den = n * sum_tt - sum_t * sum_t;
+    if( den > 0 )
+        stats->ts_slope_mC_min = (int)((n * sum_tv - sum_t * sum_v) / den
+                                       * 1000 * 60);
+
+    ack = true;
+
+EXIT:
+    return ack;
+}
+
+/** Write thermal object history as text
+ *
+ * Temperature readings are written as "<age> <temperature> <status>"
+ * lines, followed by accepted status changes as
+ * "<age> <temperature> <from> -> <to>" lines. Age is in seconds, and
+ * entries are in order from oldest to newest.
+ *
+ * @param self    thermal object pointer
+ * @param window  how far back to look [s], or zero for whole history
+ * @param file    stream to write to
+ */
+void
+thermal_object_write_history(const thermal_object_t *self, int window,
+                             FILE *file)
+{
+    if( !self )
+        goto EXIT;
+
+    time_t now = to_util_monotime();
+
+    for( int i = self->to_history_count - 1; i >= 0; --i ) {
+        const thermal_sample_t *sample = thermal_object_get_sample(self, i);
+
+        if( window > 0 && now - sample->ts_time > window )
+            continue;
+
+        fprintf(file, "%ld %d %s\n",
+                (long)(now - sample->ts_time), sample->ts_temperature,
+                thermal_status_repr(sample->ts_status));
+    }
+
+    for( int i = self->to_transition_count - 1; i >= 0; --i ) {
+        int slot = ((self->to_transition_next + THERMAL_HISTORY_TRANSITIONS
+                     - 1 - i) % THERMAL_HISTORY_TRANSITIONS);
+        const thermal_transition_t *tr = &self->to_transitions[slot];
+
+        if( window > 0 && now - tr->tt_time > window )
+            continue;
+
+        fprintf(file, "%ld %d %s -> %s\n",
+                (long)(now - tr->tt_time), tr->tt_temperature,
+                thermal_status_repr(tr->tt_from),
+                thermal_status_repr(tr->tt_to));
+    }
+
+EXIT:
+    return;
+}
+
+/** Get temperature range for the current status of thermal object
+ *
+ * @param self  thermal object pointer
+ * @param lo    where to store lowest temperature for the status [C]
+ * @param hi    where to store lowest temperature for the next status [C]
+ *
+ * @return true if limits are known, false otherwise
+ */
+static bool
+thermal_object_get_limits(const thermal_object_t *self, int *lo, int *hi)
+{
+    bool ack = false;
+
+    if( !thermal_object_has_valid_sensor_vtab(self) )
+        goto EXIT;
+
+    if( !self->to_sensor_vtab->tsv_get_limits_cb )
+        goto EXIT;
+
+    ack = self->to_sensor_vtab->tsv_get_limits_cb(self, lo, hi);
+
+EXIT:
+    return ack;
+}
+
+/** Adjust polling delay based on temperature trend
+ *
+ * When temperature is moving towards status limit, the time until
+ * the limit is crossed is predicted and the poll delay is shortened
+ * so that the crossing gets noticed in time. When temperature is
+ * stable and far from the limits, the poll is pushed towards the
+ * end of the allowed window.
+ *
+ * The result never exceeds the maximum delay given by the sensor
+ * backend, and is shortened at most down to the delay used during
+ * status transitions. If the temperature is already outside the
+ * status range, the delays are left as they are.
+ *
+ * @param self     thermal object pointer
+ * @param mintime  minimum poll delay [s], in/out
+ * @param maxtime  maximum poll delay [s], in/out
+ */
+static void
+thermal_object_adjust_poll_delay(thermal_object_t *self,
+                                 int *mintime, int *maxtime)
+{
+    double slope  = 0;
+    int    spread = 0;
+    int    limit_lo, limit_hi;
+
+    if( !thermal_object_get_limits(self, &limit_lo, &limit_hi) )
+        goto EXIT;
+
+    if( !thermal_object_get_trend(self, &slope, &spread) )
+        goto EXIT;
+
+    int temp = self->to_temperature;
+    int lo   = *mintime;
+    int hi   = *maxtime;
+
+    /* Within hysteresis band the temperature can be outside the
+     * status range already; there is no crossing to predict and
+     * the normal delays apply */
+    if( temp < limit_lo || temp >= limit_hi )
+        goto EXIT;
+
+    /* Predicted time until temperature leaves the status range */
+    double crossing = hi;
+
+    if( slope > 0 )
+        crossing = (limit_hi - temp) / slope;
+    else if( slope < 0 )
+        crossing = (temp - limit_lo + 1) / -slope;
+
+    if( crossing > 0 && crossing < hi ) {
+        /* Shorten: make sure we are awake around projected crossing */
+        int shortest = THERMAL_STATUS_POLL_DELAY_TRANSITION_MINIMUM;
+        if( shortest > lo )
+            shortest = lo;
+
+        hi = (int)crossing;
+        if( hi < THERMAL_STATUS_POLL_DELAY_TRANSITION_MAXIMUM )
+            hi = THERMAL_STATUS_POLL_DELAY_TRANSITION_MAXIMUM;
+        if( hi > *maxtime )
+            hi = *maxtime;
+
+        if( lo > hi / 2 )
+            lo = hi / 2;
+        if( lo < shortest )
+            lo = shortest;
+    }
+    else if( spread <= 1 &&
+             temp - limit_lo >= THERMAL_TREND_SAFE_MARGIN &&
+             limit_hi - temp >= THERMAL_TREND_SAFE_MARGIN ) {
+        /* Stretch: no need to poll before the window midpoint */
+        if( lo < hi )
+            lo = (lo + hi) / 2;
+    }
+
+    if( lo == *mintime && hi == *maxtime )
+        goto EXIT;
+
+    dsme_log(LOG_DEBUG, PFIX"%s: trend %+.3f C/min; poll delay %d-%d -> %d-%d",
+             thermal_object_get_name(self), slope * 60,
+             *mintime, *maxtime, lo, hi);
+
+    *mintime = lo;
+    *maxtime = hi;
+
+EXIT:
+    return;
+}
+
+/** Check if sensor backend filters temperature readings
+ *
+ * @param self  thermal object pointer
+ *
+ * @return true if reported status is already filtered, false otherwise
+ */
+static bool
+thermal_object_is_filtered(const thermal_object_t *self)
+{
+    bool ack = false;
+
+    if( !thermal_object_has_valid_sensor_vtab(self) )
+        goto EXIT;
+
+    if( !self->to_sensor_vtab->tsv_is_filtered_cb )
+        goto EXIT;
+
+    ack = self->to_sensor_vtab->tsv_is_filtered_cb(self);
+
 EXIT:
     return ack;
 }
@@ -528,6 +965,57 @@ EXIT:
     return;
 }
 
+/** Re-evaluate meta sensor after the sensors it depends on got updated
+ *
+ * Unlike thermal_object_request_update(), this does not go through
+ * the sensors the object depends on - the values they already have
+ * are used as is.
+ *
+ * @param self         thermal object pointer
+ *
+ * @return true if thermal_object_handle_update() has been / will be
+ *         called, false otherwise
+ */
+bool
+thermal_object_evaluate_update(thermal_object_t *self)
+{
+    /* Unless the object itself requested an update, this is just
+     * a side effect of some other sensor getting updated */
+    self->to_reevaluating = !self->to_request_pending;
+
+    /* Mark as pending so that the result gets processed */
+    self->to_request_pending = true;
+
+    bool ack = thermal_object_read_sensor(self);
+
+    self->to_reevaluating = false;
+
+    if( ack )
+        return true;
+
+    dsme_log(LOG_DEBUG, PFIX"%s: re-evaluation failed",
+             thermal_object_get_name(self));
+
+    thermal_object_cancel_update(self);
+    return false;
+}
+
+/** Check if sensor is being read only for dependency re-evaluation
+ *
+ * Sensor backends can use this to avoid treating readings made
+ * during thermal_object_evaluate_update() as new samples, e.g. when
+ * filtering readings over time.
+ *
+ * @param self         thermal object pointer
+ *
+ * @return true if re-evaluation is in progress, false otherwise
+ */
+bool
+thermal_object_is_reevaluating(const thermal_object_t *self)
+{
+    return self ? self->to_reevaluating : false;
+}
+
 /** Check if thermal object is waiting for sensor backend status query
  *
  * @param self         thermal object pointer
@@ -590,6 +1078,10 @@ thermal_object_handle_update(thermal_object_t *self)
      */
     self->to_temperature = temperature;
 
+    time_t now = to_util_monotime();
+
+    thermal_object_add_sample(self, now, temperature, status);
+
     /* If we are in or arrive back to stable status,
      * clear the in-transition flags
      */
@@ -605,14 +1097,21 @@ thermal_object_handle_update(thermal_object_t *self)
         goto EXIT;
     }
 
+    /* If the sensor backend filters the readings, glitches have
+     * already been dealt with and there is no need to wait. Except
+     * for fatal status, which leads to shutdown.
+     */
+    if( status != THERMAL_STATUS_FATAL && thermal_object_is_filtered(self) ) {
+        self->to_status_next = status;
+        goto ACCEPT;
+    }
+
     /* Thermal object status has changed, but it can be because of bad reading.
      * Before accepting new status, make sure it is not a glitch.
      * Use more frequent polling frequency and accept the new state if
      * it stays effective over THERMAL_STATUS_TRANSITION_DELAY seconds.
      */
 
-    time_t now = to_util_monotime();
-
     if( self->to_status_next != status ) {
         self->to_status_next = status;
         self->to_status_change_started = now;
@@ -637,6 +1136,7 @@ thermal_object_handle_update(thermal_object_t *self)
         goto EXIT;
     }
 
+ACCEPT:
     /* The new status stayed active long enough, better believe it */
 
     dsme_log(LOG_NOTICE, PFIX"%s: transition to status=%s %s at temperature=%d",
@@ -645,6 +1145,8 @@ thermal_object_handle_update(thermal_object_t *self)
              "accepted",
              temperature);
 
+    thermal_object_add_transition(self, now, self->to_status_curr, status);
+
     self->to_status_curr = status;
     self->to_status_next = status;
     self->to_status_change_started = 0;
@@ -41,6 +41,10 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+
+#include <linux/netlink.h>
 
 #include <stdio.h>
 #include <stdbool.h>
@@ -51,6 +55,9 @@
 #include <errno.h>
 #include <syslog.h>
 #include <glob.h>
+#include <limits.h>
+#include <libgen.h>
+#include <fnmatch.h>
 
 #include <glib.h>
 
@@ -69,19 +76,49 @@ static void  tsg_util_set_string   (char **ptr, const char *val);
 static char *tsg_util_read_file    (const char *path);
 static bool  tsg_util_write_file   (const char *path, const char *text);
 static bool  tsg_util_parse_int    (const char *text, int *value);
-static bool  tsg_util_read_int     (const char *path, int *value, int divisor);
+static bool  tsg_util_pread_text   (const char *path, int *fd, char *buff, size_t size);
+static bool  tsg_util_read_int     (const char *path, int *fd, int *value, int divisor);
 
-static bool  tsg_util_read_temp_C  (const char *path, int *temp);
-static bool  tsg_util_read_temp_dC (const char *path, int *temp);
-static bool  tsg_util_read_temp_mC (const char *path, int *temp);
-static bool  tsg_util_read_other   (const char *sensor, int *temp);
+static bool  tsg_util_read_temp_C  (const char *path, int *fd, int *temp);
+static bool  tsg_util_read_temp_dC (const char *path, int *fd, int *temp);
+static bool  tsg_util_read_temp_mC (const char *path, int *fd, int *temp);
+static bool  tsg_util_read_other   (const char *sensor, int *fd, int *temp);
 
 /* ========================================================================= *
  * THERMAL_SENSOR_GENERIC
  * ========================================================================= */
 
-/** Callback function type for reading temperature from a file */
-typedef bool (*sg_temp_fn)(const char *path, int *temp);
+/** Maximum number of trip points that can be programmed per sensor */
+#define TSG_TRIP_MAX 4
+
+/** Minimum verification poll delay for event driven sensors [s] */
+#define TSG_EVENT_VERIFY_MINWAIT (30 * 60)
+
+/** Maximum verification poll delay for event driven sensors [s] */
+#define TSG_EVENT_VERIFY_MAXWAIT (60 * 60)
+
+/** Maximum number of samples used for median filtering */
+#define TSG_FILTER_MAX 9
+
+/** Temperature filtering methods */
+typedef enum
+{
+    /** Readings are used as is */
+    TSG_FILTER_NONE,
+
+    /** Median of the latest N readings */
+    TSG_FILTER_MEDIAN,
+
+    /** Exponential moving average with weight 1/N */
+    TSG_FILTER_EMA,
+} tsg_filter_t;
+
+/** Callback function type for reading temperature from a file
+ *
+ * The file descriptor is kept open between calls; -1 means
+ * the file has not been opened yet.
+ */
+typedef bool (*sg_temp_fn)(const char *path, int *fd, int *temp);
 
 /** Configuration data for thermal status level */
 typedef struct
@@ -108,18 +145,51 @@ typedef struct
     /** Cached thermal status */
     THERMAL_STATUS     sg_status;
 
+    /** Thermal status the latest unfiltered reading maps to */
+    THERMAL_STATUS     sg_raw_status;
+
     /** Temperature read function */
     sg_temp_fn         sg_temp_cb;
 
     /** Temperature file path / dependency sensor name */
     char              *sg_temp_path;
 
+    /** Temperature file descriptor, or -1 if not opened */
+    int                sg_temp_fd;
+
     /** Temperature correction offset */
     int                sg_temp_offs;
 
+    /** Temperature file units per degree [C] */
+    int                sg_temp_scale;
+
     /** Flag for: temperature is read from another sensor */
     bool               sg_is_meta;
 
+    /** Flag for: sensor was found via sysfs discovery */
+    bool               sg_is_discovered;
+
+    /** Temperature filtering method */
+    tsg_filter_t       sg_filter_type;
+
+    /** Number of samples the filter spans */
+    int                sg_filter_len;
+
+    /** Latest readings for median filter [C] */
+    int                sg_filter_buf[TSG_FILTER_MAX];
+
+    /** Number of readings fed to the filter, up to sg_filter_len */
+    int                sg_filter_count;
+
+    /** Index of sg_filter_buf slot to use for the next reading */
+    int                sg_filter_next;
+
+    /** Moving average [mC], or INVALID_TEMPERATURE before first reading */
+    int                sg_filter_ema;
+
+    /** Degrees needed to cross back towards normal status [C] */
+    int                sg_hysteresis;
+
     /** Path to sensor enable/disable control file */
     char              *sg_mode_path;
 
@@ -135,10 +205,32 @@ typedef struct
     /** Thermal level configuration array */
     sensor_level_t     sg_level[THERMAL_STATUS_COUNT];
 
+    /** Number of configured trip point files */
+    int                sg_trip_count;
+
+    /** Writable trip point temperature files */
+    char              *sg_trip_path[TSG_TRIP_MAX];
+
+    /** Value last written to trip point file, or INVALID_TEMPERATURE */
+    int                sg_trip_temp[TSG_TRIP_MAX];
+
+    /** Value trip point file had before first write */
+    int                sg_trip_orig[TSG_TRIP_MAX];
+
+    /** Flag for: trip points are programmed to match current status */
+    bool               sg_trip_ok;
+
+    /** Flag for: programming trip points failed, do not try again */
+    bool               sg_trip_failed;
+
+    /** Flag for: kernel is known to send uevents on trip crossings */
+    bool               sg_trip_events;
+
 } thermal_sensor_generic_t;
 
 static thermal_sensor_generic_t  *thermal_sensor_generic_create             (const char *name);
 static void                       thermal_sensor_generic_delete             (thermal_sensor_generic_t *self);
+static void                       thermal_sensor_generic_close_temp_file    (thermal_sensor_generic_t *self);
 
 static bool                       thermal_sensor_generic_is_valid           (thermal_sensor_generic_t *self);
 
@@ -146,10 +238,19 @@ static const char                *thermal_sensor_generic_get_name           (con
 static bool                       thermal_sensor_generic_get_status         (const thermal_sensor_generic_t *self, int *temp, THERMAL_STATUS *status);
 static const char                *thermal_sensor_generic_get_depends_on     (const thermal_sensor_generic_t *self);
 static bool                       thermal_sensor_generic_get_poll_delay     (const thermal_sensor_generic_t *self, int *minwait, int *maxwait);
+static bool                       thermal_sensor_generic_get_limits         (const thermal_sensor_generic_t *self, int *lo, int *hi);
+static bool                       thermal_sensor_generic_is_event_driven    (const thermal_sensor_generic_t *self);
+static bool                       thermal_sensor_generic_is_filtered        (const thermal_sensor_generic_t *self);
+static bool                       thermal_sensor_generic_has_zone           (const thermal_sensor_generic_t *self, const char *zone);
+static char                      *thermal_sensor_generic_read_zone_attr     (const thermal_sensor_generic_t *self, const char *attr);
+static bool                       thermal_sensor_generic_trip_is_movable    (const char *path);
 
 static bool                       thermal_sensor_generic_enable_sensor      (const thermal_sensor_generic_t *self, bool enable);
 static bool                       thermal_sensor_generic_sensor_is_enabled  (const thermal_sensor_generic_t *self);
-static bool                       thermal_sensor_generic_read_sensor        (thermal_sensor_generic_t *self);
+static bool                       thermal_sensor_generic_read_sensor        (thermal_sensor_generic_t *self, bool resample);
+static int                        thermal_sensor_generic_filter_temp        (thermal_sensor_generic_t *self, int temp, bool commit);
+static THERMAL_STATUS             thermal_sensor_generic_map_status         (const thermal_sensor_generic_t *self, int temp);
+static THERMAL_STATUS             thermal_sensor_generic_eval_status        (const thermal_sensor_generic_t *self, int temp);
 
 static void                       thermal_sensor_generic_set_temp_path      (thermal_sensor_generic_t *self, const char *path);
 static void                       thermal_sensor_generic_set_temp_func      (thermal_sensor_generic_t *self, sg_temp_fn cb);
@@ -158,6 +259,12 @@ static void                       thermal_sensor_generic_set_limit          (the
 
 static void                       thermal_sensor_generic_set_depends_on     (thermal_sensor_generic_t *self, const char *sensor_name);
 static void                       thermal_sensor_generic_set_temp_offs      (thermal_sensor_generic_t *self, int offs);
+static void                       thermal_sensor_generic_set_temp_scale     (thermal_sensor_generic_t *self, int scale);
+static void                       thermal_sensor_generic_add_trip_path      (thermal_sensor_generic_t *self, const char *path);
+static void                       thermal_sensor_generic_set_filter         (thermal_sensor_generic_t *self, tsg_filter_t type, int len);
+static void                       thermal_sensor_generic_set_hysteresis     (thermal_sensor_generic_t *self, int degrees);
+static bool                       thermal_sensor_generic_program_trips      (thermal_sensor_generic_t *self);
+static void                       thermal_sensor_generic_restore_trips      (thermal_sensor_generic_t *self);
 
 /* ========================================================================= *
  * HOOKS_FOR_THERMAL_OBJECT
@@ -169,6 +276,8 @@ static const char                *thermal_sensor_generic_get_name_cb        (con
 static const char                *thermal_sensor_generic_get_depends_on_cb  (const thermal_object_t *object);
 static bool                       thermal_sensor_generic_get_status_cb      (const thermal_object_t *object, THERMAL_STATUS *status, int *temp);
 static bool                       thermal_sensor_generic_get_poll_delay_cb  (const thermal_object_t *object, int *minwait, int *maxwait);
+static bool                       thermal_sensor_generic_get_limits_cb      (const thermal_object_t *object, int *lo, int *hi);
+static bool                       thermal_sensor_generic_is_filtered_cb     (const thermal_object_t *object);
 static bool                       thermal_sensor_generic_read_sensor_cb     (thermal_object_t *object);
 
 /* ========================================================================= *
@@ -187,6 +296,21 @@ static bool                       thermal_sensor_generic_read_sensor_cb     (the
 /** Keyword for declaring path to enable/disable file */
 #define CONFIG_KW_MODE    "Mode"
 
+/** Keyword for declaring writable trip point files */
+#define CONFIG_KW_TRIP    "Trip"
+
+/** Keyword for declaring temperature filtering method */
+#define CONFIG_KW_FILTER  "Filter"
+
+/** Keyword for declaring hysteresis for thermal limits */
+#define CONFIG_KW_HYSTERESIS "Hysteresis"
+
+/** Keyword for enabling / disabling sensor discovery */
+#define CONFIG_KW_DISCOVER "Discover"
+
+/** Keyword for declaring discovered sensors to leave out */
+#define CONFIG_KW_IGNORE  "Ignore"
+
 /** Keyword for declaring limits for low thermal status */
 #define CONFIG_KW_LOW     "Low"
 
@@ -209,11 +333,76 @@ static thermal_object_t          *tsg_objects_get_object          (GSList *list,
 static thermal_object_t          *tsg_objects_add_object          (GSList **list, const char *name);
 static thermal_sensor_generic_t  *tsg_objects_add_sensor          (GSList **list, const char *name);
 static THERMAL_STATUS             tsg_objects_parse_level         (const char *key);
+static int                        tsg_objects_count_like          (GSList *list, const thermal_object_t *self, const char *name);
+static void                       tsg_objects_sort_dependencies   (GSList **list);
 static void                       tsg_objects_register_all        (GSList **list);
 static void                       tsg_objects_read_config         (GSList **list, const char *config);
 static void                       tsg_objects_quit                (GSList **list);
 static void                       tsg_objects_init                (GSList **list);
 
+/* ========================================================================= *
+ * THERMAL_DISCOVERY
+ * ========================================================================= */
+
+/** Critical temperatures of discovered sensors are cached in this file */
+#define TSG_DISCOVERY_CACHE_PATH     "/var/lib/dsme/thermal_sensors.cache"
+
+/** Temporary file used while writing the cache */
+#define TSG_DISCOVERY_CACHE_TEMP     TSG_DISCOVERY_CACHE_PATH ".tmp"
+
+/** First line of cache file, followed by kernel release */
+#define TSG_DISCOVERY_CACHE_HEADER   "# dsme thermal sensor cache for kernel "
+
+/** Critical temperature to assume if sensor does not define one [C] */
+#define TSG_DISCOVERY_DEFAULT_CRIT   120
+
+/** Range of critical temperatures that are taken at face value [C] */
+#define TSG_DISCOVERY_MIN_CRIT        50
+#define TSG_DISCOVERY_MAX_CRIT       150
+
+/** State data used while discovering sensors */
+typedef struct
+{
+    /** Whether sysfs should be scanned for sensors */
+    bool        ds_enabled;
+
+    /** Name patterns of discovered sensors to leave out */
+    GSList     *ds_ignore;
+
+    /** Identity -> critical temperature, as loaded from cache file */
+    GHashTable *ds_cached;
+
+    /** Identity -> critical temperature, for sensors found in sysfs */
+    GHashTable *ds_found;
+} tsg_discovery_t;
+
+static int                        tsg_discovery_read_mC           (const char *path);
+static int                        tsg_discovery_zone_crit         (const char *zone);
+static char                      *tsg_discovery_read_attr         (const char *dir, const char *attr);
+static void                       tsg_discovery_read_config       (tsg_discovery_t *self, const char *config);
+static bool                       tsg_discovery_is_ignored        (const tsg_discovery_t *self, const char *name);
+static gchar                     *tsg_discovery_make_identity     (const tsg_discovery_t *self, const char *base);
+static int                        tsg_discovery_get_crit          (tsg_discovery_t *self, const char *base, int (*read_crit)(const char *), const char *path);
+static void                       tsg_discovery_add_sensor        (tsg_discovery_t *self, GSList **list, const char *name, const char *path, int crit);
+static void                       tsg_discovery_scan_zones        (tsg_discovery_t *self, GSList **list);
+static void                       tsg_discovery_scan_hwmon        (tsg_discovery_t *self, GSList **list);
+static void                       tsg_discovery_load_cache        (tsg_discovery_t *self, const char *kernel);
+static bool                       tsg_discovery_cache_is_stale    (const tsg_discovery_t *self);
+static void                       tsg_discovery_save_cache        (const tsg_discovery_t *self, const char *kernel);
+static void                       tsg_discovery_init              (GSList **list, char **configs);
+static void                       tsg_discovery_prune             (GSList **list);
+
+/* ========================================================================= *
+ * THERMAL_UEVENTS
+ * ========================================================================= */
+
+static void                       tsg_uevent_handle_message       (char *msg, size_t len);
+static void                       tsg_uevent_request_all          (void);
+static gboolean                   tsg_uevent_input_cb             (GIOChannel *chan, GIOCondition cnd, gpointer aptr);
+static bool                       tsg_uevent_is_active            (void);
+static bool                       tsg_uevent_init                 (void);
+static void                       tsg_uevent_quit                 (void);
+
 /* ========================================================================= *
  * UTILITY_FUNCTIONS
  * ========================================================================= */
@@ -441,9 +630,57 @@ tsg_util_parse_int(const char *text, int *value)
     return ack;
 }
 
+/** Read content of a small text file via persistent file descriptor
+ *
+ * The file is opened on the first call and read with pread() from
+ * offset zero on subsequent calls. If the file descriptor has become
+ * stale, e.g. because the device was removed and added back, the
+ * file is reopened and read again. On other errors the file is
+ * closed so that the next read starts from scratch.
+ *
+ * @param path  file path
+ * @param fd    cached file descriptor, or -1
+ * @param buff  buffer to read into
+ * @param size  size of the buffer
+ *
+ * @return true if data was read, false otherwise
+ */
+static bool
+tsg_util_pread_text(const char *path, int *fd, char *buff, size_t size)
+{
+    bool ack = false;
+
+    for( int attempt = 0; attempt < 2; ++attempt ) {
+        if( *fd == -1 ) {
+            *fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+            if( *fd == -1 )
+                goto EXIT;
+        }
+
+        ssize_t rc = TEMP_FAILURE_RETRY(pread(*fd, buff, size - 1, 0));
+
+        if( rc >= 0 ) {
+            buff[rc] = 0;
+            ack = true;
+            goto EXIT;
+        }
+
+        int err = errno;
+        TEMP_FAILURE_RETRY(close(*fd)), *fd = -1;
+        errno = err;
+
+        if( err != ENODEV && err != ESTALE )
+            break;
+    }
+
+EXIT:
+    return ack;
+}
+
 /** Read integer value from a text file
  *
  * @param path     file path
+ * @param fd       cached file descriptor, or -1
  * @param value    where to store number value
  * @param divisor  downscale factor to apply
  *
@@ -451,13 +688,13 @@ tsg_util_parse_int(const char *text, int *value)
  */
 
 static bool
-tsg_util_read_int(const char *path, int *value, int divisor)
+tsg_util_read_int(const char *path, int *fd, int *value, int divisor)
 {
     bool  ack = false;
-    char *txt = 0;
+    char  txt[64];
     int   val = 0;
 
-    if( !(txt = tsg_util_read_file(path)) )
+    if( !tsg_util_pread_text(path, fd, txt, sizeof txt) )
         goto EXIT;
 
     if( !tsg_util_parse_int(txt, &val) )
@@ -472,60 +709,64 @@ tsg_util_read_int(const char *path, int *value, int divisor)
     *value = val, ack = true;
 
 EXIT:
-    free(txt);
-
     return ack;
 }
 
 /** Read a text file containing temperature in [C] units
  *
  * @param path     file path
+ * @param fd       cached file descriptor, or -1
  * @param temp     where to store the temperature [C]
  *
  * @return true if temperature was obtained, false otherwise
  */
 static bool
-tsg_util_read_temp_C(const char *path, int *temp)
+tsg_util_read_temp_C(const char *path, int *fd, int *temp)
 {
-    return tsg_util_read_int(path, temp, 1);
+    return tsg_util_read_int(path, fd, temp, 1);
 }
 
 /** Read a text file containing temperature in [dC] units
  *
  * @param path     file path
+ * @param fd       cached file descriptor, or -1
  * @param temp     where to store the temperature [C]
  *
  * @return true if temperature was obtained, false otherwise
  */
 static bool
-tsg_util_read_temp_dC(const char *path, int *temp)
+tsg_util_read_temp_dC(const char *path, int *fd, int *temp)
 {
-    return tsg_util_read_int(path, temp, 10);
+    return tsg_util_read_int(path, fd, temp, 10);
 }
 
 /** Read a text file containing temperature in [mC] units
  *
  * @param path     file path
+ * @param fd       cached file descriptor, or -1
  * @param temp     where to store the temperature [C]
  *
  * @return true if temperature was obtained, false otherwise
  */
 static bool
-tsg_util_read_temp_mC(const char *path, int *temp)
+tsg_util_read_temp_mC(const char *path, int *fd, int *temp)
 {
-    return tsg_util_read_int(path, temp, 1000);
+    return tsg_util_read_int(path, fd, temp, 1000);
 }
 
 /** Get temperature of named sensor from thermal manager
  *
  * @param path     sensor name / sensor group prefix
+ * @param fd       (not used)
  * @param temp     where to store the temperature [C]
  *
  * @return true if temperature was obtained, false otherwise
  */
 static bool
-tsg_util_read_other(const char *sensor, int *temp)
+tsg_util_read_other(const char *sensor, int *fd, int *temp)
 {
+    (void)fd;
+
     THERMAL_STATUS status = THERMAL_STATUS_INVALID;
     return thermal_manager_get_sensor_status(sensor, &status, temp);
 }
@@ -548,12 +789,22 @@ thermal_sensor_generic_create(const char *name)
     self->sg_name         = strdup(name);
     self->sg_temp         = INVALID_TEMPERATURE;
     self->sg_status       = THERMAL_STATUS_INVALID;
+    self->sg_raw_status   = THERMAL_STATUS_INVALID;
 
     self->sg_temp_cb      = 0;
     self->sg_temp_path    = 0;
+    self->sg_temp_fd      = -1;
     self->sg_temp_offs    = 0;
+    self->sg_temp_scale   = 1;
     self->sg_is_meta      = false;
 
+    self->sg_filter_type  = TSG_FILTER_NONE;
+    self->sg_filter_len   = 0;
+    self->sg_filter_count = 0;
+    self->sg_filter_next  = 0;
+    self->sg_filter_ema   = INVALID_TEMPERATURE;
+    self->sg_hysteresis   = 0;
+
     self->sg_mode_path    = 0;
     self->sg_mode_enable  = 0;
     self->sg_mode_disable = 0;
@@ -566,6 +817,17 @@ thermal_sensor_generic_create(const char *name)
         self->sg_level[i].sl_maxwait = 0;
     }
 
+    self->sg_trip_count   = 0;
+    self->sg_trip_ok      = false;
+    self->sg_trip_failed  = false;
+    self->sg_trip_events  = false;
+
+    for( int i = 0; i < TSG_TRIP_MAX; ++i ) {
+        self->sg_trip_path[i] = 0;
+        self->sg_trip_temp[i] = INVALID_TEMPERATURE;
+        self->sg_trip_orig[i] = INVALID_TEMPERATURE;
+    }
+
     return self;
 }
 
@@ -586,18 +848,36 @@ thermal_sensor_generic_delete(thermal_sensor_generic_t *self)
 
     free(self->sg_name);
 
+    thermal_sensor_generic_close_temp_file(self);
     free(self->sg_temp_path);
 
     free(self->sg_mode_path);
     free(self->sg_mode_enable);
     free(self->sg_mode_disable);
 
+    thermal_sensor_generic_restore_trips(self);
+    for( int i = 0; i < self->sg_trip_count; ++i )
+        free(self->sg_trip_path[i]);
+
     free(self);
 
 EXIT:
     return;
 }
 
+/** Close temperature file descriptor kept open between reads
+ *
+ * @param self  sensor object
+ */
+static void
+thermal_sensor_generic_close_temp_file(thermal_sensor_generic_t *self)
+{
+    if( self->sg_temp_fd != -1 ) {
+        TEMP_FAILURE_RETRY(close(self->sg_temp_fd)),
+            self->sg_temp_fd = -1;
+    }
+}
+
 /** Check if sensor object is valid
  *
  * Check that all necessary values are set and configured paths
@@ -641,6 +921,39 @@ thermal_sensor_generic_is_valid(thermal_sensor_generic_t *self)
         goto EXIT;
     }
 
+    if( self->sg_trip_count > 0 && self->sg_is_meta ) {
+        dsme_log(LOG_ERR, PFIX"%s: %s",
+                 thermal_sensor_generic_get_name(self),
+                 "trip points specified for meta sensor");
+        goto EXIT;
+    }
+
+    for( int i = 0; i < self->sg_trip_count; ) {
+        if( thermal_sensor_generic_trip_is_movable(self->sg_trip_path[i]) ) {
+            ++i;
+            continue;
+        }
+
+        dsme_log(LOG_ERR, PFIX"%s: %s: %s",
+                 thermal_sensor_generic_get_name(self),
+                 self->sg_trip_path[i],
+                 "not a passive/active trip point; ignored");
+
+        free(self->sg_trip_path[i]);
+        self->sg_trip_count -= 1;
+        memmove(self->sg_trip_path + i, self->sg_trip_path + i + 1,
+                (self->sg_trip_count - i) * sizeof *self->sg_trip_path);
+        self->sg_trip_path[self->sg_trip_count] = 0;
+    }
+
+    /* With user space governor the kernel reports trip crossings via
+     * uevents right away, otherwise wait until one has been seen */
+    if( self->sg_trip_count > 0 ) {
+        char *policy = thermal_sensor_generic_read_zone_attr(self, "policy");
+        self->sg_trip_events = policy && !strcmp(policy, "user_space");
+        free(policy);
+    }
+
     if( self->sg_mode_path ) {
         if( self->sg_is_meta ) {
             dsme_log(LOG_ERR, PFIX"%s: %s",
@@ -668,6 +981,28 @@ thermal_sensor_generic_is_valid(thermal_sensor_generic_t *self)
          */
     }
 
+    if( self->sg_filter_type == TSG_FILTER_MEDIAN &&
+        (self->sg_filter_len < 1 || self->sg_filter_len > TSG_FILTER_MAX) ) {
+        dsme_log(LOG_ERR, PFIX"%s: %s",
+                 thermal_sensor_generic_get_name(self),
+                 "invalid median filter length");
+        goto EXIT;
+    }
+
+    if( self->sg_filter_type == TSG_FILTER_EMA && self->sg_filter_len < 1 ) {
+        dsme_log(LOG_ERR, PFIX"%s: %s",
+                 thermal_sensor_generic_get_name(self),
+                 "invalid moving average length");
+        goto EXIT;
+    }
+
+    if( self->sg_hysteresis < 0 ) {
+        dsme_log(LOG_ERR, PFIX"%s: %s",
+                 thermal_sensor_generic_get_name(self),
+                 "negative hysteresis");
+        goto EXIT;
+    }
+
     for( int i = 0; i < THERMAL_STATUS_COUNT; ++i ) {
         if( self->sg_level[i].sl_mintemp == INVALID_TEMPERATURE ) {
             dsme_log(LOG_ERR, PFIX"%s: %s",
@@ -772,6 +1107,15 @@ thermal_sensor_generic_get_poll_delay(const thermal_sensor_generic_t *self,
     if( lo <= 0 || hi < lo )
         goto EXIT;
 
+    /* When trip point crossings are reported via uevents, polling
+     * is needed only for verifying that things still work. Except
+     * at alert levels, where there is no room for errors. */
+    if( thermal_sensor_generic_is_event_driven(self) &&
+        self->sg_status < THERMAL_STATUS_ALERT ) {
+        if( lo < TSG_EVENT_VERIFY_MINWAIT ) lo = TSG_EVENT_VERIFY_MINWAIT;
+        if( hi < TSG_EVENT_VERIFY_MAXWAIT ) hi = TSG_EVENT_VERIFY_MAXWAIT;
+    }
+
     *minwait = lo;
     *maxwait = hi;
     ack = true;
@@ -780,6 +1124,185 @@ EXIT:
     return ack;
 }
 
+/** Get temperature range of the current sensor object status
+ *
+ * @param self  sensor object
+ * @param lo    where to store lowest temperature for the status [C]
+ * @param hi    where to store lowest temperature for the next status [C]
+ *
+ * @return true if values were obtained, false otherwise
+ */
+static bool
+thermal_sensor_generic_get_limits(const thermal_sensor_generic_t *self,
+                                  int *lo, int *hi)
+{
+    bool ack = false;
+
+    if( !self || self->sg_status == THERMAL_STATUS_INVALID )
+        goto EXIT;
+
+    *lo = self->sg_level[self->sg_status].sl_mintemp;
+    *hi = self->sg_level[self->sg_status + 1].sl_mintemp;
+
+    /* Moving back towards normal status needs to cross hysteresis */
+    if( self->sg_status > THERMAL_STATUS_NORMAL )
+        *lo -= self->sg_hysteresis;
+    else if( self->sg_status < THERMAL_STATUS_NORMAL )
+        *hi += self->sg_hysteresis;
+
+    ack = true;
+
+EXIT:
+    return ack;
+}
+
+/** Check if sensor object gets updated on trip point uevents
+ *
+ * Trip points are crossed by unfiltered readings. While the filtered
+ * status lags behind, the trip points have already been crossed and
+ * further uevents can't be expected, so normal polling is needed.
+ *
+ * @param self  sensor object
+ *
+ * @return true if trip points are in use and known to generate
+ *         uevents, false otherwise
+ */
+static bool
+thermal_sensor_generic_is_event_driven(const thermal_sensor_generic_t *self)
+{
+    return (self && self->sg_trip_ok && self->sg_trip_events &&
+            self->sg_raw_status == self->sg_status &&
+            tsg_uevent_is_active());
+}
+
+/** Check if sensor object filters temperature readings
+ *
+ * The filter output is not trusted until the filter has received
+ * as many readings as it spans, so that single bad readings right
+ * after startup are not taken at face value. Also the latest
+ * unfiltered reading must agree with the filtered status.
+ *
+ * @param self  sensor object
+ *
+ * @return true if filter is in use, full and confirmed by the
+ *         latest reading, false otherwise
+ */
+static bool
+thermal_sensor_generic_is_filtered(const thermal_sensor_generic_t *self)
+{
+    return (self && self->sg_filter_type != TSG_FILTER_NONE &&
+            self->sg_filter_count >= self->sg_filter_len &&
+            self->sg_raw_status == self->sg_status);
+}
+
+/** Check if sensor object trip points belong to given thermal zone
+ *
+ * The thermal zone is identified by the name of the directory
+ * holding the trip point files, e.g. "thermal_zone9".
+ *
+ * @param self  sensor object
+ * @param zone  thermal zone name
+ *
+ * @return true if zone matches, false otherwise
+ */
+static bool
+thermal_sensor_generic_has_zone(const thermal_sensor_generic_t *self,
+                                const char *zone)
+{
+    bool matches = false;
+
+    if( !self || self->sg_trip_count < 1 )
+        goto EXIT;
+
+    const char *path = self->sg_trip_path[0];
+    const char *end  = strrchr(path, '/');
+
+    if( !end )
+        goto EXIT;
+
+    const char *beg = end;
+    while( beg > path && beg[-1] != '/' )
+        --beg;
+
+    size_t len = end - beg;
+
+    matches = (strlen(zone) == len && !strncmp(zone, beg, len));
+
+EXIT:
+    return matches;
+}
+
+/** Read attribute of the thermal zone holding sensor trip points
+ *
+ * @param self  sensor object
+ * @param attr  attribute file name, e.g. "policy"
+ *
+ * @return attribute value without trailing white space, or NULL
+ */
+static char *
+thermal_sensor_generic_read_zone_attr(const thermal_sensor_generic_t *self,
+                                      const char *attr)
+{
+    char *text = 0;
+
+    if( !self || self->sg_trip_count < 1 )
+        goto EXIT;
+
+    const char *path = self->sg_trip_path[0];
+    const char *end  = strrchr(path, '/');
+
+    if( !end )
+        goto EXIT;
+
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof temp, "%.*s/%s", (int)(end - path), path, attr);
+
+    if( (text = tsg_util_read_file(temp)) )
+        text[strcspn(text, " \t\r\n")] = 0;
+
+EXIT:
+    return text;
+}
+
+/** Check if trip point can be moved without side effects
+ *
+ * Critical and hot trip points make the kernel shut down / suspend
+ * the device, so only passive and active trip points are used.
+ *
+ * @param path  trip point temperature file, e.g. trip_point_N_temp
+ *
+ * @return true if trip point type is passive or active, false otherwise
+ */
+static bool
+thermal_sensor_generic_trip_is_movable(const char *path)
+{
+    static const char suffix[] = "_temp";
+
+    bool   movable = false;
+    char  *type    = 0;
+    size_t len     = strlen(path);
+
+    if( len < sizeof suffix - 1 ||
+        strcmp(path + len - (sizeof suffix - 1), suffix) )
+        goto EXIT;
+
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof temp, "%.*s_type",
+             (int)(len - (sizeof suffix - 1)), path);
+
+    if( !(type = tsg_util_read_file(temp)) )
+        goto EXIT;
+
+    type[strcspn(type, " \t\r\n")] = 0;
+
+    movable = !strcmp(type, "passive") || !strcmp(type, "active");
+
+EXIT:
+    free(type);
+
+    return movable;
+}
+
 /** Enable/disable sensor associated with sensor object
  *
  * @param self    sensor object
@@ -840,17 +1363,20 @@ EXIT:
  * On success the value is cached and can be obtained via
  * thermal_sensor_generic_get_status() function.
  *
- * @param self    sensor object
+ * @param self      sensor object
+ * @param resample  true to feed the reading to temperature filter
  *
  * @return true if reading succeeded, false otherwise
  */
 static bool
-thermal_sensor_generic_read_sensor(thermal_sensor_generic_t *self)
+thermal_sensor_generic_read_sensor(thermal_sensor_generic_t *self,
+                                   bool resample)
 {
     bool ack = false;
 
     int            temp   = INVALID_TEMPERATURE;
     THERMAL_STATUS status = THERMAL_STATUS_INVALID;
+    THERMAL_STATUS raw    = THERMAL_STATUS_INVALID;
 
     if( !self )
         goto EXIT;
@@ -858,7 +1384,7 @@ thermal_sensor_generic_read_sensor(thermal_sensor_generic_t *self)
     if( !self->sg_temp_cb )
         goto EXIT;
 
-    if( !self->sg_temp_cb(self->sg_temp_path, &temp) ) {
+    if( !self->sg_temp_cb(self->sg_temp_path, &self->sg_temp_fd, &temp) ) {
 
         /* Check if the failure could be because some other
          * process has disabled the sensor */
@@ -877,7 +1403,7 @@ thermal_sensor_generic_read_sensor(thermal_sensor_generic_t *self)
             goto EXIT;
         }
 
-        if( !self->sg_temp_cb(self->sg_temp_path, &temp) ) {
+        if( !self->sg_temp_cb(self->sg_temp_path, &self->sg_temp_fd, &temp) ) {
             dsme_log(LOG_WARNING, PFIX"%s: reading still failed",
                      thermal_sensor_generic_get_name(self));
             goto EXIT;
@@ -889,50 +1415,201 @@ thermal_sensor_generic_read_sensor(thermal_sensor_generic_t *self)
 
     temp += self->sg_temp_offs;
 
-    for( int i = 0; i < THERMAL_STATUS_COUNT; ++i ) {
-        if( temp >= self->sg_level[i].sl_mintemp )
-            status = i;
+    /* Obviously wrong readings must not end up in the filter state,
+     * where they would keep skewing the output */
+    if( temp < IGNORE_TEMP_BELOW || temp > IGNORE_TEMP_ABOVE ) {
+        dsme_log(LOG_WARNING, PFIX"%s: invalid temperature reading: %dC",
+                 thermal_sensor_generic_get_name(self), temp);
+        temp = INVALID_TEMPERATURE;
+        goto EXIT;
     }
 
+    raw    = thermal_sensor_generic_eval_status(self, temp);
+    temp   = thermal_sensor_generic_filter_temp(self, temp, resample);
+    status = thermal_sensor_generic_eval_status(self, temp);
+
     ack = true;
 
 EXIT:
-    self->sg_temp   = temp;
-    self->sg_status = status;
+    self->sg_temp       = temp;
+    self->sg_status     = status;
+    self->sg_raw_status = raw;
+
+    if( ack && self->sg_trip_count > 0 )
+        thermal_sensor_generic_program_trips(self);
 
     return ack;
 }
 
-/** Set path of sensor object sensor value file
+/** Pass temperature reading through configured filter
  *
- * @param self  sensor object
- * @param path  file from which temperature can be read
+ * When not committing, the reading is evaluated as if it were the
+ * next sample, but the filter state is left as it was. This is used
+ * when meta sensors are re-evaluated due to updates of the sensors
+ * they depend on, so that the filter gets fed only from the regular
+ * reads of the sensor itself.
+ *
+ * @param self    sensor object
+ * @param temp    temperature reading [C]
+ * @param commit  true to add reading to filter state, false to peek
+ *
+ * @return filtered temperature [C]
  */
-static void
-thermal_sensor_generic_set_temp_path(thermal_sensor_generic_t *self,
-                                     const char *path)
+static int
+thermal_sensor_generic_filter_temp(thermal_sensor_generic_t *self, int temp,
+                                   bool commit)
 {
-    tsg_util_set_string(&self->sg_temp_path, path);
-    self->sg_is_meta = false;
+    int buf[TSG_FILTER_MAX];
+    int count = self->sg_filter_count;
+    int next  = self->sg_filter_next;
+    int ema   = self->sg_filter_ema;
+
+    if( count < self->sg_filter_len )
+        count += 1;
+
+    switch( self->sg_filter_type ) {
+    case TSG_FILTER_MEDIAN:
+        memcpy(buf, self->sg_filter_buf, sizeof buf);
+        buf[next] = temp;
+        next = (next + 1) % self->sg_filter_len;
+
+        /* Insertion sort a copy, the buffer is small */
+        int sorted[TSG_FILTER_MAX];
+        for( int i = 0; i < count; ++i ) {
+            int v = buf[i], j = i;
+            for( ; j > 0 && sorted[j-1] > v; --j )
+                sorted[j] = sorted[j-1];
+            sorted[j] = v;
+        }
+        /* Use the lower middle value while the buffer holds an even
+         * number of readings, so that a single high reading can't
+         * get picked before the buffer has filled up */
+        temp = sorted[(count - 1) / 2];
+        break;
+
+    case TSG_FILTER_EMA:
+        if( ema == INVALID_TEMPERATURE )
+            ema = temp * 1000;
+        else
+            ema += (temp * 1000 - ema) / self->sg_filter_len;
+
+        if( ema < 0 )
+            temp = (ema - 500) / 1000;
+        else
+            temp = (ema + 500) / 1000;
+        break;
+
+    default:
+        break;
+    }
+
+    if( commit ) {
+        if( self->sg_filter_type == TSG_FILTER_MEDIAN )
+            memcpy(self->sg_filter_buf, buf, sizeof buf);
+        self->sg_filter_count = count;
+        self->sg_filter_next  = next;
+        self->sg_filter_ema   = ema;
+    }
+
+    return temp;
 }
 
-/** Set sensor object temperature read function
+/** Map temperature to thermal status using configured limits
  *
  * @param self  sensor object
- * @param cb    callback that can read and cache temperature
+ * @param temp  temperature [C]
+ *
+ * @return thermal status
  */
-static void
-thermal_sensor_generic_set_temp_func(thermal_sensor_generic_t *self,
-                                     sg_temp_fn cb)
+static THERMAL_STATUS
+thermal_sensor_generic_map_status(const thermal_sensor_generic_t *self,
+                                  int temp)
 {
-    self->sg_is_meta = false;
-    self->sg_temp_cb = cb;
-}
+    THERMAL_STATUS status = THERMAL_STATUS_INVALID;
 
-/** Set sensor object sensor enable/disable controls
- *
- * @param self     sensor object
- * @param path     file that can be used to enable/disable sensor
+    for( int i = 0; i < THERMAL_STATUS_COUNT; ++i ) {
+        if( temp >= self->sg_level[i].sl_mintemp )
+            status = i;
+    }
+
+    return status;
+}
+
+/** Evaluate thermal status, taking hysteresis into account
+ *
+ * Moving away from normal status happens as soon as the limit is
+ * crossed, but moving back towards normal status requires that
+ * the temperature crosses the limit by hysteresis degrees.
+ *
+ * @param self  sensor object
+ * @param temp  temperature [C]
+ *
+ * @return thermal status
+ */
+static THERMAL_STATUS
+thermal_sensor_generic_eval_status(const thermal_sensor_generic_t *self,
+                                   int temp)
+{
+    THERMAL_STATUS prev   = self->sg_status;
+    THERMAL_STATUS status = thermal_sensor_generic_map_status(self, temp);
+    int            hyst   = self->sg_hysteresis;
+
+    if( hyst <= 0 || status == THERMAL_STATUS_INVALID ||
+        prev == THERMAL_STATUS_INVALID )
+        goto EXIT;
+
+    if( prev > THERMAL_STATUS_NORMAL && status < prev ) {
+        THERMAL_STATUS held = thermal_sensor_generic_map_status(self,
+                                                                temp + hyst);
+        if( held > prev )
+            held = prev;
+        if( status < held )
+            status = held;
+    }
+    else if( prev < THERMAL_STATUS_NORMAL && status > prev ) {
+        THERMAL_STATUS held = thermal_sensor_generic_map_status(self,
+                                                                temp - hyst);
+        if( held == THERMAL_STATUS_INVALID || held < prev )
+            held = prev;
+        if( status > held )
+            status = held;
+    }
+
+EXIT:
+    return status;
+}
+
+/** Set path of sensor object sensor value file
+ *
+ * @param self  sensor object
+ * @param path  file from which temperature can be read
+ */
+static void
+thermal_sensor_generic_set_temp_path(thermal_sensor_generic_t *self,
+                                     const char *path)
+{
+    thermal_sensor_generic_close_temp_file(self);
+    tsg_util_set_string(&self->sg_temp_path, path);
+    self->sg_is_meta = false;
+}
+
+/** Set sensor object temperature read function
+ *
+ * @param self  sensor object
+ * @param cb    callback that can read and cache temperature
+ */
+static void
+thermal_sensor_generic_set_temp_func(thermal_sensor_generic_t *self,
+                                     sg_temp_fn cb)
+{
+    self->sg_is_meta = false;
+    self->sg_temp_cb = cb;
+}
+
+/** Set sensor object sensor enable/disable controls
+ *
+ * @param self     sensor object
+ * @param path     file that can be used to enable/disable sensor
  * @param enable   string to write when enabling sensor
  * @param disable  string to write when disabling sensor
  */
@@ -975,6 +1652,7 @@ static void
 thermal_sensor_generic_set_depends_on(thermal_sensor_generic_t *self,
                                       const char *sensor_name)
 {
+    thermal_sensor_generic_close_temp_file(self);
     tsg_util_set_string(&self->sg_temp_path, sensor_name);
     self->sg_is_meta = true;
     self->sg_temp_cb = tsg_util_read_other;
@@ -994,6 +1672,199 @@ thermal_sensor_generic_set_temp_offs(thermal_sensor_generic_t *self, int offs)
     self->sg_temp_offs = offs;
 }
 
+/** Set sensor object temperature file units
+ *
+ * Needed for converting thermal limits to trip point values
+ *
+ * @param self     sensor object
+ * @param scale    temperature file units per degree [C]
+ */
+static void
+thermal_sensor_generic_set_temp_scale(thermal_sensor_generic_t *self,
+                                      int scale)
+{
+    self->sg_temp_scale = (scale > 0) ? scale : 1;
+}
+
+/** Set sensor object temperature filtering method
+ *
+ * @param self  sensor object
+ * @param type  filtering method
+ * @param len   number of samples the filter spans
+ */
+static void
+thermal_sensor_generic_set_filter(thermal_sensor_generic_t *self,
+                                  tsg_filter_t type, int len)
+{
+    self->sg_filter_type  = type;
+    self->sg_filter_len   = len;
+    self->sg_filter_count = 0;
+    self->sg_filter_next  = 0;
+    self->sg_filter_ema   = INVALID_TEMPERATURE;
+}
+
+/** Set sensor object thermal limit hysteresis
+ *
+ * @param self     sensor object
+ * @param degrees  hysteresis [C]
+ */
+static void
+thermal_sensor_generic_set_hysteresis(thermal_sensor_generic_t *self,
+                                      int degrees)
+{
+    self->sg_hysteresis = degrees;
+}
+
+/** Add writable trip point temperature file to sensor object
+ *
+ * @param self     sensor object
+ * @param path     trip point temperature file path
+ */
+static void
+thermal_sensor_generic_add_trip_path(thermal_sensor_generic_t *self,
+                                     const char *path)
+{
+    if( self->sg_trip_count >= TSG_TRIP_MAX ) {
+        dsme_log(LOG_WARNING, PFIX"%s: %s: too many trip points",
+                 thermal_sensor_generic_get_name(self), path);
+        goto EXIT;
+    }
+
+    self->sg_trip_path[self->sg_trip_count++] = strdup(path);
+
+EXIT:
+    return;
+}
+
+/** Program trip points to match thermal limits around current status
+ *
+ * The status boundaries closest to the current status - the one above
+ * first, then the one below, then the next ones above and below, etc -
+ * are written to trip point files in ascending order. Boundaries towards
+ * normal status are moved by hysteresis. Only values that differ from
+ * what was written earlier are written.
+ *
+ * If writing fails, trip points are not used for this sensor anymore
+ * and it falls back to normal polling.
+ *
+ * @param self     sensor object
+ *
+ * @return true if trip points are up to date, false otherwise
+ */
+static bool
+thermal_sensor_generic_program_trips(thermal_sensor_generic_t *self)
+{
+    int want[TSG_TRIP_MAX];
+    int count = 0;
+
+    if( self->sg_trip_failed || self->sg_status == THERMAL_STATUS_INVALID )
+        goto EXIT;
+
+    /* Collect distinct boundary temperatures, nearest first */
+    for( int d = 0; count < self->sg_trip_count; ++d ) {
+        int up = self->sg_status + 1 + d;
+        int dn = self->sg_status - d;
+
+        if( up >= THERMAL_STATUS_COUNT && dn < 0 )
+            break;
+
+        for( int k = 0; k < 2 && count < self->sg_trip_count; ++k ) {
+            int level = k ? dn : up;
+
+            if( level < 0 || level >= THERMAL_STATUS_COUNT )
+                continue;
+
+            int temp = self->sg_level[level].sl_mintemp;
+            int i    = count;
+
+            /* Crossing towards normal status needs to cover hysteresis,
+             * see thermal_sensor_generic_eval_status() */
+            if( k && level > THERMAL_STATUS_NORMAL )
+                temp -= self->sg_hysteresis;
+            else if( !k && level <= THERMAL_STATUS_NORMAL )
+                temp += self->sg_hysteresis;
+
+            while( i > 0 && want[i-1] > temp )
+                --i;
+
+            if( i > 0 && want[i-1] == temp )
+                continue;
+
+            memmove(want + i + 1, want + i, (count - i) * sizeof *want);
+            want[i] = temp, ++count;
+        }
+    }
+
+    for( int i = 0; i < count; ++i ) {
+        /* Lowest raw value that reads as the boundary temperature,
+         * see rounding done in tsg_util_read_int() */
+        int raw = ((want[i] - self->sg_temp_offs) * self->sg_temp_scale
+                   - self->sg_temp_scale / 2);
+        if( raw < 0 && self->sg_temp_scale > 1 )
+            raw += 1;
+
+        if( self->sg_trip_temp[i] == raw )
+            continue;
+
+        const char *path = self->sg_trip_path[i];
+
+        if( self->sg_trip_orig[i] == INVALID_TEMPERATURE ) {
+            char *orig = tsg_util_read_file(path);
+            if( !orig || !tsg_util_parse_int(orig, &self->sg_trip_orig[i]) )
+                self->sg_trip_orig[i] = INVALID_TEMPERATURE;
+            free(orig);
+        }
+
+        char txt[32];
+        snprintf(txt, sizeof txt, "%d", raw);
+
+        if( !tsg_util_write_file(path, txt) ) {
+            dsme_log(LOG_WARNING, PFIX"%s: %s: can't program trip point: "
+                     "%m; using polling",
+                     thermal_sensor_generic_get_name(self), path);
+            thermal_sensor_generic_restore_trips(self);
+            self->sg_trip_failed = true;
+            goto EXIT;
+        }
+
+        dsme_log(LOG_DEBUG, PFIX"%s: %s: trip point at %dC",
+                 thermal_sensor_generic_get_name(self), path, want[i]);
+
+        self->sg_trip_temp[i] = raw;
+    }
+
+    self->sg_trip_ok = (count > 0);
+
+EXIT:
+    return self->sg_trip_ok;
+}
+
+/** Restore trip points to values they had before programming
+ *
+ * @param self     sensor object
+ */
+static void
+thermal_sensor_generic_restore_trips(thermal_sensor_generic_t *self)
+{
+    for( int i = 0; i < self->sg_trip_count; ++i ) {
+        if( self->sg_trip_temp[i] == INVALID_TEMPERATURE )
+            continue;
+
+        if( self->sg_trip_orig[i] != INVALID_TEMPERATURE ) {
+            char txt[32];
+            snprintf(txt, sizeof txt, "%d", self->sg_trip_orig[i]);
+            if( !tsg_util_write_file(self->sg_trip_path[i], txt) )
+                dsme_log(LOG_WARNING, PFIX"%s: %s: can't restore trip point: %m",
+                         thermal_sensor_generic_get_name(self),
+                         self->sg_trip_path[i]);
+        }
+
+        self->sg_trip_temp[i] = INVALID_TEMPERATURE;
+    }
+
+    self->sg_trip_ok = false;
+}
+
 /* ========================================================================= *
  * HOOKS_FOR_THERMAL_OBJECT
  * ========================================================================= */
@@ -1006,7 +1877,9 @@ static const thermal_sensor_vtab_t thermal_sensor_generic_vtab =
     .tsv_get_depends_on_cb = thermal_sensor_generic_get_depends_on_cb,
     .tsv_read_sensor_cb    = thermal_sensor_generic_read_sensor_cb,
     .tsv_get_status_cb     = thermal_sensor_generic_get_status_cb,
-    .tsv_get_poll_delay_cb = thermal_sensor_generic_get_poll_delay_cb
+    .tsv_get_poll_delay_cb = thermal_sensor_generic_get_poll_delay_cb,
+    .tsv_get_limits_cb     = thermal_sensor_generic_get_limits_cb,
+    .tsv_is_filtered_cb    = thermal_sensor_generic_is_filtered_cb,
 };
 
 /** Get sensor object from thermal object
@@ -1105,6 +1978,40 @@ thermal_sensor_generic_get_poll_delay_cb(const thermal_object_t *object,
     return thermal_sensor_generic_get_poll_delay(self, minwait, maxwait);
 }
 
+/** Hook function for getting temperature range of sensor object status
+ *
+ * @param object  thermal object
+ * @param lo      where to store lowest temperature for the status [C]
+ * @param hi      where to store lowest temperature for the next status [C]
+ *
+ * @return true if values were obtained, false otherwise
+ */
+static bool
+thermal_sensor_generic_get_limits_cb(const thermal_object_t *object,
+                                     int *lo, int *hi)
+{
+    thermal_sensor_generic_t *self =
+        thermal_sensor_generic_from_object(object);
+
+    return thermal_sensor_generic_get_limits(self, lo, hi);
+}
+
+/** Hook function for checking if sensor object filters readings
+ *
+ * @param object  thermal object
+ *
+ * @return true if status changes can be accepted immediately,
+ *         false otherwise
+ */
+static bool
+thermal_sensor_generic_is_filtered_cb(const thermal_object_t *object)
+{
+    thermal_sensor_generic_t *self =
+        thermal_sensor_generic_from_object(object);
+
+    return thermal_sensor_generic_is_filtered(self);
+}
+
 /** Idle callback for notifying thermal object
  *
  * @param aptr  thermal object as void pointer
@@ -1156,7 +2063,10 @@ thermal_sensor_generic_read_sensor_cb(thermal_object_t *object)
     thermal_sensor_generic_t *self =
         thermal_sensor_generic_from_object(object);
 
-    if( !thermal_sensor_generic_read_sensor(self) )
+    /* Fan-out re-evaluation must not add samples to the filter */
+    bool resample = !thermal_object_is_reevaluating(object);
+
+    if( !thermal_sensor_generic_read_sensor(self, resample) )
         goto EXIT;
 
 #if 0
@@ -1236,6 +2146,103 @@ tsg_objects_add_sensor(GSList **list, const char *name)
     return thermal_sensor_generic_from_object(object);
 }
 
+/** Count thermal objects in list that match sensor name / group prefix
+ *
+ * @param list  head of linked list
+ * @param self  thermal object to ignore
+ * @param name  sensor name / sensor group name prefix
+ *
+ * @return number of matching thermal objects
+ */
+static int
+tsg_objects_count_like(GSList *list, const thermal_object_t *self,
+                       const char *name)
+{
+    int count = 0;
+
+    for( GSList *item = list; item; item = item->next ) {
+        thermal_object_t *object = item->data;
+
+        if( !object || object == self )
+            continue;
+
+        if( thermal_object_has_name_like(object, name) )
+            ++count;
+    }
+
+    return count;
+}
+
+/** Sort list of thermal objects in dependency order
+ *
+ * Meta sensors are placed after all the sensors they depend on, so
+ * that they can be read already during registration, and thermal
+ * manager can re-evaluate dependency chains after a single read.
+ *
+ * Meta sensors that depend on non-existing sensors or that are part
+ * of a dependency cycle are rejected.
+ *
+ * @param list  pointer to the head of a linked list
+ */
+static void
+tsg_objects_sort_dependencies(GSList **list)
+{
+    GSList *pending  = *list;
+    GSList *sorted   = 0;
+    bool    progress = true;
+
+    *list = 0;
+
+    while( pending && progress ) {
+        progress = false;
+
+        for( GSList *item = pending, *next; item; item = next ) {
+            thermal_object_t *object = item->data;
+            next = item->next;
+
+            /* Wait until all sensors this one depends on are sorted */
+            const char *depends_on = thermal_object_get_depends_on(object);
+
+            if( depends_on ) {
+                if( tsg_objects_count_like(pending, object, depends_on) )
+                    continue;
+
+                if( !tsg_objects_count_like(sorted, object, depends_on) )
+                    continue;
+            }
+
+            pending = g_slist_delete_link(pending, item);
+            sorted  = g_slist_prepend(sorted, object);
+            progress = true;
+        }
+    }
+
+    /* Whatever is left has unresolvable dependencies */
+    for( GSList *item = pending; item; item = item->next ) {
+        thermal_object_t *object = item->data;
+        const char *depends_on = thermal_object_get_depends_on(object);
+
+        if( tsg_objects_count_like(pending, object, depends_on) ||
+            tsg_objects_count_like(sorted, object, depends_on) ) {
+            dsme_log(LOG_ERR, PFIX"%s: %s: %s",
+                     thermal_object_get_name(object),
+                     "unresolvable sensor dependency", depends_on);
+        }
+        else {
+            dsme_log(LOG_ERR, PFIX"%s: %s: %s",
+                     thermal_object_get_name(object),
+                     "depends on unknown sensor", depends_on);
+        }
+    }
+
+    for( GSList *item = pending; item; item = item->next )
+        thermal_object_delete(item->data);
+
+    g_slist_free(pending);
+
+    *list = g_slist_reverse(sorted);
+}
+
 /** Validate and register a list of thermal objects
  *
  * @param list  pointer to the head of a linked list
@@ -1265,7 +2272,7 @@ tsg_objects_register_all(GSList **list)
                      thermal_sensor_generic_get_name(sensor),
                      "sensor could not be enabled");
         }
-        else if( !thermal_sensor_generic_read_sensor(sensor) ) {
+        else if( !thermal_sensor_generic_read_sensor(sensor, true) ) {
             dsme_log(LOG_ERR, PFIX"%s: %s",
                      thermal_sensor_generic_get_name(sensor),
                      "sensor could not be read");
@@ -1350,6 +2357,12 @@ tsg_objects_read_config(GSList **list, const char *config)
             continue;
         }
 
+        /* Global items are handled by tsg_discovery_read_config() */
+        if( !strcmp(key, CONFIG_KW_DISCOVER) ||
+            !strcmp(key, CONFIG_KW_IGNORE) ) {
+            continue;
+        }
+
         /* Parse config entry */
         if( !strcmp(key, CONFIG_KW_NAME) ) {
             // Name: <sensor_name>
@@ -1371,14 +2384,17 @@ tsg_objects_read_config(GSList **list, const char *config)
             if( !strcmp(type, "C") ) {
                 thermal_sensor_generic_set_temp_func(sensor,
                                                      tsg_util_read_temp_C);
+                thermal_sensor_generic_set_temp_scale(sensor, 1);
             }
             else if( !strcmp(type, "dC") ) {
                 thermal_sensor_generic_set_temp_func(sensor,
                                                      tsg_util_read_temp_dC);
+                thermal_sensor_generic_set_temp_scale(sensor, 10);
             }
             else if( !strcmp(type, "mC") ) {
                 thermal_sensor_generic_set_temp_func(sensor,
                                                      tsg_util_read_temp_mC);
+                thermal_sensor_generic_set_temp_scale(sensor, 1000);
             }
             else {
                 dsme_log(LOG_ERR, PFIX"%s:%d: unknown/missing temp type: %s",
@@ -1401,6 +2417,38 @@ tsg_objects_read_config(GSList **list, const char *config)
             thermal_sensor_generic_set_mode_control(sensor,
                                                     path, enable, disable);
         }
+        else if( !strcmp(key, CONFIG_KW_TRIP) ) {
+            // Trip: <trip_temp_path> [trip_temp_path]...
+            for( ;; ) {
+                char *path = tsg_util_slice_str(&pos);
+                if( *path == 0 || *path == '#' )
+                    break;
+                thermal_sensor_generic_add_trip_path(sensor, path);
+            }
+        }
+        else if( !strcmp(key, CONFIG_KW_FILTER) ) {
+            // Filter: <median|ema> <samples>
+            char *type = tsg_util_slice_str(&pos);
+            int   len  = tsg_util_slice_int(&pos);
+
+            if( !strcmp(type, "median") ) {
+                thermal_sensor_generic_set_filter(sensor, TSG_FILTER_MEDIAN,
+                                                  len);
+            }
+            else if( !strcmp(type, "ema") ) {
+                thermal_sensor_generic_set_filter(sensor, TSG_FILTER_EMA,
+                                                  len);
+            }
+            else {
+                dsme_log(LOG_ERR, PFIX"%s:%d: unknown filter type: %s",
+                         config, line, type);
+            }
+        }
+        else if( !strcmp(key, CONFIG_KW_HYSTERESIS) ) {
+            // Hysteresis: <degrees>
+            thermal_sensor_generic_set_hysteresis(sensor,
+                                                  tsg_util_slice_int(&pos));
+        }
         else if( (rc = tsg_objects_parse_level(key)) != -1 ) {
             // Low|Normal|...|Fatal|Invalid: <mintemp> <minwait> <maxwait>
             int mintemp = tsg_util_slice_int(&pos);
@@ -1448,9 +2496,13 @@ tsg_objects_quit(GSList **list)
 
     g_slist_free(*list), *list = 0;
 
+    tsg_uevent_quit();
 }
 
 /** Create linked list of thermal objects based on config files
+ *
+ * Sensors found via sysfs discovery are added first, so that
+ * config files can override their settings.
  *
  * @param list    head of linked list
  */
@@ -1463,26 +2515,853 @@ tsg_objects_init(GSList **list)
 
     if( glob(pat, GLOB_ERR, 0, &gl) != 0 ) {
         dsme_log(LOG_WARNING, PFIX"No thermal config files found");
-        goto EXIT;
+        tsg_discovery_init(list, 0);
     }
+    else {
+        tsg_discovery_init(list, gl.gl_pathv);
 
-    for( int i = 0; i < gl.gl_pathc; ++i )
-        tsg_objects_read_config(list, gl.gl_pathv[i]);
+        for( int i = 0; i < gl.gl_pathc; ++i )
+            tsg_objects_read_config(list, gl.gl_pathv[i]);
+    }
 
     *list = g_slist_reverse(*list);
 
+    tsg_discovery_prune(list);
+    tsg_objects_sort_dependencies(list);
+
+    /* Start listening to thermal uevents if trip points are used */
+    for( GSList *item = *list; item; item = item->next ) {
+        thermal_sensor_generic_t *sensor =
+            thermal_sensor_generic_from_object(item->data);
+
+        if( sensor && sensor->sg_trip_count > 0 ) {
+            tsg_uevent_init();
+            break;
+        }
+    }
+
     tsg_objects_register_all(list);
 
-EXIT:
     globfree(&gl);
 }
 
 /* ========================================================================= *
- * DSME_PLUGIN_GLUE
+ * THERMAL_DISCOVERY
  * ========================================================================= */
 
-/** Linked list of thermal objects created by this module */
-static GSList *objects_list = 0;
+/** Read millidegree temperature file
+ *
+ * @param path  file path
+ *
+ * @return temperature in degrees C, or INVALID_TEMPERATURE
+ */
+static int
+tsg_discovery_read_mC(const char *path)
+{
+    int temp = INVALID_TEMPERATURE;
+    int fd   = -1;
+
+    if( !tsg_util_read_temp_mC(path, &fd, &temp) )
+        temp = INVALID_TEMPERATURE;
+
+    if( fd != -1 )
+        TEMP_FAILURE_RETRY(close(fd));
+
+    return temp;
+}
+
+/** Get critical trip point temperature of a thermal zone
+ *
+ * @param zone  thermal zone directory
+ *
+ * @return temperature in degrees C, or INVALID_TEMPERATURE
+ */
+static int
+tsg_discovery_zone_crit(const char *zone)
+{
+    int crit = INVALID_TEMPERATURE;
+
+    for( int i = 0; crit == INVALID_TEMPERATURE; ++i ) {
+        char  path[PATH_MAX];
+        snprintf(path, sizeof path, "%s/trip_point_%d_type", zone, i);
+
+        char *type = tsg_util_read_file(path);
+        if( !type )
+            break;
+
+        if( !strncmp(type, "critical", 8) ) {
+            snprintf(path, sizeof path, "%s/trip_point_%d_temp", zone, i);
+            crit = tsg_discovery_read_mC(path);
+        }
+
+        free(type);
+    }
+
+    return crit;
+}
+
+/** Read single word attribute file
+ *
+ * @param dir   sysfs directory
+ * @param attr  attribute file name
+ *
+ * @return attribute value without trailing white space, or NULL
+ */
+static char *
+tsg_discovery_read_attr(const char *dir, const char *attr)
+{
+    char  path[PATH_MAX];
+    snprintf(path, sizeof path, "%s/%s", dir, attr);
+
+    char *text = tsg_util_read_file(path);
+    if( text )
+        text[strcspn(text, " \t\r\n")] = 0;
+
+    return text;
+}
+
+/** Handle Discover and Ignore items from a configuration file
+ *
+ * These are global settings that are needed before the sensor
+ * configuration proper is parsed.
+ *
+ * @param self    discovery state
+ * @param config  path to configuration file
+ */
+static void
+tsg_discovery_read_config(tsg_discovery_t *self, const char *config)
+{
+    char   *buff = 0;
+    size_t  size = 0;
+    FILE   *file = 0;
+
+    file = fopen(config, "r");
+    if( !file )
+        goto EXIT;
+
+    for( int line = 1; getline(&buff, &size, file) >= 0; ++line ) {
+        char *pos = buff;
+        char *key = tsg_util_slice_key(&pos);
+
+        if( !strcmp(key, CONFIG_KW_DISCOVER) ) {
+            // Discover: <yes|no>
+            char *val = tsg_util_slice_str(&pos);
+
+            if( !strcmp(val, "yes") )
+                self->ds_enabled = true;
+            else if( !strcmp(val, "no") )
+                self->ds_enabled = false;
+            else
+                dsme_log(LOG_ERR, PFIX"%s:%d: invalid discover value: %s",
+                         config, line, val);
+        }
+        else if( !strcmp(key, CONFIG_KW_IGNORE) ) {
+            // Ignore: <sensor_name_pattern> [sensor_name_pattern]...
+            for( ;; ) {
+                char *pat = tsg_util_slice_str(&pos);
+                if( *pat == 0 || *pat == '#' )
+                    break;
+                self->ds_ignore = g_slist_prepend(self->ds_ignore,
+                                                  g_strdup(pat));
+            }
+        }
+    }
+
+EXIT:
+    free(buff);
+
+    if( file ) fclose(file);
+}
+
+/** Check if discovered sensor has been configured to be ignored
+ *
+ * @param self  discovery state
+ * @param name  sensor name
+ *
+ * @return true if sensor should be left out, false otherwise
+ */
+static bool
+tsg_discovery_is_ignored(const tsg_discovery_t *self, const char *name)
+{
+    for( GSList *item = self->ds_ignore; item; item = item->next ) {
+        if( !fnmatch(item->data, name, 0) )
+            return true;
+    }
+    return false;
+}
+
+/** Make sensor identity that is unique within the current scan
+ *
+ * Sysfs device indices follow probe order, which can change from
+ * one boot to another. The identity is derived from properties of
+ * the device instead, with a sequence number appended only if some
+ * other device has already used the same identity.
+ *
+ * @param self  discovery state
+ * @param base  identity derived from device properties
+ *
+ * @return identity string, to be released with g_free()
+ */
+static gchar *
+tsg_discovery_make_identity(const tsg_discovery_t *self, const char *base)
+{
+    gchar *identity = g_strdup(base);
+
+    for( int i = 2; g_hash_table_lookup_extended(self->ds_found, identity,
+                                                 0, 0); ++i ) {
+        g_free(identity);
+        identity = g_strdup_printf("%s#%d", base, i);
+    }
+
+    return identity;
+}
+
+/** Get critical temperature of a sensor, preferring cached value
+ *
+ * @param self       discovery state
+ * @param base       identity derived from device properties
+ * @param read_crit  function for reading critical temperature from sysfs
+ * @param path       argument to pass to read_crit
+ *
+ * @return temperature in degrees C, or INVALID_TEMPERATURE
+ */
+static int
+tsg_discovery_get_crit(tsg_discovery_t *self, const char *base,
+                       int (*read_crit)(const char *), const char *path)
+{
+    gchar   *identity = tsg_discovery_make_identity(self, base);
+    gpointer cached   = 0;
+    int      crit;
+
+    if( self->ds_cached &&
+        g_hash_table_lookup_extended(self->ds_cached, identity, 0, &cached) )
+        crit = GPOINTER_TO_INT(cached);
+    else
+        crit = read_crit(path);
+
+    /* Table takes ownership of the identity string */
+    g_hash_table_replace(self->ds_found, identity, GINT_TO_POINTER(crit));
+
+    return crit;
+}
+
+/** Add sensor with default limits to list of thermal objects
+ *
+ * The limits are placed below the critical temperature, so that
+ * dsme can make an orderly shutdown before the kernel forces one.
+ * No temperature maps to low status.
+ *
+ * @param self  discovery state
+ * @param list  pointer to the head of linked list
+ * @param name  sensor name
+ * @param path  millidegree temperature file
+ * @param crit  critical temperature [C], or INVALID_TEMPERATURE
+ */
+static void
+tsg_discovery_add_sensor(tsg_discovery_t *self, GSList **list,
+                         const char *name, const char *path, int crit)
+{
+    if( tsg_discovery_is_ignored(self, name) ) {
+        dsme_log(LOG_DEBUG, PFIX"%s: discovered at %s, ignored",
+                 name, path);
+        goto EXIT;
+    }
+
+    if( crit < TSG_DISCOVERY_MIN_CRIT || crit > TSG_DISCOVERY_MAX_CRIT )
+        crit = TSG_DISCOVERY_DEFAULT_CRIT;
+
+    thermal_sensor_generic_t *sensor = tsg_objects_add_sensor(list, name);
+
+    thermal_sensor_generic_set_temp_path(sensor, path);
+    thermal_sensor_generic_set_temp_func(sensor, tsg_util_read_temp_mC);
+    thermal_sensor_generic_set_temp_scale(sensor, 1000);
+
+    thermal_sensor_generic_set_limit(sensor, THERMAL_STATUS_LOW,
+                                     -40, 60, 120);
+    thermal_sensor_generic_set_limit(sensor, THERMAL_STATUS_NORMAL,
+                                     -40, 60, 120);
+    thermal_sensor_generic_set_limit(sensor, THERMAL_STATUS_WARNING,
+                                     crit - 20, 30, 60);
+    thermal_sensor_generic_set_limit(sensor, THERMAL_STATUS_ALERT,
+                                     crit - 10, 5, 10);
+    thermal_sensor_generic_set_limit(sensor, THERMAL_STATUS_FATAL,
+                                     crit - 5, 5, 10);
+    thermal_sensor_generic_set_limit(sensor, THERMAL_STATUS_INVALID,
+                                     200, 60, 120);
+
+    sensor->sg_is_discovered = true;
+
+    dsme_log(LOG_DEBUG, PFIX"%s: discovered at %s, critical=%d",
+             name, path, crit);
+
+EXIT:
+    return;
+}
+
+/** Add sensors for all thermal zones
+ *
+ * The sensors are named after the zones, e.g. "thermal_zone3", so
+ * that "thermal_zone" can be used to refer to all of them. The zone
+ * type together with the underlying device path is used as identity
+ * in the cache.
+ *
+ * @param self  discovery state
+ * @param list  pointer to the head of linked list
+ */
+static void
+tsg_discovery_scan_zones(tsg_discovery_t *self, GSList **list)
+{
+    static const char pat[] = "/sys/class/thermal/thermal_zone*";
+
+    glob_t gl = {};
+
+    if( glob(pat, 0, 0, &gl) != 0 )
+        goto EXIT;
+
+    for( size_t i = 0; i < gl.gl_pathc; ++i ) {
+        const char *zone = gl.gl_pathv[i];
+        char        path[PATH_MAX];
+
+        snprintf(path, sizeof path, "%s/temp", zone);
+        if( access(path, R_OK) == -1 )
+            continue;
+
+        /* Zones of the same type are told apart by the underlying
+         * device, if they have one */
+        snprintf(path, sizeof path, "%s/device", zone);
+        char *device = realpath(path, 0);
+
+        char  *type = tsg_discovery_read_attr(zone, "type");
+        gchar *base = g_strdup_printf("zone:%s:%s", type ?: "unknown",
+                                      device ?: "none");
+        int    crit = tsg_discovery_get_crit(self, base,
+                                             tsg_discovery_zone_crit, zone);
+
+        snprintf(path, sizeof path, "%s/temp", zone);
+        tsg_discovery_add_sensor(self, list, strrchr(zone, '/') + 1, path,
+                                 crit);
+        g_free(base);
+        free(type);
+        free(device);
+    }
+
+EXIT:
+    globfree(&gl);
+}
+
+/** Add sensors for all hwmon temperature inputs
+ *
+ * The sensors are named like "hwmon2:temp1". Hwmon devices that just
+ * mirror a thermal zone are skipped. The hwmon device name together
+ * with the underlying device path and input name is used as identity
+ * in the cache.
+ *
+ * @param self  discovery state
+ * @param list  pointer to the head of linked list
+ */
+static void
+tsg_discovery_scan_hwmon(tsg_discovery_t *self, GSList **list)
+{
+    static const char pat[] = "/sys/class/hwmon/hwmon*/temp*_input";
+
+    glob_t gl = {};
+
+    if( glob(pat, 0, 0, &gl) != 0 )
+        goto EXIT;
+
+    for( size_t i = 0; i < gl.gl_pathc; ++i ) {
+        char *input  = gl.gl_pathv[i];
+        char *slash  = strrchr(input, '/');
+        char *device = 0;
+        char *hwname = 0;
+        char  path[PATH_MAX];
+        char  name[64];
+
+        /* Split "/sys/class/hwmon/hwmonN/tempK_input" */
+        *slash = 0;
+
+        snprintf(path, sizeof path, "%s/device", input);
+        device = realpath(path, 0);
+        if( device && !strncmp(basename(device), "thermal_zone", 12) )
+            goto NEXT;
+
+        hwname = tsg_discovery_read_attr(input, "name");
+
+        int len = strlen(slash + 1) - strlen("_input");
+        snprintf(name, sizeof name, "%s:%.*s",
+                 strrchr(input, '/') + 1, len, slash + 1);
+
+        gchar *base = g_strdup_printf("hwmon:%s:%s:%.*s",
+                                      hwname ?: "unknown",
+                                      device ?: "none",
+                                      len, slash + 1);
+
+        snprintf(path, sizeof path, "%s/%.*s_crit", input, len, slash + 1);
+        int crit = tsg_discovery_get_crit(self, base,
+                                          tsg_discovery_read_mC, path);
+        g_free(base);
+
+        snprintf(path, sizeof path, "%s/%s", input, slash + 1);
+        tsg_discovery_add_sensor(self, list, name, path, crit);
+
+    NEXT:
+        free(hwname);
+        free(device);
+        *slash = '/';
+    }
+
+EXIT:
+    globfree(&gl);
+}
+
+/** Load critical temperatures from cache file
+ *
+ * The cache is used only if it was written while running the
+ * same kernel version. Each line holds critical temperature
+ * followed by identity of the sensor.
+ *
+ * @param self    discovery state
+ * @param kernel  kernel release string
+ */
+static void
+tsg_discovery_load_cache(tsg_discovery_t *self, const char *kernel)
+{
+    char   *buff = 0;
+    size_t  size = 0;
+    FILE   *file = fopen(TSG_DISCOVERY_CACHE_PATH, "r");
+
+    if( !file )
+        goto EXIT;
+
+    size_t len = strlen(TSG_DISCOVERY_CACHE_HEADER);
+    if( getline(&buff, &size, file) < 0 ||
+        strncmp(buff, TSG_DISCOVERY_CACHE_HEADER, len) )
+        goto EXIT;
+
+    buff[strcspn(buff, "\n")] = 0;
+    if( strcmp(buff + len, kernel) )
+        goto EXIT;
+
+    self->ds_cached = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, 0);
+
+    while( getline(&buff, &size, file) >= 0 ) {
+        char *pos      = buff;
+        int   crit     = tsg_util_slice_int(&pos);
+        char *identity = tsg_util_slice_str(&pos);
+
+        if( *identity )
+            g_hash_table_replace(self->ds_cached, g_strdup(identity),
+                                 GINT_TO_POINTER(crit));
+    }
+
+EXIT:
+    free(buff);
+
+    if( file ) fclose(file);
+}
+
+/** Check whether the cache file needs to be rewritten
+ *
+ * @param self  discovery state
+ *
+ * @return true if scan found sensors not in the cache or vice versa
+ */
+static bool
+tsg_discovery_cache_is_stale(const tsg_discovery_t *self)
+{
+    if( !self->ds_cached )
+        return true;
+
+    if( g_hash_table_size(self->ds_cached) !=
+        g_hash_table_size(self->ds_found) )
+        return true;
+
+    GHashTableIter iter;
+    gpointer       key;
+
+    g_hash_table_iter_init(&iter, self->ds_found);
+    while( g_hash_table_iter_next(&iter, &key, 0) ) {
+        if( !g_hash_table_lookup_extended(self->ds_cached, key, 0, 0) )
+            return true;
+    }
+
+    return false;
+}
+
+/** Write critical temperatures to cache file
+ *
+ * @param self    discovery state
+ * @param kernel  kernel release string
+ */
+static void
+tsg_discovery_save_cache(const tsg_discovery_t *self, const char *kernel)
+{
+    bool  ack  = false;
+    FILE *file = fopen(TSG_DISCOVERY_CACHE_TEMP, "w");
+
+    if( !file )
+        goto EXIT;
+
+    fprintf(file, "%s%s\n", TSG_DISCOVERY_CACHE_HEADER, kernel);
+
+    GHashTableIter iter;
+    gpointer       key, val;
+
+    g_hash_table_iter_init(&iter, self->ds_found);
+    while( g_hash_table_iter_next(&iter, &key, &val) )
+        fprintf(file, "%d %s\n", GPOINTER_TO_INT(val), (char *)key);
+
+    if( ferror(file) )
+        goto EXIT;
+
+    if( fclose(file) != 0 ) {
+        file = 0;
+        goto EXIT;
+    }
+
+    file = 0;
+
+    if( rename(TSG_DISCOVERY_CACHE_TEMP, TSG_DISCOVERY_CACHE_PATH) == -1 )
+        goto EXIT;
+
+    ack = true;
+
+EXIT:
+    if( file )
+        fclose(file);
+
+    if( !ack ) {
+        dsme_log(LOG_WARNING, PFIX"%s: could not write cache: %m",
+                 TSG_DISCOVERY_CACHE_PATH);
+        unlink(TSG_DISCOVERY_CACHE_TEMP);
+    }
+}
+
+/** Add thermal objects for sensors available in sysfs
+ *
+ * Discovery is done by default only when there are no configuration
+ * files, but can be enabled / disabled via "Discover" config item.
+ *
+ * Thermal zones and hwmon temperature inputs are enumerated on every
+ * startup, so that the sensor paths are always valid. The critical
+ * temperatures are cached by sensor identity and read from sysfs
+ * only for sensors not seen before with the same kernel version.
+ *
+ * @param list     pointer to the head of linked list
+ * @param configs  NULL terminated array of config file paths, or NULL
+ */
+static void
+tsg_discovery_init(GSList **list, char **configs)
+{
+    tsg_discovery_t self =
+    {
+        .ds_enabled = !configs || !*configs,
+        .ds_ignore  = 0,
+        .ds_cached  = 0,
+        .ds_found   = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, 0),
+    };
+
+    for( size_t i = 0; configs && configs[i]; ++i )
+        tsg_discovery_read_config(&self, configs[i]);
+
+    if( !self.ds_enabled )
+        goto EXIT;
+
+    struct utsname un;
+
+    if( uname(&un) == -1 )
+        snprintf(un.release, sizeof un.release, "unknown");
+
+    tsg_discovery_load_cache(&self, un.release);
+
+    tsg_discovery_scan_zones(&self, list);
+    tsg_discovery_scan_hwmon(&self, list);
+
+    dsme_log(LOG_DEBUG, PFIX"discovered %u sensors",
+             g_hash_table_size(self.ds_found));
+
+    if( tsg_discovery_cache_is_stale(&self) )
+        tsg_discovery_save_cache(&self, un.release);
+
+EXIT:
+    g_slist_free_full(self.ds_ignore, g_free);
+
+    if( self.ds_cached )
+        g_hash_table_unref(self.ds_cached);
+
+    g_hash_table_unref(self.ds_found);
+}
+
+/** Remove discovered sensors that are also configured explicitly
+ *
+ * If a config file defines a sensor with different name, but using
+ * the same temperature file as a discovered sensor, the discovered
+ * one is dropped.
+ *
+ * @param list  pointer to the head of linked list
+ */
+static void
+tsg_discovery_prune(GSList **list)
+{
+    for( GSList *item = *list, *next; item; item = next ) {
+        thermal_sensor_generic_t *sensor =
+            thermal_sensor_generic_from_object(item->data);
+        next = item->next;
+
+        if( !sensor || !sensor->sg_is_discovered )
+            continue;
+
+        char *have = realpath(sensor->sg_temp_path, 0);
+
+        for( GSList *iter = *list; have && iter; iter = iter->next ) {
+            thermal_sensor_generic_t *other =
+                thermal_sensor_generic_from_object(iter->data);
+
+            if( !other || other == sensor || other->sg_is_discovered )
+                continue;
+
+            if( other->sg_is_meta || !other->sg_temp_path )
+                continue;
+
+            char *want = realpath(other->sg_temp_path, 0);
+            bool  same = want && !strcmp(have, want);
+            free(want);
+
+            if( !same )
+                continue;
+
+            dsme_log(LOG_DEBUG, PFIX"%s: replaced by configured sensor %s",
+                     sensor->sg_name, other->sg_name);
+
+            thermal_object_delete(item->data);
+            *list = g_slist_delete_link(*list, item);
+            break;
+        }
+
+        free(have);
+    }
+}
+
+/* ========================================================================= *
+ * THERMAL_UEVENTS
+ * ========================================================================= */
+
+/** Linked list of thermal objects created by this module */
+static GSList *objects_list = 0;
+
+/** Netlink socket for receiving kernel uevents */
+static int   tsg_uevent_fd = -1;
+
+/** I/O watch for tsg_uevent_fd */
+static guint tsg_uevent_watch_id = 0;
+
+/** Handle kernel uevent message
+ *
+ * Thermal zone change events cause sensors that have trip points
+ * in the zone to be re-evaluated.
+ *
+ * @param msg  uevent data: "action@devpath" followed by "KEY=value"
+ *             strings, all nul terminated
+ * @param len  length of msg
+ */
+static void
+tsg_uevent_handle_message(char *msg, size_t len)
+{
+    const char *subsystem = 0;
+    const char *devpath   = 0;
+
+    for( size_t pos = 0; pos < len; pos += strlen(msg + pos) + 1 ) {
+        const char *item = msg + pos;
+
+        if( !strncmp(item, "SUBSYSTEM=", 10) )
+            subsystem = item + 10;
+        else if( !strncmp(item, "DEVPATH=", 8) )
+            devpath = item + 8;
+    }
+
+    if( !subsystem || !devpath || strcmp(subsystem, "thermal") )
+        goto EXIT;
+
+    const char *zone = strrchr(devpath, '/');
+    zone = zone ? zone + 1 : devpath;
+
+    for( GSList *item = objects_list; item; item = item->next ) {
+        thermal_object_t *object = item->data;
+
+        thermal_sensor_generic_t *sensor =
+            thermal_sensor_generic_from_object(object);
+
+        if( !thermal_sensor_generic_has_zone(sensor, zone) )
+            continue;
+
+        dsme_log(LOG_DEBUG, PFIX"%s: %s event",
+                 thermal_sensor_generic_get_name(sensor), zone);
+
+        /* Polling can be relaxed once the kernel has shown that
+         * it does report trip crossings for this zone */
+        if( !sensor->sg_trip_events ) {
+            dsme_log(LOG_INFO, PFIX"%s: %s reports trip crossings",
+                     thermal_sensor_generic_get_name(sensor), zone);
+            sensor->sg_trip_events = true;
+        }
+
+        thermal_object_request_update(object);
+    }
+
+EXIT:
+    return;
+}
+
+/** Request update of all sensors that use trip point uevents
+ */
+static void
+tsg_uevent_request_all(void)
+{
+    for( GSList *item = objects_list; item; item = item->next ) {
+        thermal_sensor_generic_t *sensor =
+            thermal_sensor_generic_from_object(item->data);
+
+        if( sensor && sensor->sg_trip_ok )
+            thermal_object_request_update(item->data);
+    }
+}
+
+/** I/O watch callback for kernel uevent socket
+ *
+ * @param chan  (unused) glib io channel
+ * @param cnd   reason for calling the callback
+ * @param aptr  (unused) user data pointer
+ *
+ * @return TRUE to keep the watch active, or FALSE to remove it
+ */
+static gboolean
+tsg_uevent_input_cb(GIOChannel *chan, GIOCondition cnd, gpointer aptr)
+{
+    (void)chan;
+    (void)aptr;
+
+    gboolean keep_going = FALSE;
+    char     msg[4096];
+
+    if( cnd & ~G_IO_IN )
+        goto EXIT;
+
+    ssize_t rc = recv(tsg_uevent_fd, msg, sizeof msg - 1, MSG_DONTWAIT);
+
+    if( rc < 0 ) {
+        if( errno == ENOBUFS ) {
+            /* Socket buffer overflowed and some uevents were lost,
+             * re-evaluate all sensors that depend on them */
+            dsme_log(LOG_WARNING, PFIX"uevent socket: %m");
+            tsg_uevent_request_all();
+            keep_going = TRUE;
+        }
+        else if( errno == EAGAIN || errno == EINTR )
+            keep_going = TRUE;
+        else
+            dsme_log(LOG_ERR, PFIX"uevent socket: %m");
+        goto EXIT;
+    }
+
+    msg[rc] = 0;
+    tsg_uevent_handle_message(msg, rc);
+
+    keep_going = TRUE;
+
+EXIT:
+    if( !keep_going ) {
+        dsme_log(LOG_WARNING, PFIX"uevent watch disabled; using polling");
+        tsg_uevent_watch_id = 0;
+        tsg_uevent_quit();
+
+        /* Reschedule polls using regular poll delays */
+        tsg_uevent_request_all();
+    }
+
+    return keep_going;
+}
+
+/** Check if kernel uevents are being listened to
+ *
+ * @return true if uevent socket is open, false otherwise
+ */
+static bool
+tsg_uevent_is_active(void)
+{
+    return tsg_uevent_watch_id != 0;
+}
+
+/** Start listening to kernel uevents
+ *
+ * @return true on success, false otherwise
+ */
+static bool
+tsg_uevent_init(void)
+{
+    GIOChannel *chan = 0;
+
+    if( tsg_uevent_is_active() )
+        goto EXIT;
+
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_pid    = 0,
+        .nl_groups = 1,
+    };
+
+    tsg_uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                           NETLINK_KOBJECT_UEVENT);
+    if( tsg_uevent_fd == -1 ) {
+        dsme_log(LOG_ERR, PFIX"uevent socket: %m");
+        goto EXIT;
+    }
+
+    if( bind(tsg_uevent_fd, (struct sockaddr *)&addr, sizeof addr) == -1 ) {
+        dsme_log(LOG_ERR, PFIX"uevent bind: %m");
+        goto EXIT;
+    }
+
+    if( !(chan = g_io_channel_unix_new(tsg_uevent_fd)) )
+        goto EXIT;
+
+    tsg_uevent_watch_id = g_io_add_watch(chan,
+                                         G_IO_IN | G_IO_ERR |
+                                         G_IO_HUP | G_IO_NVAL,
+                                         tsg_uevent_input_cb, 0);
+
+    dsme_log(LOG_DEBUG, PFIX"listening to thermal uevents");
+
+EXIT:
+    if( chan )
+        g_io_channel_unref(chan);
+
+    if( !tsg_uevent_is_active() )
+        tsg_uevent_quit();
+
+    return tsg_uevent_is_active();
+}
+
+/** Stop listening to kernel uevents
+ */
+static void
+tsg_uevent_quit(void)
+{
+    if( tsg_uevent_watch_id ) {
+        g_source_remove(tsg_uevent_watch_id),
+            tsg_uevent_watch_id = 0;
+    }
+
+    if( tsg_uevent_fd != -1 ) {
+        TEMP_FAILURE_RETRY(close(tsg_uevent_fd)),
+            tsg_uevent_fd = -1;
+    }
+}
+
+/* ========================================================================= *
+ * DSME_PLUGIN_GLUE
+ * ========================================================================= */
 
 /** Handler for connected to D-Bus system bus event
  *
@@ -0,0 +1,800 @@
+/**
+   @file iphbsim.c
+
+   Offline simulator for the iphb client scheduling logic.
+   <p>
+   Replays a trace of client wait requests against the iphb module
+   using a virtual clock, and reports how many wakeups, rtc alarm
+   reprogrammings and resumes from suspend the scheduling caused.
+   <p>
+   Trace files consist of lines in format:
+   <pre>
+   # time  client  mintime  maxtime  [resume] [repeat]
+   0       email   240      300      resume repeat
+   15      chat    30       60       repeat
+   </pre>
+   where time is the seconds since start of simulation when the
+   request is made, mintime and maxtime are the requested wakeup
+   range in seconds, "resume" means the client wants to be woken up
+   also from suspend and "repeat" means the client makes the same
+   request again after each wakeup.
+   <p>
+   The device is assumed to suspend whenever no wakelocks are held
+   and no client is busy handling a wakeup. Glib timers are run on
+   a clock that does not advance during suspend, while iphb itself
+   uses a clock that does - like CLOCK_MONOTONIC and CLOCK_BOOTTIME.
+   <p>
+   Copyright (C) 2015 Jolla Ltd.
+
+   This file is part of Dsme.
+
+   Dsme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Dsme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Dsme.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* INTRUSIONS */
+
+#include "../modules/iphb.c"
+
+/* INCLUDES */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+/* ========================================================================= *
+ * STUBS
+ * ========================================================================= */
+
+const module_t *current_module(void)           { return 0; }
+const char     *module_name(const module_t *m) { (void)m; return "iphb"; }
+const char     *current_module_name(void)      { return 0; }
+uint32_t        current_message_type(void)     { return 0; }
+pid_t           current_sender_pid(void)       { return 0; }
+
+endpoint_t *endpoint_copy(const endpoint_t *endpoint) { (void)endpoint; return 0; }
+void endpoint_free(endpoint_t *endpoint)               { (void)endpoint; }
+unsigned endpoint_hash(const endpoint_t *endpoint)    { (void)endpoint; return 0; }
+
+bool endpoint_same(const endpoint_t *a, const endpoint_t *b)
+{
+    return a == b;
+}
+
+void endpoint_send(endpoint_t *recipient, const void *msg)
+{
+    (void)recipient; (void)msg;
+}
+
+void endpoint_send_with_extra(endpoint_t *recipient, const void *msg,
+                              size_t extra_size, const void *extra)
+{
+    (void)recipient; (void)msg; (void)extra_size; (void)extra;
+}
+
+DBusConnection *dsme_dbus_get_connection(DBusError *err)
+{
+    (void)err;
+    return 0;
+}
+
+void dsme_dbus_bind_methods(bool *bound_already,
+                            const dsme_dbus_binding_t *bindings,
+                            const char *service, const char *interface)
+{
+    (void)bindings; (void)service; (void)interface;
+    *bound_already = true;
+}
+
+void dsme_dbus_unbind_methods(bool *really_bound,
+                              const dsme_dbus_binding_t *bindings,
+                              const char *service, const char *interface)
+{
+    (void)bindings; (void)service; (void)interface;
+    *really_bound = false;
+}
+
+void dsme_dbus_bind_signals(bool *bound_already,
+                            const dsme_dbus_signal_binding_t *bindings)
+{
+    (void)bindings;
+    *bound_already = true;
+}
+
+void dsme_dbus_unbind_signals(bool *really_bound,
+                              const dsme_dbus_signal_binding_t *bindings)
+{
+    (void)bindings;
+    *really_bound = false;
+}
+
+DsmeDbusMessage *dsme_dbus_reply_new(const DsmeDbusMessage *request)
+{
+    (void)request;
+    return 0;
+}
+
+void dsme_dbus_message_append_string(DsmeDbusMessage *msg, const char *s)
+{
+    (void)msg; (void)s;
+}
+
+int dsme_dbus_message_get_int(const DsmeDbusMessage *msg)
+{
+    (void)msg;
+    return 0;
+}
+
+/* ========================================================================= *
+ * VIRTUAL_ENVIRONMENT
+ * ========================================================================= */
+
+#define SIM_NEVER            INT64_MAX
+#define SIM_MAX_TIMERS       16
+#define SIM_MAX_WAKELOCKS    16
+#define SIM_MAX_CLIENTS      64
+#define SIM_FD_BASE          10000
+
+/** Boot clock at start of simulation [ms]; iphb treats zero
+ *  timestamps as "not set", so start from a realistic uptime */
+#define SIM_START            (60 * 1000)
+
+/** Simulated client state */
+typedef struct {
+    char     *name;
+    client_t *client;  /* iphb client object */
+    int       mintime; /* request parameters for repeats */
+    int       maxtime;
+    bool      resume;
+    bool      repeat;
+    int64_t   rearm;   /* when to repeat the request [ms], or SIM_NEVER */
+} sim_client_t;
+
+/** Trace entry */
+typedef struct {
+    int64_t       when;   /* request time [ms] */
+    sim_client_t *client;
+} sim_request_t;
+
+/** Glib timer replacement */
+typedef struct {
+    guint       id;
+    guint       interval; /* [ms] */
+    int64_t     due;      /* on awake clock [ms] */
+    GSourceFunc cb;
+    gpointer    aptr;
+} sim_timer_t;
+
+/** Wakelock replacement */
+typedef struct {
+    const char *name;
+    int64_t     expires;  /* on boot clock [ms], or SIM_NEVER */
+} sim_wakelock_t;
+
+/** Simulation results */
+typedef struct {
+    unsigned wakeups;          /* wakeups delivered to clients */
+    unsigned resume_wakeups;   /* wakeups delivered to resume clients */
+    unsigned wakeup_passes;    /* distinct instants clients were woken */
+    unsigned rtc_programs;     /* rtc alarm reprogrammings */
+    unsigned rtc_resumes;      /* resumes from suspend via rtc alarm */
+    unsigned other_resumes;    /* resumes from suspend via client activity */
+    unsigned late;             /* resume wakeups delivered after maxtime */
+    int64_t  lateness;         /* total lateness [ms] */
+    int64_t  lateness_max;     /* largest lateness [ms] */
+    int64_t  suspended;        /* time spent in suspend [ms] */
+} sim_stats_t;
+
+static int64_t         sim_boot    = SIM_START;/* CLOCK_BOOTTIME [ms] */
+static int64_t         sim_awake   = 0;        /* CLOCK_MONOTONIC [ms] */
+static int64_t         sim_busy    = 0;        /* client busy until [ms] */
+static int64_t         sim_rtc     = SIM_NEVER;/* rtc alarm due [ms] */
+static int64_t         sim_hbeat   = 0;        /* next heartbeat, awake clock */
+static int64_t         sim_last_wakeup = -1;   /* time of last client wakeup */
+static int             sim_busy_ms = 500;      /* client processing time */
+static bool            sim_timerfd = false;    /* alarms via timerfd, not rtc */
+
+static sim_timer_t     sim_timer[SIM_MAX_TIMERS];
+static guint           sim_timer_id = 0;
+static sim_wakelock_t  sim_wakelock[SIM_MAX_WAKELOCKS];
+
+static sim_client_t    sim_client[SIM_MAX_CLIENTS];
+static int             sim_clients = 0;
+static sim_request_t  *sim_request = 0;
+static int             sim_requests = 0;
+static int             sim_requests_done = 0;
+
+static sim_stats_t     sim_stats;
+
+static bool sim_get_time(struct timeval *tv)
+{
+    tv->tv_sec  = sim_boot / 1000;
+    tv->tv_usec = sim_boot % 1000 * 1000;
+    return true;
+}
+
+static guint sim_timer_add(guint ms, GSourceFunc cb, gpointer aptr)
+{
+    for( int i = 0; i < SIM_MAX_TIMERS; ++i ) {
+        if( sim_timer[i].id )
+            continue;
+        sim_timer[i].id       = ++sim_timer_id;
+        sim_timer[i].interval = ms;
+        sim_timer[i].due      = sim_awake + ms;
+        sim_timer[i].cb       = cb;
+        sim_timer[i].aptr     = aptr;
+        return sim_timer[i].id;
+    }
+    fprintf(stderr, "iphbsim: out of timers\n");
+    abort();
+}
+
+static gboolean sim_timer_remove(guint id)
+{
+    for( int i = 0; i < SIM_MAX_TIMERS; ++i ) {
+        if( sim_timer[i].id == id ) {
+            sim_timer[i].id = 0;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void sim_wakelock_lock(const char *name, int ms)
+{
+    int64_t expires = (ms < 0) ? SIM_NEVER : sim_boot + ms;
+    int     slot    = -1;
+
+    for( int i = 0; i < SIM_MAX_WAKELOCKS; ++i ) {
+        if( sim_wakelock[i].name && !strcmp(sim_wakelock[i].name, name) ) {
+            slot = i;
+            break;
+        }
+        if( !sim_wakelock[i].name && slot == -1 )
+            slot = i;
+    }
+
+    if( slot == -1 ) {
+        fprintf(stderr, "iphbsim: out of wakelocks\n");
+        abort();
+    }
+
+    sim_wakelock[slot].name    = name;
+    sim_wakelock[slot].expires = expires;
+}
+
+static void sim_wakelock_unlock(const char *name)
+{
+    for( int i = 0; i < SIM_MAX_WAKELOCKS; ++i ) {
+        if( sim_wakelock[i].name && !strcmp(sim_wakelock[i].name, name) )
+            sim_wakelock[i].name = 0;
+    }
+}
+
+static bool sim_alarm_program(const struct timeval *delay)
+{
+    sim_stats.rtc_programs += 1;
+
+    int64_t ms = delay->tv_sec * 1000LL + delay->tv_usec / 1000;
+
+    if( !timerisset(delay) )
+        sim_rtc = SIM_NEVER;
+    else if( sim_timerfd )
+        /* timerfd alarms compensate for delayed wakeup checking */
+        sim_rtc = sim_boot + ms - (ms > CLIENTLIST_WAKEUP_DELAY_MS ?
+                                   CLIENTLIST_WAKEUP_DELAY_MS : 0);
+    else {
+        /* rtc alarms have one second resolution */
+        int64_t secs = (sim_boot + ms) / 1000 - sim_boot / 1000;
+        sim_rtc = (sim_boot / 1000 + (secs < 1 ? 1 : secs)) * 1000;
+    }
+
+    return true;
+}
+
+static sim_client_t *sim_client_by_fd(int fd)
+{
+    int i = fd - SIM_FD_BASE;
+    return (i >= 0 && i < sim_clients) ? &sim_client[i] : 0;
+}
+
+static bool sim_client_send(int fd, const void *data, size_t size)
+{
+    (void)data; (void)size;
+
+    sim_client_t *sc = sim_client_by_fd(fd);
+
+    if( !sc )
+        return false;
+
+    sim_stats.wakeups += 1;
+
+    if( sim_last_wakeup != sim_boot ) {
+        sim_last_wakeup = sim_boot;
+        sim_stats.wakeup_passes += 1;
+    }
+
+    /* client_wakeup() leaves maxtime untouched */
+    int64_t maxtime = sc->client->maxtime.tv_sec * 1000LL +
+                      sc->client->maxtime.tv_usec / 1000;
+
+    if( sc->resume )
+        sim_stats.resume_wakeups += 1;
+
+    /* clients not needing resume are expected to wait */
+    if( sc->resume && sim_boot > maxtime ) {
+        int64_t late = sim_boot - maxtime;
+        sim_stats.late     += 1;
+        sim_stats.lateness += late;
+        if( sim_stats.lateness_max < late )
+            sim_stats.lateness_max = late;
+    }
+
+    /* client keeps the device busy while handling the wakeup */
+    if( sim_busy < sim_boot + sim_busy_ms )
+        sim_busy = sim_boot + sim_busy_ms;
+
+    if( sc->repeat )
+        sc->rearm = sim_boot + sim_busy_ms;
+
+    return true;
+}
+
+static void sim_kernel_watch(bool enable)
+{
+    (void)enable;
+}
+
+static void sim_watchdog_sync(void)
+{
+}
+
+static const iphb_env_t sim_env =
+{
+    .get_time        = sim_get_time,
+    .timer_add       = sim_timer_add,
+    .timer_remove    = sim_timer_remove,
+    .wakelock_lock   = sim_wakelock_lock,
+    .wakelock_unlock = sim_wakelock_unlock,
+    .alarm_program   = sim_alarm_program,
+    .client_send     = sim_client_send,
+    .kernel_watch    = sim_kernel_watch,
+    .watchdog_sync   = sim_watchdog_sync,
+};
+
+/* ========================================================================= *
+ * TRACE_PARSING
+ * ========================================================================= */
+
+/** Built-in workload used when no trace file is given */
+static const char * const sim_default_trace[] =
+{
+    "0    email   240   300   resume repeat",
+    "5    chat    30    60    resume repeat",
+    "10   sync    3600  3600  resume repeat",
+    "20   weather 1800  2700  resume repeat",
+    "30   ui      10    20    repeat",
+    0
+};
+
+static sim_client_t *sim_client_lookup(const char *name)
+{
+    for( int i = 0; i < sim_clients; ++i ) {
+        if( !strcmp(sim_client[i].name, name) )
+            return &sim_client[i];
+    }
+
+    if( sim_clients == SIM_MAX_CLIENTS ) {
+        fprintf(stderr, "iphbsim: too many clients\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sim_client_t *sc = &sim_client[sim_clients];
+
+    sc->name   = strdup(name);
+    sc->client = client_new_external(SIM_FD_BASE + sim_clients);
+    sc->rearm  = SIM_NEVER;
+
+    free(sc->client->pidtxt);
+    sc->client->pidtxt = strdup(name);
+    clientlist_add_client(sc->client);
+
+    sim_clients += 1;
+    return sc;
+}
+
+static bool sim_parse_line(const char *line, int lineno)
+{
+    double when  = 0;
+    char   name[64];
+    int    mintime = 0, maxtime = 0, used = 0;
+
+    while( *line == ' ' || *line == '\t' )
+        ++line;
+
+    if( !*line || *line == '#' || *line == '\n' )
+        return true;
+
+    if( sscanf(line, "%lf %63s %d %d %n",
+               &when, name, &mintime, &maxtime, &used) < 4 ) {
+        fprintf(stderr, "iphbsim: line %d: parse error\n", lineno);
+        return false;
+    }
+
+    sim_client_t *sc = sim_client_lookup(name);
+
+    sc->mintime = mintime;
+    sc->maxtime = maxtime;
+    sc->resume  = strstr(line + used, "resume") != 0;
+    sc->repeat  = strstr(line + used, "repeat") != 0;
+
+    sim_request = realloc(sim_request, (sim_requests + 1) * sizeof *sim_request);
+    if( !sim_request )
+        abort();
+
+    sim_request[sim_requests].when   = SIM_START + (int64_t)(when * 1000);
+    sim_request[sim_requests].client = sc;
+    sim_requests += 1;
+
+    return true;
+}
+
+static int sim_request_compare_cb(const void *a, const void *b)
+{
+    const sim_request_t *r1 = a;
+    const sim_request_t *r2 = b;
+
+    return (r1->when > r2->when) - (r1->when < r2->when);
+}
+
+static bool sim_load_trace(const char *path)
+{
+    bool  ack    = false;
+    FILE *file   = 0;
+    char *line   = 0;
+    size_t size  = 0;
+    int   lineno = 0;
+
+    if( !path ) {
+        for( int i = 0; sim_default_trace[i]; ++i )
+            if( !sim_parse_line(sim_default_trace[i], i + 1) )
+                goto EXIT;
+    }
+    else {
+        if( !(file = fopen(path, "r")) ) {
+            fprintf(stderr, "iphbsim: %s: %m\n", path);
+            goto EXIT;
+        }
+        while( getline(&line, &size, file) != -1 ) {
+            if( !sim_parse_line(line, ++lineno) )
+                goto EXIT;
+        }
+    }
+
+    qsort(sim_request, sim_requests, sizeof *sim_request,
+          sim_request_compare_cb);
+
+    ack = true;
+
+EXIT:
+    free(line);
+    if( file )
+        fclose(file);
+
+    return ack;
+}
+
+/* ========================================================================= *
+ * SIMULATION
+ * ========================================================================= */
+
+/** Check if something is keeping the device out of suspend */
+static bool sim_is_awake(void)
+{
+    if( sim_busy > sim_boot )
+        return true;
+
+    for( int i = 0; i < SIM_MAX_WAKELOCKS; ++i ) {
+        if( sim_wakelock[i].name && sim_wakelock[i].expires > sim_boot )
+            return true;
+    }
+
+    return false;
+}
+
+/** Get time at which the device is allowed to suspend */
+static int64_t sim_awake_until(void)
+{
+    int64_t until = sim_busy;
+
+    for( int i = 0; i < SIM_MAX_WAKELOCKS; ++i ) {
+        if( sim_wakelock[i].name && sim_wakelock[i].expires > until )
+            until = sim_wakelock[i].expires;
+    }
+
+    return until;
+}
+
+/** Make client request using parameters from the trace */
+static void sim_client_request(sim_client_t *sc)
+{
+    struct _iphb_wait_req_t req;
+    struct timeval          now;
+
+    memset(&req, 0, sizeof req);
+    req.version    = 1;
+    req.mintime    = sc->mintime & 0xffff;
+    req.maxtime    = sc->maxtime & 0xffff;
+    req.mintime_hi = sc->mintime >> 16;
+    req.maxtime_hi = sc->maxtime >> 16;
+    req.wakeup     = sc->resume;
+
+    sc->rearm = SIM_NEVER;
+
+    if( sim_busy < sim_boot + sim_busy_ms )
+        sim_busy = sim_boot + sim_busy_ms;
+
+    sim_get_time(&now);
+    client_handle_wait_req(sc->client, &req, &now);
+
+    /* same path as requests from epoll */
+    clientlist_wakeup_clients_later(&now);
+}
+
+/** Advance virtual clocks to given boot time */
+static void sim_advance(int64_t when)
+{
+    int64_t delta = when - sim_boot;
+
+    if( delta <= 0 )
+        return;
+
+    if( sim_is_awake() )
+        sim_awake += delta;
+    else
+        sim_stats.suspended += delta;
+
+    sim_boot = when;
+}
+
+static int64_t sim_min(int64_t a, int64_t b)
+{
+    return a < b ? a : b;
+}
+
+/** Run simulation until given boot time */
+static void sim_run(int64_t end)
+{
+    struct timeval now;
+
+    while( sim_boot < end ) {
+        bool    awake = sim_is_awake();
+        int64_t next  = end;
+
+        if( sim_requests_done < sim_requests )
+            next = sim_min(next, sim_request[sim_requests_done].when);
+
+        for( int i = 0; i < sim_clients; ++i )
+            next = sim_min(next, sim_client[i].rearm);
+
+        next = sim_min(next, sim_rtc);
+
+        if( awake ) {
+            /* timers run on clock that stops during suspend */
+            for( int i = 0; i < SIM_MAX_TIMERS; ++i ) {
+                if( sim_timer[i].id )
+                    next = sim_min(next, sim_boot + sim_timer[i].due - sim_awake);
+            }
+            next = sim_min(next, sim_boot + sim_hbeat - sim_awake);
+            next = sim_min(next, sim_awake_until());
+        }
+
+        if( next < sim_boot )
+            next = sim_boot;
+
+        sim_advance(next);
+        sim_get_time(&now);
+
+        /* rtc alarm: resume from suspend */
+        if( sim_rtc <= sim_boot ) {
+            sim_rtc = SIM_NEVER;
+            if( !awake )
+                sim_stats.rtc_resumes += 1;
+            wakeup_source_set(WAKEUP_SOURCE_RTC);
+            wakelock_lock(rtc_wakeup, RTC_WAKEUP_TIMEOUT_MS);
+            clientlist_wakeup_clients_later(&now);
+            continue;
+        }
+
+        /* client activity: resume from suspend too */
+        if( sim_requests_done < sim_requests &&
+            sim_request[sim_requests_done].when <= sim_boot ) {
+            if( !sim_is_awake() )
+                sim_stats.other_resumes += 1;
+            sim_client_request(sim_request[sim_requests_done++].client);
+            continue;
+        }
+
+        bool rearmed = false;
+        for( int i = 0; i < sim_clients; ++i ) {
+            if( sim_client[i].rearm <= sim_boot ) {
+                sim_client_request(&sim_client[i]);
+                rearmed = true;
+            }
+        }
+        if( rearmed )
+            continue;
+
+        if( !awake )
+            continue;
+
+        /* expired timers */
+        for( int i = 0; i < SIM_MAX_TIMERS; ++i ) {
+            if( !sim_timer[i].id || sim_timer[i].due > sim_awake )
+                continue;
+
+            guint id = sim_timer[i].id;
+            if( sim_timer[i].cb(sim_timer[i].aptr) && sim_timer[i].id == id )
+                sim_timer[i].due = sim_awake + sim_timer[i].interval;
+            else
+                sim_timer_remove(id);
+        }
+
+        /* hwwd kicker heartbeat */
+        if( sim_hbeat <= sim_awake ) {
+            sim_hbeat = sim_awake + DSME_HEARTBEAT_INTERVAL * 1000;
+            wakeup_source_set(WAKEUP_SOURCE_HEARTBEAT);
+            clientlist_wakeup_clients_now(&now);
+        }
+
+        /* expired wakelocks */
+        for( int i = 0; i < SIM_MAX_WAKELOCKS; ++i ) {
+            if( sim_wakelock[i].name && sim_wakelock[i].expires <= sim_boot )
+                sim_wakelock[i].name = 0;
+        }
+    }
+}
+
+static void sim_report(int64_t duration)
+{
+    double hours = duration / 3600000.0;
+
+    printf("policy:              %s\n",
+           wakeup_align_repr(wakeup_align_policy));
+    printf("duration:            %.0f s\n", duration / 1000.0);
+    printf("clients:             %d\n", sim_clients);
+    printf("client wakeups:      %u\n", sim_stats.wakeups);
+    printf("wakeup instants:     %u (%.1f/hour)\n",
+           sim_stats.wakeup_passes, sim_stats.wakeup_passes / hours);
+    printf("resumes:             %u rtc, %u other (%.1f/hour)\n",
+           sim_stats.rtc_resumes, sim_stats.other_resumes,
+           (sim_stats.rtc_resumes + sim_stats.other_resumes) / hours);
+    printf("rtc programming:     %u\n", sim_stats.rtc_programs);
+    printf("resume lateness:     %.0f ms avg (%u late, max %lld ms)\n",
+           sim_stats.resume_wakeups ?
+           (double)sim_stats.lateness / sim_stats.resume_wakeups : 0.0,
+           sim_stats.late, (long long)sim_stats.lateness_max);
+    printf("suspend residency:   %.1f %%\n",
+           100.0 * sim_stats.suspended / duration);
+}
+
+static void sim_usage(const char *name)
+{
+    printf("USAGE: %s [options] [trace file]\n", name);
+    printf(
+"\n"
+"  -h --help             Print usage information\n"
+"  -d --duration <s>     Simulated time, default is one day\n"
+"  -b --busy <ms>        Time clients keep device awake after wakeup\n"
+"  -p --policy <name>    Wakeup alignment policy: legacy or stabbing\n"
+"  -t --timerfd          Resume alarms via timerfd instead of rtc\n"
+"  -v --verbose          Log iphb activity to stderr\n"
+"\n"
+"Without trace file a built-in workload is used and the results\n"
+"are sanity checked.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int64_t     duration  = 24 * 3600 * 1000LL;
+    int         verbosity = LOG_WARNING;
+    const char *trace     = 0;
+    const struct option long_options[] = {
+        { "help",     no_argument,       NULL, 'h' },
+        { "duration", required_argument, NULL, 'd' },
+        { "busy",     required_argument, NULL, 'b' },
+        { "policy",   required_argument, NULL, 'p' },
+        { "timerfd",  no_argument,       NULL, 't' },
+        { "verbose",  no_argument,       NULL, 'v' },
+        { 0, 0, 0, 0 }
+    };
+
+    for( ;; ) {
+        int opt = getopt_long(argc, argv, "hd:b:p:tv", long_options, 0);
+
+        if( opt == -1 )
+            break;
+
+        switch( opt ) {
+        case 'd':
+            duration = strtoll(optarg, 0, 0) * 1000;
+            break;
+
+        case 'b':
+            sim_busy_ms = strtol(optarg, 0, 0);
+            break;
+
+        case 'p':
+            if( !strcmp(optarg, "stabbing") )
+                wakeup_align_policy = WAKEUP_ALIGN_STABBING;
+            else if( !strcmp(optarg, "legacy") )
+                wakeup_align_policy = WAKEUP_ALIGN_LEGACY;
+            else {
+                fprintf(stderr, "iphbsim: unknown policy '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 't':
+            sim_timerfd = true;
+            break;
+
+        case 'v':
+            verbosity = LOG_DEBUG;
+            break;
+
+        case 'h':
+            sim_usage(argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            fprintf(stderr, "(use --help for instructions)\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if( optind < argc )
+        trace = argv[optind++];
+
+    dsme_log_open(LOG_METHOD_STDERR, verbosity, false, "iphbsim: ",
+                  0, 0, 0);
+
+    iphb_env = &sim_env;
+
+    if( !sim_load_trace(trace) )
+        return EXIT_FAILURE;
+
+    sim_run(SIM_START + duration);
+    sim_report(duration);
+
+    int exit_code = EXIT_SUCCESS;
+
+    /* The built-in workload doubles as a test case: all clients must
+     * get woken up, and within rtc and delayed wakeup check latency */
+    if( !trace ) {
+        for( int i = 0; i < sim_clients; ++i ) {
+            if( !sim_client[i].client->stat_wakeups ) {
+                printf("FAIL: client %s never woken up\n", sim_client[i].name);
+                exit_code = EXIT_FAILURE;
+            }
+        }
+        if( sim_stats.lateness_max > 1500 ) {
+            printf("FAIL: wakeups delivered too late\n");
+            exit_code = EXIT_FAILURE;
+        }
+    }
+
+    dsme_log_close();
+
+    return exit_code;
+}
@@ -0,0 +1,184 @@
+/**
+   @file logringtest.c
+
+   Stress test for the lockless logging ring buffer.
+   <p>
+   Several producer threads log variable length messages concurrently
+   while the logging thread consumes them. Every message received by
+   the logging backend is checked for sane priority, intact payload
+   and per producer ordering. Messages may be lost due to ring buffer
+   overflow, but the ones that get through must not be corrupted.
+   <p>
+   Copyright (C) 2015 Jolla Ltd.
+
+   This file is part of Dsme.
+
+   Dsme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Dsme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Dsme.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* INTRUSIONS */
+
+#include "../dsme/logging.c"
+
+/* INCLUDES */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* ========================================================================= *
+ * STUBS
+ * ========================================================================= */
+
+const module_t *current_module(void)           { return 0; }
+const char     *module_name(const module_t *m) { (void)m; return "test"; }
+const char     *current_module_name(void)      { return 0; }
+uint32_t        current_message_type(void)     { return 0; }
+pid_t           current_sender_pid(void)       { return 0; }
+
+/* ========================================================================= *
+ * TEST
+ * ========================================================================= */
+
+#define PRODUCER_COUNT    8
+#define MESSAGE_COUNT     20000
+#define PAYLOAD_MAX       200
+
+/** Last sequence number seen from each producer, -1 = none yet */
+static int      last_seq[PRODUCER_COUNT];
+
+/** Number of intact messages received */
+static unsigned received = 0;
+
+/** Number of lost messages reported via overflow notifications */
+static unsigned reported_lost = 0;
+
+/** Number of corrupted / out of order messages received */
+static unsigned errors = 0;
+
+static void check_error(const char *what, int prio, const char *message)
+{
+    if( ++errors <= 10 )
+        fprintf(stderr, "%s: prio=%d message=\"%.60s\"\n",
+                what, prio, message);
+}
+
+/** Logging backend replacement; called from the logging thread only */
+static void check_message(int prio, const char *message)
+{
+    int      producer = -1;
+    int      seq      = -1;
+    int      offs     = 0;
+    unsigned lost     = 0;
+
+    if( prio < LOG_EMERG || prio > LOG_DEBUG ) {
+        check_error("invalid priority", prio, message);
+        goto EXIT;
+    }
+
+    if( sscanf(message, "logging ringbuffer overflow; %u messages lost",
+               &lost) == 1 ) {
+        reported_lost += lost;
+        goto EXIT;
+    }
+
+    if( sscanf(message, "producer %d seq %d %n", &producer, &seq, &offs) < 2 ||
+        producer < 0 || producer >= PRODUCER_COUNT || seq < 0 ) {
+        check_error("unexpected message", prio, message);
+        goto EXIT;
+    }
+
+    if( prio != LOG_EMERG + seq % (LOG_DEBUG + 1) ) {
+        check_error("priority mismatch", prio, message);
+        goto EXIT;
+    }
+
+    const char *payload = message + offs;
+    size_t      len     = seq % PAYLOAD_MAX;
+
+    if( strlen(payload) != len ||
+        strspn(payload, (char[]){ (char)('a' + producer), 0 }) != len ) {
+        check_error("corrupted payload", prio, message);
+        goto EXIT;
+    }
+
+    if( seq <= last_seq[producer] ) {
+        check_error("out of order", prio, message);
+        goto EXIT;
+    }
+
+    last_seq[producer] = seq;
+    ++received;
+
+EXIT:
+    return;
+}
+
+static void *producer_thread(void *aptr)
+{
+    int  producer = (int)(intptr_t)aptr;
+    char payload[PAYLOAD_MAX];
+
+    for( int seq = 0; seq < MESSAGE_COUNT; ++seq ) {
+        size_t len = seq % PAYLOAD_MAX;
+        memset(payload, 'a' + producer, len);
+        payload[len] = 0;
+        dsme_log_txt(LOG_EMERG + seq % (LOG_DEBUG + 1),
+                     "producer %d seq %d %s", producer, seq, payload);
+
+        /* Give the logging thread a chance to keep up, so that the
+         * ring buffer wraps around many times instead of just
+         * overflowing once */
+        sched_yield();
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    pthread_t threads[PRODUCER_COUNT];
+
+    for( int i = 0; i < PRODUCER_COUNT; ++i )
+        last_seq[i] = -1;
+
+    if( !dsme_log_open(LOG_METHOD_STDERR, LOG_DEBUG, false, "logringtest",
+                       0, 0, 0) ) {
+        fprintf(stderr, "could not open logging\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Checking happens in the logging thread, instead of printing */
+    dsme_log_routine = check_message;
+
+    for( int i = 0; i < PRODUCER_COUNT; ++i ) {
+        if( pthread_create(&threads[i], 0, producer_thread,
+                           (void *)(intptr_t)i) != 0 ) {
+            fprintf(stderr, "could not create producer thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for( int i = 0; i < PRODUCER_COUNT; ++i )
+        pthread_join(threads[i], 0);
+
+    /* Stops the logging thread and drains whatever is left */
+    dsme_log_close();
+
+    printf("received %u of %u messages, %u reported lost, %u errors\n",
+           received, PRODUCER_COUNT * MESSAGE_COUNT, reported_lost, errors);
+
+    return (errors == 0 && received > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -28,6 +28,7 @@
 #define _GNU_SOURCE
 
 #include "../modules/dbusproxy.h"
+#include "../modules/iphbstats.h"
 #include "../modules/state-internal.h"
 #include "../include/dsme/logging.h"
 
@@ -98,13 +99,14 @@ static dsmemsg_generic_t *dsmeipc_read(void);
 
 static void               xdsme_query_version(bool testmode);
 static void               xdsme_query_runlevel(void);
+static void               xdsme_query_iphb_stats(void);
 static void               xdsme_request_dbus_connect(void);
 static void               xdsme_request_dbus_disconnect(void);
 static void               xdsme_request_reboot(void);
 static void               xdsme_request_shutdown(void);
 static void               xdsme_request_powerup(void);
 static void               xdsme_request_runlevel(const char *runlevel);
-static void               xdsme_request_loglevel(unsigned level);
+static void               xdsme_request_loglevel(const char *module, unsigned level);
 
 /* ------------------------------------------------------------------------- *
  * RTC_OPTIONS
@@ -363,6 +365,39 @@ static void xdsme_query_version(bool testmode)
     free(version);
 }
 
+static void xdsme_query_iphb_stats(void)
+{
+    DSM_MSGTYPE_IPHB_STATS_QUERY req =
+          DSME_MSG_INIT(DSM_MSGTYPE_IPHB_STATS_QUERY);
+
+    int64_t timeout = DSMEIPC_WAIT_DEFAULT;
+    char   *report  = 0;
+
+    dsmeipc_send(&req);
+
+    while( dsmeipc_wait(&timeout) ) {
+        dsmemsg_generic_t *msg = dsmeipc_read();
+
+        DSM_MSGTYPE_IPHB_STATS *rsp =
+            DSMEMSG_CAST(DSM_MSGTYPE_IPHB_STATS, msg);
+
+        if( rsp ) {
+            const char *data = DSMEMSG_EXTRA(rsp);
+            size_t      size = DSMEMSG_EXTRA_SIZE(rsp);
+            report = strndup(data, size);
+        }
+
+        free(msg);
+
+        if( rsp )
+            break;
+    }
+
+    printf("%s", report ?: "iphb statistics not available\n");
+
+    free(report);
+}
+
 static void xdsme_query_runlevel(void)
 {
     DSM_MSGTYPE_STATE_QUERY req = DSME_MSG_INIT(DSM_MSGTYPE_STATE_QUERY);
@@ -432,13 +467,16 @@ static void xdsme_request_runlevel(const char *runlevel)
     dsmeipc_send_with_string(&req, runlevel);
 }
 
-static void xdsme_request_loglevel(unsigned level)
+static void xdsme_request_loglevel(const char *module, unsigned level)
 {
     DSM_MSGTYPE_SET_LOGGING_VERBOSITY req =
         DSME_MSG_INIT(DSM_MSGTYPE_SET_LOGGING_VERBOSITY);
     req.verbosity = level;
 
-    dsmeipc_send(&req);
+    if( module )
+        dsmeipc_send_with_string(&req, module);
+    else
+        dsmeipc_send(&req);
 }
 
 /* ========================================================================= *
@@ -562,7 +600,8 @@ static void output_usage(const char *name)
 "  -h --help                       Print usage information\n"
 "  -v --version                    Print the versions of DSME and dsmetool\n"
 "  -V --verbose                    Make dsmetool more verbose\n"
-"  -l --loglevel <0..7>            Change DSME's logging verbosity\n"
+"  -l --loglevel [<module>:]<0..7> Change DSME's logging verbosity,\n"
+"                                   optionally for one module only\n"
 "\n"
 "  -g --get-state                  Print device state, i.e. one of\n"
 "                                   SHUTDOWN USER ACTDEAD REBOOT BOOT\n"
@@ -574,6 +613,7 @@ static void output_usage(const char *name)
 "                                   SHUTDOWN USER ACTDEAD REBOOT\n"
 "\n"
 "  -c --clear-rtc                  Clear RTC alarms\n"
+"  -i --iphb-stats                 Print IP heartbeat wakeup statistics\n"
 "\n"
 "  -d --start-dbus                 Start DSME's D-Bus services\n"
 "  -s --stop-dbus                  Stop DSME's D-Bus services\n"
@@ -589,7 +629,7 @@ int main(int argc, char *argv[])
 {
     const char *program_name  = argv[0];
     int         retval        = EXIT_FAILURE;
-    const char *short_options = "hdsbvact:l:guoV";
+    const char *short_options = "hdsbvact:l:guoVi";
     const struct option long_options[] = {
         {"help",       no_argument,       NULL, 'h'},
         {"start-dbus", no_argument,       NULL, 'd'},
@@ -603,6 +643,7 @@ int main(int argc, char *argv[])
         {"telinit",    required_argument, NULL, 't'},
         {"loglevel",   required_argument, NULL, 'l'},
         {"verbose",    no_argument,       NULL, 'V'},
+        {"iphb-stats", no_argument,       NULL, 'i'},
         {0, 0, 0, 0}
     };
 
@@ -652,8 +693,21 @@ int main(int argc, char *argv[])
             xdsme_query_runlevel();
             break;
 
+        case 'i':
+            xdsme_query_iphb_stats();
+            break;
+
         case 'l':
-            xdsme_request_loglevel(parse_loglevel(optarg));
+            {
+                char *level = strrchr(optarg, ':');
+                if( level ) {
+                    *level++ = 0;
+                    xdsme_request_loglevel(optarg, parse_loglevel(level));
+                }
+                else {
+                    xdsme_request_loglevel(0, parse_loglevel(optarg));
+                }
+            }
             break;
 
         case 'c':
@@ -0,0 +1,241 @@
+/**
+   @file dsmetrace.c
+
+   Dumps the contents of a DSME trace ring file.
+   <p>
+   By default the trace left behind by the previous boot is shown.
+   <p>
+   Copyright (C) 2015 Jolla Ltd.
+
+   This file is part of Dsme.
+
+   Dsme is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Dsme is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Dsme.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "../include/dsme/logtrace.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ME "dsmetrace: "
+
+static const char *prio_name(int prio)
+{
+    static const char * const lut[] =
+    {
+        "emerg", "alert", "crit", "err",
+        "warning", "notice", "info", "debug",
+    };
+
+    return (prio >= 0 && prio <= LOG_DEBUG) ? lut[prio] : "log";
+}
+
+/** Read whole trace file to memory
+ *
+ * @return file contents, or NULL on failure
+ */
+static char *read_trace(const char *path)
+{
+    char *data = 0;
+    int   fd   = -1;
+    size_t done = 0;
+
+    if( (fd = open(path, O_RDONLY)) == -1 ) {
+        fprintf(stderr, ME "%s: open: %s\n", path, strerror(errno));
+        goto EXIT;
+    }
+
+    if( !(data = calloc(1, DSME_TRACE_FILE_SIZE)) )
+        goto EXIT;
+
+    while( done < DSME_TRACE_FILE_SIZE ) {
+        ssize_t rc = read(fd, data + done, DSME_TRACE_FILE_SIZE - done);
+        if( rc == 0 )
+            break;
+        if( rc < 0 ) {
+            if( errno == EINTR )
+                continue;
+            fprintf(stderr, ME "%s: read: %s\n", path, strerror(errno));
+            free(data), data = 0;
+            goto EXIT;
+        }
+        done += rc;
+    }
+
+    const dsme_trace_header_t *hdr = (const dsme_trace_header_t *)data;
+
+    if( done < DSME_TRACE_FILE_SIZE ||
+        memcmp(hdr->magic, DSME_TRACE_MAGIC, sizeof hdr->magic) ||
+        hdr->header_size != DSME_TRACE_HEADER_SIZE ||
+        hdr->data_size   != DSME_TRACE_DATA_SIZE ) {
+        fprintf(stderr, ME "%s: not a dsme trace file\n", path);
+        free(data), data = 0;
+    }
+
+EXIT:
+    if( fd != -1 ) close(fd);
+
+    return data;
+}
+
+/** Check if there is a complete record at given data offset
+ *
+ * @return record size, or zero if there is no valid record
+ */
+static size_t valid_record(const char *data, size_t offs)
+{
+    const dsme_trace_record_t *rec = (const dsme_trace_record_t *)(data + offs);
+    size_t size = rec->size;
+
+    if( size <= sizeof *rec || size % DSME_TRACE_ALIGN ||
+        size > DSME_TRACE_DATA_SIZE - offs ||
+        size > sizeof *rec + DSME_TRACE_MAX_TEXT + DSME_TRACE_ALIGN )
+        return 0;
+
+    size_t max = size - sizeof *rec;
+    size_t len = strnlen(rec->text, max);
+
+    if( len == max )
+        return 0;
+
+    if( dsme_trace_record_check(rec, len + 1) != rec->check )
+        return 0;
+
+    return size;
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+    const dsme_trace_record_t *ra = *(const dsme_trace_record_t * const *)a;
+    const dsme_trace_record_t *rb = *(const dsme_trace_record_t * const *)b;
+
+    /* Sequence numbers may have wrapped around */
+    int32_t diff = (int32_t)(ra->seq - rb->seq);
+    return (diff > 0) - (diff < 0);
+}
+
+static bool dump_trace(const char *path)
+{
+    bool                        ack  = false;
+    char                       *file = 0;
+    const dsme_trace_record_t **vec  = 0;
+    size_t                      cnt  = 0;
+
+    if( !(file = read_trace(path)) )
+        goto EXIT;
+
+    const dsme_trace_header_t *hdr  = (const dsme_trace_header_t *)file;
+    const char                *data = file + DSME_TRACE_HEADER_SIZE;
+
+    vec = calloc(DSME_TRACE_DATA_SIZE / sizeof(dsme_trace_record_t),
+                 sizeof *vec);
+    if( !vec )
+        goto EXIT;
+
+    /* Old records might have been partially overwritten, so scan
+     * all aligned offsets instead of just following record sizes */
+    for( size_t offs = 0; offs < DSME_TRACE_DATA_SIZE; ) {
+        size_t size = valid_record(data, offs);
+        if( size ) {
+            vec[cnt++] = (const dsme_trace_record_t *)(data + offs);
+            offs += size;
+        }
+        else {
+            offs += DSME_TRACE_ALIGN;
+        }
+    }
+
+    qsort(vec, cnt, sizeof *vec, compare_seq);
+
+    printf("# boot %.*s, %zu records\n",
+           (int)strnlen(hdr->boot_id, sizeof hdr->boot_id), hdr->boot_id,
+           cnt);
+
+    for( size_t i = 0; i < cnt; ++i ) {
+        const dsme_trace_record_t *rec = vec[i];
+        time_t    t = (time_t)(rec->time_ms / 1000);
+        struct tm tm;
+        char      when[32];
+
+        localtime_r(&t, &tm);
+        strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", &tm);
+        printf("%s.%03u %s: %s\n", when, (unsigned)(rec->time_ms % 1000),
+               prio_name(rec->prio), rec->text);
+    }
+
+    ack = true;
+
+EXIT:
+    free(vec);
+    free(file);
+
+    return ack;
+}
+
+static void usage(const char *name)
+{
+    printf("USAGE: %s [options] [trace file]\n", name);
+    printf(
+"\n"
+"  -h --help      Print usage information\n"
+"  -c --current   Dump trace of the current boot\n"
+"\n"
+"Without options the trace from the previous boot (%s) is shown.\n",
+           DSME_TRACE_FILE_PREV);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = DSME_TRACE_FILE_PREV;
+    const struct option long_options[] = {
+        { "help",    no_argument, NULL, 'h' },
+        { "current", no_argument, NULL, 'c' },
+        { 0, 0, 0, 0 }
+    };
+
+    for( ;; ) {
+        int opt = getopt_long(argc, argv, "hc", long_options, 0);
+
+        if( opt == -1 )
+            break;
+
+        switch( opt ) {
+        case 'c':
+            path = DSME_TRACE_FILE;
+            break;
+
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            fprintf(stderr, "(use --help for instructions)\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if( optind < argc )
+        path = argv[optind++];
+
+    return dump_trace(path) ? EXIT_SUCCESS : EXIT_FAILURE;
+}